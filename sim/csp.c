@@ -0,0 +1,860 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/csp_crc32.h>
+#include <csp/interfaces/csp_if_kiss.h>
+
+/**
+ * Just enough of libcsp 1.x for the node: a bounded buffer pool,
+ * connections and sockets, static routes, the KISS interface (with its
+ * CRC32) and a simplified RDP. RDP does the handshake, window and close
+ * the way libcsp does but never retransmits, so a lost ACK shows up as
+ * a stalled window and a failed csp_send, just like a dead link does.
+ */
+
+#define BUFFER_SIZE 256
+#define CONN_COUNT 8
+#define CONN_QUEUE 10
+#define PORT_COUNT 64
+/* Outgoing ports are handed out from here up */
+#define EPHEMERAL_PORT 48
+
+#define RDP_HEADER_SIZE 5
+#define RDP_SYN 0x08
+#define RDP_ACK 0x04
+#define RDP_EAK 0x02
+#define RDP_RST 0x01
+
+#define KISS_FEND 0xC0
+#define KISS_FESC 0xDB
+#define KISS_TFEND 0xDC
+#define KISS_TFESC 0xDD
+#define KISS_TNC_DATA 0x00
+
+typedef enum {
+    CONN_CLOSED = 0,
+    CONN_SYN_SENT,
+    CONN_OPEN,
+    CONN_RESET
+} conn_state_t;
+
+struct csp_conn_s {
+    bool used;
+    bool rdp;
+    csp_id_t idout;
+    conn_state_t state;
+    csp_queue_handle_t rx;
+    /* RDP send state: next sequence number and oldest unacknowledged */
+    uint16_t snd_nxt;
+    uint16_t snd_una;
+    uint16_t rcv_cur;
+    pthread_cond_t changed;
+};
+
+struct csp_socket_s {
+    csp_queue_handle_t accept;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_mutex_t pool_lock;
+    uint8_t address;
+    int buffers_used;
+    int buffers_max;
+    uint32_t buffers_failed;
+    int window;
+    struct csp_conn_s conns[CONN_COUNT];
+    csp_socket_t * ports[PORT_COUNT];
+    csp_socket_t * any;
+    uint8_t next_port;
+    csp_iface_t * routes[32];
+    pthread_mutex_t tx_lock;
+} csp = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .pool_lock = PTHREAD_MUTEX_INITIALIZER,
+    .tx_lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+
+int csp_init(uint8_t my_node_address)
+{
+    pthread_condattr_t monotonic;
+    int i;
+
+    pthread_condattr_init(&monotonic);
+    pthread_condattr_setclock(&monotonic, CLOCK_MONOTONIC);
+
+    csp.address = my_node_address;
+    csp.buffers_max = sim_env_long("UKUB_SIM_CSP_BUFFERS", 20);
+    csp.window = sim_env_long("UKUB_SIM_RDP_WINDOW", 4);
+    csp.next_port = EPHEMERAL_PORT;
+
+    for (i = 0; i < CONN_COUNT; i++)
+    {
+        pthread_cond_init(&csp.conns[i].changed, &monotonic);
+    }
+
+    return 0;
+}
+
+
+void * csp_buffer_get(size_t size)
+{
+    csp_packet_t * packet = NULL;
+
+    pthread_mutex_lock(&csp.pool_lock);
+    if (size <= BUFFER_SIZE && csp.buffers_used < csp.buffers_max)
+    {
+        csp.buffers_used++;
+        packet = calloc(1, sizeof(csp_packet_t) + BUFFER_SIZE);
+    }
+    else
+    {
+        csp.buffers_failed++;
+    }
+    pthread_mutex_unlock(&csp.pool_lock);
+
+    return packet;
+}
+
+
+void csp_buffer_free(void * packet)
+{
+    if (packet == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&csp.pool_lock);
+    csp.buffers_used--;
+    pthread_mutex_unlock(&csp.pool_lock);
+
+    free(packet);
+}
+
+
+int csp_buffer_remaining(void)
+{
+    return csp.buffers_max - csp.buffers_used;
+}
+
+
+int csp_buffer_size(void)
+{
+    return BUFFER_SIZE;
+}
+
+
+int csp_route_set(uint8_t node, csp_iface_t * ifc, uint8_t nexthop_mac_addr)
+{
+    (void) nexthop_mac_addr;
+
+    if (node >= 32)
+    {
+        return -1;
+    }
+
+    csp.routes[node] = ifc;
+
+    return 0;
+}
+
+
+/**
+ * route_out: hand a packet to the interface routed to its destination.
+ * The interface takes the packet; with no route it is left to the caller.
+ */
+
+static int route_out(csp_packet_t * packet, uint32_t timeout)
+{
+    csp_iface_t * ifc = csp.routes[packet->id.dst];
+    int ret;
+
+    if (ifc == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&csp.tx_lock);
+    ret = ifc->nexthop(ifc, packet, timeout);
+    pthread_mutex_unlock(&csp.tx_lock);
+
+    if (ret == 0)
+    {
+        ifc->tx++;
+    }
+    else
+    {
+        ifc->tx_error++;
+    }
+
+    return ret;
+}
+
+
+/* Send an RDP control segment on a connection; csp.lock must be held */
+static void rdp_control(csp_conn_t * conn, uint8_t flags, uint16_t seq)
+{
+    csp_packet_t * packet;
+    uint8_t * header;
+
+    if ((packet = csp_buffer_get(RDP_HEADER_SIZE)) == NULL)
+    {
+        return;
+    }
+
+    header = packet->data;
+    header[0] = flags;
+    header[1] = seq >> 8;
+    header[2] = seq & 0xFF;
+    header[3] = conn->rcv_cur >> 8;
+    header[4] = conn->rcv_cur & 0xFF;
+    packet->length = RDP_HEADER_SIZE;
+    packet->id = conn->idout;
+
+    pthread_mutex_unlock(&csp.lock);
+    if (route_out(packet, 0) != 0)
+    {
+        csp_buffer_free(packet);
+    }
+    pthread_mutex_lock(&csp.lock);
+}
+
+
+static bool conn_wait(csp_conn_t * conn, uint32_t timeout)
+{
+    struct timespec when;
+
+    if (timeout == CSP_MAX_DELAY)
+    {
+        pthread_cond_wait(&conn->changed, &csp.lock);
+        return true;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &when);
+    when.tv_sec += timeout / 1000;
+    when.tv_nsec += (long)(timeout % 1000) * 1000000;
+    if (when.tv_nsec >= 1000000000)
+    {
+        when.tv_sec++;
+        when.tv_nsec -= 1000000000;
+    }
+
+    return pthread_cond_timedwait(&conn->changed, &csp.lock, &when) == 0;
+}
+
+
+static csp_conn_t * conn_new(void)
+{
+    int i;
+
+    for (i = 0; i < CONN_COUNT; i++)
+    {
+        if (!csp.conns[i].used)
+        {
+            csp.conns[i].used = true;
+            csp.conns[i].rdp = false;
+            csp.conns[i].state = CONN_OPEN;
+            csp.conns[i].rx = csp_queue_create(CONN_QUEUE, sizeof(csp_packet_t *));
+            return &csp.conns[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Release a connection and any packets still queued on it */
+static void conn_free(csp_conn_t * conn)
+{
+    csp_packet_t * packet;
+
+    while (csp_queue_dequeue(conn->rx, &packet, 0) == CSP_QUEUE_OK)
+    {
+        csp_buffer_free(packet);
+    }
+
+    csp_queue_remove(conn->rx);
+    conn->used = false;
+    conn->state = CONN_CLOSED;
+}
+
+
+csp_conn_t * csp_connect(uint8_t prio, uint8_t dest, uint8_t dport, uint32_t timeout, uint32_t opts)
+{
+    csp_conn_t * conn;
+    uint32_t start = csp_get_ms();
+    uint32_t waited;
+
+    pthread_mutex_lock(&csp.lock);
+
+    if ((conn = conn_new()) == NULL)
+    {
+        pthread_mutex_unlock(&csp.lock);
+        return NULL;
+    }
+
+    conn->idout.ext = 0;
+    conn->idout.pri = prio;
+    conn->idout.src = csp.address;
+    conn->idout.dst = dest;
+    conn->idout.dport = dport;
+    conn->idout.sport = csp.next_port;
+    csp.next_port = (csp.next_port + 1 < PORT_COUNT) ? csp.next_port + 1 : EPHEMERAL_PORT;
+
+    if (opts & CSP_O_RDP)
+    {
+        conn->rdp = true;
+        conn->idout.flags |= CSP_FRDP;
+        conn->state = CONN_SYN_SENT;
+        conn->snd_una = conn->snd_nxt = rand() & 0xFFFF;
+        conn->rcv_cur = 0;
+
+        rdp_control(conn, RDP_SYN, conn->snd_nxt++);
+
+        while (conn->state == CONN_SYN_SENT &&
+               (waited = csp_get_ms() - start) < timeout &&
+               conn_wait(conn, timeout - waited));
+
+        if (conn->state != CONN_OPEN)
+        {
+            conn_free(conn);
+            conn = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&csp.lock);
+
+    return conn;
+}
+
+
+int csp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout)
+{
+    uint32_t start = csp_get_ms();
+    uint32_t waited;
+    uint8_t * header;
+
+    if (conn == NULL || packet == NULL)
+    {
+        return 0;
+    }
+
+    packet->id = conn->idout;
+
+    if (conn->rdp)
+    {
+        pthread_mutex_lock(&csp.lock);
+
+        /* Wait for room in the window, as libcsp does */
+        while (conn->state == CONN_OPEN &&
+               (uint16_t)(conn->snd_nxt - conn->snd_una) >= csp.window &&
+               (waited = csp_get_ms() - start) < timeout &&
+               conn_wait(conn, timeout - waited));
+
+        if (conn->state != CONN_OPEN ||
+            (uint16_t)(conn->snd_nxt - conn->snd_una) >= csp.window)
+        {
+            pthread_mutex_unlock(&csp.lock);
+            return 0;
+        }
+
+        header = packet->data + packet->length;
+        header[0] = RDP_ACK;
+        header[1] = conn->snd_nxt >> 8;
+        header[2] = conn->snd_nxt & 0xFF;
+        header[3] = conn->rcv_cur >> 8;
+        header[4] = conn->rcv_cur & 0xFF;
+        packet->length += RDP_HEADER_SIZE;
+        conn->snd_nxt++;
+
+        pthread_mutex_unlock(&csp.lock);
+    }
+
+    /* Without a route the caller still owns the packet */
+    return route_out(packet, timeout) == 0;
+}
+
+
+int csp_close(csp_conn_t * conn)
+{
+    if (conn == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&csp.lock);
+
+    if (conn->rdp && conn->state == CONN_OPEN)
+    {
+        rdp_control(conn, RDP_RST | RDP_ACK, conn->snd_nxt);
+    }
+
+    conn_free(conn);
+
+    pthread_mutex_unlock(&csp.lock);
+
+    return 0;
+}
+
+
+csp_socket_t * csp_socket(uint32_t opts)
+{
+    (void) opts;
+
+    return calloc(1, sizeof(csp_socket_t));
+}
+
+
+int csp_bind(csp_socket_t * socket, uint8_t port)
+{
+    if (port == CSP_ANY)
+    {
+        csp.any = socket;
+    }
+    else if (port < PORT_COUNT)
+    {
+        csp.ports[port] = socket;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int csp_listen(csp_socket_t * socket, size_t conn_queue_length)
+{
+    socket->accept = csp_queue_create(conn_queue_length, sizeof(csp_conn_t *));
+
+    return 0;
+}
+
+
+csp_conn_t * csp_accept(csp_socket_t * socket, uint32_t timeout)
+{
+    csp_conn_t * conn;
+
+    if (csp_queue_dequeue(socket->accept, &conn, timeout) != CSP_QUEUE_OK)
+    {
+        return NULL;
+    }
+
+    return conn;
+}
+
+
+csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout)
+{
+    csp_packet_t * packet;
+
+    if (csp_queue_dequeue(conn->rx, &packet, timeout) != CSP_QUEUE_OK)
+    {
+        return NULL;
+    }
+
+    return packet;
+}
+
+
+int csp_conn_dport(csp_conn_t * conn)
+{
+    return conn->idout.sport;
+}
+
+
+int csp_conn_sport(csp_conn_t * conn)
+{
+    return conn->idout.dport;
+}
+
+
+int csp_conn_src(csp_conn_t * conn)
+{
+    return conn->idout.dst;
+}
+
+
+int csp_conn_dst(csp_conn_t * conn)
+{
+    return conn->idout.src;
+}
+
+
+void csp_service_handler(csp_conn_t * conn, csp_packet_t * packet)
+{
+    (void) conn;
+
+    csp_buffer_free(packet);
+}
+
+
+/* Handle an RDP segment on a client connection; csp.lock must be held */
+static void rdp_receive(csp_conn_t * conn, csp_packet_t * packet)
+{
+    uint8_t * header;
+    uint8_t flags;
+    uint16_t seq;
+    uint16_t ack;
+
+    if (packet->length < RDP_HEADER_SIZE)
+    {
+        csp_buffer_free(packet);
+        return;
+    }
+
+    packet->length -= RDP_HEADER_SIZE;
+    header = packet->data + packet->length;
+    flags = header[0];
+    seq = (header[1] << 8) | header[2];
+    ack = (header[3] << 8) | header[4];
+
+    if (flags & RDP_RST)
+    {
+        conn->state = CONN_RESET;
+    }
+    else if (conn->state == CONN_SYN_SENT && (flags & RDP_SYN) && (flags & RDP_ACK))
+    {
+        conn->rcv_cur = seq;
+        conn->snd_una = ack + 1;
+        conn->state = CONN_OPEN;
+        rdp_control(conn, RDP_ACK, conn->snd_nxt);
+    }
+    else if (conn->state == CONN_OPEN && (flags & RDP_ACK))
+    {
+        /* Everything up to and including ack has arrived */
+        if ((uint16_t)(ack + 1 - conn->snd_una) <= (uint16_t)(conn->snd_nxt - conn->snd_una))
+        {
+            conn->snd_una = ack + 1;
+        }
+
+        if (packet->length > 0 && seq == (uint16_t)(conn->rcv_cur + 1))
+        {
+            conn->rcv_cur = seq;
+            rdp_control(conn, RDP_ACK, conn->snd_nxt);
+
+            if (csp_queue_enqueue(conn->rx, &packet, 0) == CSP_QUEUE_OK)
+            {
+                packet = NULL;
+            }
+        }
+    }
+
+    pthread_cond_broadcast(&conn->changed);
+    csp_buffer_free(packet);
+}
+
+
+/**
+ * csp_new_packet: route a packet that came in on an interface. In libcsp
+ * this goes through the router task; here it runs on the caller's thread.
+ */
+
+void csp_new_packet(csp_packet_t * packet, csp_iface_t * ifc, void * pxTaskWoken)
+{
+    csp_socket_t * socket;
+    csp_conn_t * conn = NULL;
+    int i;
+
+    (void) pxTaskWoken;
+
+    ifc->rx++;
+
+    if (packet->id.dst != csp.address)
+    {
+        ifc->drop++;
+        csp_buffer_free(packet);
+        return;
+    }
+
+    pthread_mutex_lock(&csp.lock);
+
+    for (i = 0; i < CONN_COUNT; i++)
+    {
+        if (csp.conns[i].used &&
+            csp.conns[i].idout.sport == packet->id.dport &&
+            csp.conns[i].idout.dport == packet->id.sport &&
+            csp.conns[i].idout.dst == packet->id.src)
+        {
+            conn = &csp.conns[i];
+            break;
+        }
+    }
+
+    if (conn != NULL && conn->rdp)
+    {
+        rdp_receive(conn, packet);
+        pthread_mutex_unlock(&csp.lock);
+        return;
+    }
+
+    if (conn == NULL)
+    {
+        socket = (packet->id.dport < PORT_COUNT) ? csp.ports[packet->id.dport] : NULL;
+        if (socket == NULL)
+        {
+            socket = csp.any;
+        }
+
+        /* Incoming RDP connections aren't simulated */
+        if (socket == NULL || socket->accept == NULL || (packet->id.flags & CSP_FRDP) ||
+            (conn = conn_new()) == NULL)
+        {
+            pthread_mutex_unlock(&csp.lock);
+            ifc->drop++;
+            csp_buffer_free(packet);
+            return;
+        }
+
+        conn->idout.ext = 0;
+        conn->idout.pri = packet->id.pri;
+        conn->idout.src = csp.address;
+        conn->idout.dst = packet->id.src;
+        conn->idout.dport = packet->id.sport;
+        conn->idout.sport = packet->id.dport;
+
+        if (csp_queue_enqueue(socket->accept, &conn, 0) != CSP_QUEUE_OK)
+        {
+            conn_free(conn);
+            pthread_mutex_unlock(&csp.lock);
+            ifc->drop++;
+            csp_buffer_free(packet);
+            return;
+        }
+    }
+
+    if (csp_queue_enqueue(conn->rx, &packet, 0) != CSP_QUEUE_OK)
+    {
+        ifc->drop++;
+        csp_buffer_free(packet);
+    }
+
+    pthread_mutex_unlock(&csp.lock);
+}
+
+
+/* CRC32-C, as libcsp's */
+uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    int bit;
+
+    while (length--)
+    {
+        crc ^= *data++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+        }
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+
+void csp_kiss_init(csp_iface_t * csp_iface, csp_kiss_handle_t * csp_kiss_handle,
+                   csp_kiss_putc_f kiss_putc_f, csp_kiss_discard_f kiss_discard_f,
+                   const char * name)
+{
+    csp_kiss_handle->kiss_putc = kiss_putc_f;
+    csp_kiss_handle->kiss_discard = kiss_discard_f;
+    csp_kiss_handle->rx_length = 0;
+    csp_kiss_handle->rx_mode = KISS_MODE_NOT_STARTED;
+    csp_kiss_handle->rx_first = 0;
+    csp_kiss_handle->rx_packet = NULL;
+
+    csp_iface->driver = csp_kiss_handle;
+    csp_iface->nexthop = csp_kiss_tx;
+    csp_iface->name = name;
+    csp_iface->mtu = BUFFER_SIZE;
+}
+
+
+int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout)
+{
+    csp_kiss_handle_t * driver = interface->driver;
+    uint32_t crc = htonl(csp_crc32_memory(packet->data, packet->length));
+    uint8_t * bytes;
+    unsigned int i;
+
+    (void) timeout;
+
+    /* Same framing as libcsp: CRC32 on the data, then the id in front */
+    memcpy(packet->data + packet->length, &crc, sizeof(crc));
+    packet->length += sizeof(crc);
+    packet->id.ext = htonl(packet->id.ext);
+    packet->length += sizeof(packet->id.ext);
+    bytes = (uint8_t *) &packet->id.ext;
+
+    driver->kiss_putc(KISS_FEND);
+    driver->kiss_putc(KISS_TNC_DATA);
+
+    for (i = 0; i < packet->length; i++)
+    {
+        if (bytes[i] == KISS_FEND)
+        {
+            driver->kiss_putc(KISS_FESC);
+            driver->kiss_putc(KISS_TFEND);
+        }
+        else if (bytes[i] == KISS_FESC)
+        {
+            driver->kiss_putc(KISS_FESC);
+            driver->kiss_putc(KISS_TFESC);
+        }
+        else
+        {
+            driver->kiss_putc(bytes[i]);
+        }
+    }
+
+    driver->kiss_putc(KISS_FEND);
+
+    csp_buffer_free(packet);
+
+    return 0;
+}
+
+
+/* A complete frame is in rx_packet: check it and route it */
+static void kiss_frame(csp_iface_t * interface, csp_kiss_handle_t * driver, void * pxTaskWoken)
+{
+    csp_packet_t * packet = driver->rx_packet;
+    uint32_t crc;
+
+    if (driver->rx_length < sizeof(packet->id.ext) + sizeof(crc))
+    {
+        interface->frame++;
+        return;
+    }
+
+    packet->length = driver->rx_length - sizeof(packet->id.ext) - sizeof(crc);
+    memcpy(&crc, packet->data + packet->length, sizeof(crc));
+    if (ntohl(crc) != csp_crc32_memory(packet->data, packet->length))
+    {
+        interface->rx_error++;
+        return;
+    }
+
+    packet->id.ext = ntohl(packet->id.ext);
+    driver->rx_packet = NULL;
+
+    csp_new_packet(packet, interface, pxTaskWoken);
+}
+
+
+void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskWoken)
+{
+    csp_kiss_handle_t * driver = interface->driver;
+    uint8_t * bytes;
+    uint8_t c;
+
+    while (len--)
+    {
+        c = *buf++;
+
+        if (driver->rx_packet == NULL)
+        {
+            if ((driver->rx_packet = csp_buffer_get(BUFFER_SIZE)) == NULL)
+            {
+                interface->drop++;
+                driver->rx_mode = KISS_MODE_SKIP_FRAME;
+            }
+        }
+
+        bytes = (driver->rx_packet != NULL) ? (uint8_t *) &driver->rx_packet->id.ext : NULL;
+
+        switch (driver->rx_mode)
+        {
+        case KISS_MODE_NOT_STARTED:
+            if (c != KISS_FEND)
+            {
+                driver->kiss_discard(c, pxTaskWoken);
+            }
+            else
+            {
+                driver->rx_mode = KISS_MODE_STARTED;
+                driver->rx_first = 1;
+                driver->rx_length = 0;
+            }
+            break;
+
+        case KISS_MODE_STARTED:
+            if (driver->rx_first)
+            {
+                driver->rx_first = 0;
+                if (c == KISS_FEND)
+                {
+                    /* Back to back FENDs: still waiting for the command byte */
+                    driver->rx_first = 1;
+                }
+                else if (c != KISS_TNC_DATA)
+                {
+                    driver->rx_mode = KISS_MODE_SKIP_FRAME;
+                }
+                break;
+            }
+
+            if (c == KISS_FESC)
+            {
+                driver->rx_mode = KISS_MODE_ESCAPED;
+            }
+            else if (c == KISS_FEND)
+            {
+                kiss_frame(interface, driver, pxTaskWoken);
+                driver->rx_mode = KISS_MODE_STARTED;
+                driver->rx_first = 1;
+                driver->rx_length = 0;
+            }
+            else if (driver->rx_length < BUFFER_SIZE + sizeof(uint32_t))
+            {
+                bytes[driver->rx_length++] = c;
+            }
+            else
+            {
+                interface->rx_error++;
+                driver->rx_mode = KISS_MODE_SKIP_FRAME;
+            }
+            break;
+
+        case KISS_MODE_ESCAPED:
+            if (driver->rx_length < BUFFER_SIZE + sizeof(uint32_t))
+            {
+                bytes[driver->rx_length++] = (c == KISS_TFEND) ? KISS_FEND : KISS_FESC;
+            }
+            driver->rx_mode = KISS_MODE_STARTED;
+            break;
+
+        case KISS_MODE_SKIP_FRAME:
+            if (c == KISS_FEND)
+            {
+                driver->rx_mode = KISS_MODE_STARTED;
+                driver->rx_first = 1;
+                driver->rx_length = 0;
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <kubos-hal/gpio.h>
+#include <kubos-hal/i2c.h>
+#include <kubos-core/modules/sensors/bno055.h>
+#include <kubos-core/modules/sensors/htu21d.h>
+
+/**
+ * The kubos-core sensor drivers, reimplemented over the simulated bus.
+ * They make the same transfers and delays as the flight drivers, so the
+ * bus time the node spends in them is representative.
+ */
+
+#define SENSOR_I2C_BUS K_I2C1
+
+#define OFFSETS_LEN (MAG_RADIUS_MSB_ADDR - ACCEL_OFFSET_X_LSB_ADDR + 1)
+
+static unsigned int led_state[K_NUM_PINS];
+static unsigned int led_toggles[K_NUM_PINS];
+
+
+static KSensorStatus bno_write8(uint8_t reg, uint8_t value)
+{
+    uint8_t buf[2] = { reg, value };
+
+    return (k_i2c_write(SENSOR_I2C_BUS, BNO055_ADDRESS_A, buf, 2) == I2C_OK) ? SENSOR_OK
+                                                                            : SENSOR_WRITE_ERROR;
+}
+
+
+static KSensorStatus bno_read(uint8_t reg, uint8_t * buf, int len)
+{
+    if (k_i2c_write(SENSOR_I2C_BUS, BNO055_ADDRESS_A, &reg, 1) != I2C_OK ||
+        k_i2c_read(SENSOR_I2C_BUS, BNO055_ADDRESS_A, buf, len) != I2C_OK)
+    {
+        return SENSOR_READ_ERROR;
+    }
+
+    return SENSOR_OK;
+}
+
+
+static bno055_opmode_t bno_mode = OPERATION_MODE_CONFIG;
+
+
+KSensorStatus bno055_set_mode(bno055_opmode_t mode)
+{
+    KSensorStatus status = bno_write8(BNO055_OPR_MODE_ADDR, mode);
+
+    bno_mode = mode;
+    vTaskDelay(30);
+
+    return status;
+}
+
+
+KSensorStatus bno055_setup(bno055_opmode_t mode)
+{
+    uint8_t id = 0;
+    int tries;
+
+    if (bno_read(BNO055_CHIP_ID_ADDR, &id, 1) != SENSOR_OK || id != BNO055_ID)
+    {
+        /* It may still be booting */
+        vTaskDelay(1000);
+        if (bno_read(BNO055_CHIP_ID_ADDR, &id, 1) != SENSOR_OK || id != BNO055_ID)
+        {
+            return SENSOR_NOT_FOUND;
+        }
+    }
+
+    bno055_set_mode(OPERATION_MODE_CONFIG);
+    bno_write8(BNO055_SYS_TRIGGER_ADDR, 0x20);
+
+    for (tries = 0; tries < 100; tries++)
+    {
+        vTaskDelay(10);
+        if (bno_read(BNO055_CHIP_ID_ADDR, &id, 1) == SENSOR_OK && id == BNO055_ID)
+        {
+            break;
+        }
+    }
+    if (id != BNO055_ID)
+    {
+        return SENSOR_NOT_FOUND;
+    }
+    vTaskDelay(50);
+
+    bno_write8(BNO055_PWR_MODE_ADDR, POWER_MODE_NORMAL);
+    vTaskDelay(10);
+    bno_write8(BNO055_PAGE_ID_ADDR, 0);
+    bno_write8(BNO055_SYS_TRIGGER_ADDR, 0);
+    vTaskDelay(10);
+
+    return bno055_set_mode(mode);
+}
+
+
+KSensorStatus bno055_get_position(bno055_quat_data_t * quat)
+{
+    uint8_t buf[8];
+    const double scale = 1.0 / (1 << 14);
+
+    if (bno_read(BNO055_QUATERNION_DATA_W_LSB_ADDR, buf, sizeof(buf)) != SENSOR_OK)
+    {
+        return SENSOR_READ_ERROR;
+    }
+
+    quat->w = (int16_t)(buf[0] | (buf[1] << 8)) * scale;
+    quat->x = (int16_t)(buf[2] | (buf[3] << 8)) * scale;
+    quat->y = (int16_t)(buf[4] | (buf[5] << 8)) * scale;
+    quat->z = (int16_t)(buf[6] | (buf[7] << 8)) * scale;
+
+    return SENSOR_OK;
+}
+
+
+KSensorStatus bno055_get_data_vector(vector_type_t type, bno055_vector_data_t * vector)
+{
+    uint8_t buf[6];
+    double scale;
+
+    if (bno_read(type, buf, sizeof(buf)) != SENSOR_OK)
+    {
+        return SENSOR_READ_ERROR;
+    }
+
+    switch (type)
+    {
+    case VECTOR_EULER:
+    case VECTOR_GYROSCOPE:
+    case VECTOR_MAGNETOMETER:
+        scale = 1.0 / 16.0;
+        break;
+    default:
+        scale = 1.0 / 100.0;
+        break;
+    }
+
+    vector->x = (int16_t)(buf[0] | (buf[1] << 8)) * scale;
+    vector->y = (int16_t)(buf[2] | (buf[3] << 8)) * scale;
+    vector->z = (int16_t)(buf[4] | (buf[5] << 8)) * scale;
+
+    return SENSOR_OK;
+}
+
+
+KSensorStatus bno055_get_calibration(bno055_calibration_data_t * calib)
+{
+    uint8_t stat;
+
+    if (bno_read(BNO055_CALIB_STAT_ADDR, &stat, 1) != SENSOR_OK)
+    {
+        return SENSOR_READ_ERROR;
+    }
+
+    calib->sys = (stat >> 6) & 0x03;
+    calib->gyro = (stat >> 4) & 0x03;
+    calib->accel = (stat >> 2) & 0x03;
+    calib->mag = stat & 0x03;
+
+    return SENSOR_OK;
+}
+
+
+/**
+ * bno055_check_calibration: if the sensor is fully calibrated read out
+ * its offsets. Otherwise count the miss in calibCount, which wraps back
+ * to 0 after the given number of misses.
+ */
+
+KSensorStatus bno055_check_calibration(uint8_t * calibCount, uint8_t retries,
+                                       bno055_offsets_t * offsets)
+{
+    bno055_calibration_data_t calib;
+
+    if (bno055_get_calibration(&calib) == SENSOR_OK &&
+        calib.sys == 3 && calib.gyro == 3 && calib.accel == 3 && calib.mag == 3)
+    {
+        return bno055_get_sensor_offset_struct(offsets);
+    }
+
+    if (++(*calibCount) >= retries)
+    {
+        *calibCount = 0;
+    }
+
+    return SENSOR_NOT_CALIBRATED;
+}
+
+
+static uint16_t offset_word(const uint8_t * buf, int index)
+{
+    return buf[2 * index] | (buf[2 * index + 1] << 8);
+}
+
+
+KSensorStatus bno055_get_sensor_offset_struct(bno055_offsets_t * offsets)
+{
+    bno055_opmode_t mode = bno_mode;
+    uint8_t buf[OFFSETS_LEN];
+    KSensorStatus status;
+
+    bno055_set_mode(OPERATION_MODE_CONFIG);
+    status = bno_read(ACCEL_OFFSET_X_LSB_ADDR, buf, sizeof(buf));
+    bno055_set_mode(mode);
+
+    if (status != SENSOR_OK)
+    {
+        return status;
+    }
+
+    offsets->accel_offset_x = offset_word(buf, 0);
+    offsets->accel_offset_y = offset_word(buf, 1);
+    offsets->accel_offset_z = offset_word(buf, 2);
+    offsets->mag_offset_x = offset_word(buf, 3);
+    offsets->mag_offset_y = offset_word(buf, 4);
+    offsets->mag_offset_z = offset_word(buf, 5);
+    offsets->gyro_offset_x = offset_word(buf, 6);
+    offsets->gyro_offset_y = offset_word(buf, 7);
+    offsets->gyro_offset_z = offset_word(buf, 8);
+    offsets->accel_radius = offset_word(buf, 9);
+    offsets->mag_radius = offset_word(buf, 10);
+
+    return SENSOR_OK;
+}
+
+
+KSensorStatus bno055_set_sensor_offset_struct(bno055_offsets_t offsets)
+{
+    bno055_opmode_t mode = bno_mode;
+    uint16_t words[11] = {
+        offsets.accel_offset_x, offsets.accel_offset_y, offsets.accel_offset_z,
+        offsets.mag_offset_x, offsets.mag_offset_y, offsets.mag_offset_z,
+        offsets.gyro_offset_x, offsets.gyro_offset_y, offsets.gyro_offset_z,
+        offsets.accel_radius, offsets.mag_radius
+    };
+    uint8_t buf[1 + OFFSETS_LEN] = { ACCEL_OFFSET_X_LSB_ADDR };
+    KSensorStatus status = SENSOR_OK;
+    int i;
+
+    for (i = 0; i < 11; i++)
+    {
+        buf[1 + 2 * i] = words[i] & 0xFF;
+        buf[2 + 2 * i] = words[i] >> 8;
+    }
+
+    bno055_set_mode(OPERATION_MODE_CONFIG);
+    if (k_i2c_write(SENSOR_I2C_BUS, BNO055_ADDRESS_A, buf, sizeof(buf)) != I2C_OK)
+    {
+        status = SENSOR_WRITE_ERROR;
+    }
+    bno055_set_mode(mode);
+
+    return status;
+}
+
+
+KSensorStatus htu21d_setup(void)
+{
+    return SENSOR_OK;
+}
+
+
+KSensorStatus htu21d_reset(void)
+{
+    uint8_t cmd = HTU21D_SOFT_RESET;
+
+    if (k_i2c_write(SENSOR_I2C_BUS, HTU21D_I2C_ADDR, &cmd, 1) != I2C_OK)
+    {
+        return SENSOR_WRITE_ERROR;
+    }
+
+    vTaskDelay(15);
+
+    return SENSOR_OK;
+}
+
+
+/* Hold master measurement: the read stretches until the result is ready */
+static KSensorStatus htu_measure(uint8_t cmd, uint16_t * raw)
+{
+    uint8_t buf[3];
+    uint8_t crc = 0;
+    int i;
+    int bit;
+
+    if (k_i2c_write(SENSOR_I2C_BUS, HTU21D_I2C_ADDR, &cmd, 1) != I2C_OK ||
+        k_i2c_read(SENSOR_I2C_BUS, HTU21D_I2C_ADDR, buf, 3) != I2C_OK)
+    {
+        return SENSOR_READ_ERROR;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        crc ^= buf[i];
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+        }
+    }
+    if (crc != buf[2])
+    {
+        return SENSOR_READ_ERROR;
+    }
+
+    *raw = ((buf[0] << 8) | buf[1]) & 0xFFFC;
+
+    return SENSOR_OK;
+}
+
+
+KSensorStatus htu21d_read_temperature(float * temp)
+{
+    uint16_t raw;
+    KSensorStatus status;
+
+    if ((status = htu_measure(HTU21D_TRIGGER_TEMP_HOLD, &raw)) == SENSOR_OK)
+    {
+        *temp = -46.85f + 175.72f * raw / 65536.0f;
+    }
+
+    return status;
+}
+
+
+KSensorStatus htu21d_read_humidity(float * hum)
+{
+    uint16_t raw;
+    KSensorStatus status;
+
+    if ((status = htu_measure(HTU21D_TRIGGER_HUM_HOLD, &raw)) == SENSOR_OK)
+    {
+        *hum = -6.0f + 125.0f * raw / 65536.0f;
+    }
+
+    return status;
+}
+
+
+void k_gpio_init(int pin, KGPIOMode mode, KGPIOPullup pullup)
+{
+    (void) mode;
+    (void) pullup;
+
+    if (pin >= 0 && pin < K_NUM_PINS)
+    {
+        led_state[pin] = 0;
+    }
+}
+
+
+unsigned int k_gpio_read(int pin)
+{
+    return (pin >= 0 && pin < K_NUM_PINS) ? led_state[pin] : 0;
+}
+
+
+void k_gpio_write(int pin, unsigned int val)
+{
+    if (pin >= 0 && pin < K_NUM_PINS && led_state[pin] != !!val)
+    {
+        led_state[pin] = !!val;
+        led_toggles[pin]++;
+    }
+}
+
+
+void sim_gpio_report(void)
+{
+    sim_log("leds: %u green, %u orange, %u red, %u blue toggles",
+            led_toggles[K_LED_GREEN], led_toggles[K_LED_ORANGE],
+            led_toggles[K_LED_RED], led_toggles[K_LED_BLUE]);
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <kubos-core/modules/fatfs/ff.h>
+
+/**
+ * FatFs over a directory on the host. Each call costs UKUB_SIM_SD_US
+ * (default 200us) plus UKUB_SIM_SD_SECTOR_US (default 500us) per 512 byte
+ * sector touched, which is in line with SDIO card latency. Renaming onto
+ * an existing file fails with FR_EXIST as it does in FatFs.
+ */
+
+#define SECTOR_SIZE 512
+
+static const char * sd_dir;
+static long call_us;
+static long sector_us;
+
+
+static void sd_delay(UINT bytes)
+{
+    sim_sleep_us(call_us + sector_us * ((bytes + SECTOR_SIZE - 1) / SECTOR_SIZE));
+}
+
+
+static void sd_path(char * path, size_t size, const TCHAR * name)
+{
+    snprintf(path, size, "%s/%s", sd_dir, name);
+}
+
+
+static FRESULT from_errno(void)
+{
+    switch (errno)
+    {
+    case ENOENT:
+        return FR_NO_FILE;
+    case EEXIST:
+        return FR_EXIST;
+    case EACCES:
+    case EPERM:
+        return FR_DENIED;
+    default:
+        return FR_DISK_ERR;
+    }
+}
+
+
+FRESULT f_mount(FATFS * fs, const TCHAR * path, BYTE opt)
+{
+    (void) path;
+    (void) opt;
+
+    sd_dir = sim_env_str("UKUB_SIM_SD", "sim_sd");
+    call_us = sim_env_long("UKUB_SIM_SD_US", 200);
+    sector_us = sim_env_long("UKUB_SIM_SD_SECTOR_US", 500);
+
+    if (mkdir(sd_dir, 0755) != 0 && errno != EEXIST)
+    {
+        return FR_NOT_READY;
+    }
+
+    fs->fs_type = 1;
+    sd_delay(SECTOR_SIZE);
+
+    return FR_OK;
+}
+
+
+FRESULT f_open(FIL * fp, const TCHAR * path, BYTE mode)
+{
+    char host[256];
+    int flags = (mode & FA_WRITE) ? ((mode & FA_READ) ? O_RDWR : O_WRONLY) : O_RDONLY;
+    struct stat st;
+
+    if (sd_dir == NULL)
+    {
+        return FR_NOT_ENABLED;
+    }
+
+    if (mode & FA_CREATE_ALWAYS)
+    {
+        flags |= O_CREAT | O_TRUNC;
+    }
+    else if (mode & FA_CREATE_NEW)
+    {
+        flags |= O_CREAT | O_EXCL;
+    }
+    else if (mode & FA_OPEN_ALWAYS)
+    {
+        flags |= O_CREAT;
+    }
+
+    sd_path(host, sizeof(host), path);
+    sd_delay(0);
+
+    if ((fp->fd = open(host, flags, 0644)) < 0)
+    {
+        return from_errno();
+    }
+
+    fstat(fp->fd, &st);
+    fp->flag = mode;
+    fp->fptr = 0;
+    fp->fsize = st.st_size;
+
+    return FR_OK;
+}
+
+
+FRESULT f_close(FIL * fp)
+{
+    if (fp->fd < 0)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    close(fp->fd);
+    fp->fd = -1;
+    sd_delay(0);
+
+    return FR_OK;
+}
+
+
+FRESULT f_read(FIL * fp, void * buff, UINT btr, UINT * br)
+{
+    ssize_t n = pread(fp->fd, buff, btr, fp->fptr);
+
+    *br = 0;
+    if (n < 0)
+    {
+        return FR_DISK_ERR;
+    }
+
+    sd_delay(n);
+    fp->fptr += n;
+    *br = n;
+
+    return FR_OK;
+}
+
+
+FRESULT f_write(FIL * fp, const void * buff, UINT btw, UINT * bw)
+{
+    ssize_t n;
+
+    *bw = 0;
+    if (!(fp->flag & FA_WRITE))
+    {
+        return FR_DENIED;
+    }
+
+    if ((n = pwrite(fp->fd, buff, btw, fp->fptr)) < 0)
+    {
+        return FR_DISK_ERR;
+    }
+
+    sd_delay(n);
+    fp->fptr += n;
+    if (fp->fptr > fp->fsize)
+    {
+        fp->fsize = fp->fptr;
+    }
+    *bw = n;
+
+    return FR_OK;
+}
+
+
+/* As in FatFs, seeking past the end of a writable file extends it */
+FRESULT f_lseek(FIL * fp, DWORD ofs)
+{
+    if (ofs > fp->fsize)
+    {
+        if (!(fp->flag & FA_WRITE))
+        {
+            ofs = fp->fsize;
+        }
+        else if (ftruncate(fp->fd, ofs) != 0)
+        {
+            return FR_DISK_ERR;
+        }
+        else
+        {
+            fp->fsize = ofs;
+        }
+    }
+
+    fp->fptr = ofs;
+
+    return FR_OK;
+}
+
+
+FRESULT f_truncate(FIL * fp)
+{
+    if (ftruncate(fp->fd, fp->fptr) != 0)
+    {
+        return FR_DISK_ERR;
+    }
+
+    fp->fsize = fp->fptr;
+    sd_delay(0);
+
+    return FR_OK;
+}
+
+
+FRESULT f_sync(FIL * fp)
+{
+    fdatasync(fp->fd);
+    sd_delay(SECTOR_SIZE);
+
+    return FR_OK;
+}
+
+
+FRESULT f_unlink(const TCHAR * path)
+{
+    char host[256];
+
+    sd_path(host, sizeof(host), path);
+    sd_delay(SECTOR_SIZE);
+
+    return (unlink(host) == 0) ? FR_OK : from_errno();
+}
+
+
+FRESULT f_rename(const TCHAR * path_old, const TCHAR * path_new)
+{
+    char from[256];
+    char to[256];
+
+    sd_path(from, sizeof(from), path_old);
+    sd_path(to, sizeof(to), path_new);
+    sd_delay(SECTOR_SIZE);
+
+    if (access(to, F_OK) == 0)
+    {
+        return FR_EXIST;
+    }
+
+    return (rename(from, to) == 0) ? FR_OK : from_errno();
+}
+
+
+int f_printf(FIL * fp, const TCHAR * str, ...)
+{
+    char buf[256];
+    UINT bw;
+    va_list args;
+    int n;
+
+    va_start(args, str);
+    n = vsnprintf(buf, sizeof(buf), str, args);
+    va_end(args);
+
+    if (n < 0 || (size_t) n >= sizeof(buf) || f_write(fp, buf, n, &bw) != FR_OK || bw != (UINT) n)
+    {
+        return -1;
+    }
+
+    return n;
+}
+
+
+/* Read a line, like FatFs: stops after '\n', NULL at end of file */
+TCHAR * f_gets(TCHAR * buff, int len, FIL * fp)
+{
+    int i = 0;
+    UINT br;
+    char c;
+
+    while (i < len - 1)
+    {
+        if (f_read(fp, &c, 1, &br) != FR_OK || br == 0)
+        {
+            break;
+        }
+        buff[i++] = c;
+        if (c == '\n')
+        {
+            break;
+        }
+    }
+
+    buff[i] = '\0';
+
+    return (i > 0) ? buff : NULL;
+}
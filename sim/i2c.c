@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kubos-hal/i2c.h>
+#include <kubos-core/modules/sensors/bno055.h>
+#include <kubos-core/modules/sensors/htu21d.h>
+
+/**
+ * K_I2C1 with a BNO055 and an HTU21D on it. A transfer holds the bus for
+ * as long as it would on the wire: a fixed HAL overhead plus nine bit
+ * times per byte (address included) at UKUB_SIM_I2C_CLOCK, plus any
+ * clock stretching by the device. Two tasks using the bus at once is
+ * counted as contention, since the flight HAL doesn't serialize them.
+ *
+ * The devices model the register behaviour the node relies on: mode
+ * switch and reset times, NACKs while busy, offsets only writable in
+ * config mode, and HTU21D hold and no-hold measurements.
+ */
+
+#define DEG (M_PI / 180.0)
+#define GRAVITY 9.80665
+
+/* BNO055 timings from the datasheet, in us */
+#define BNO_RESET_US 650000
+#define BNO_TO_CONFIG_US 19000
+#define BNO_FROM_CONFIG_US 7000
+#define BNO_FUSION_US 10000
+
+/* HTU21D conversion times at full resolution, in us */
+#define HTU_TEMP_US 50000
+#define HTU_HUM_US 16000
+#define HTU_RESET_US 15000
+
+typedef KI2CStatus (*device_op_t)(uint8_t * buf, int len, uint64_t * hold);
+
+static struct {
+    pthread_mutex_t lock;
+    uint32_t clock;
+    uint32_t overhead_us;
+    uint64_t transfers;
+    uint64_t bytes;
+    uint64_t busy_us;
+    uint64_t nacks;
+    uint64_t contention;
+    unsigned int seed;
+} bus = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct {
+    uint8_t regs[0x80];
+    uint8_t pointer;
+    uint64_t busy_until;
+    uint64_t epoch;
+    uint64_t updated;
+    double angle[3];
+    uint32_t offset_writes;
+} bno;
+
+static struct {
+    uint8_t command;
+    uint64_t ready_at;
+    bool pending;
+    uint8_t user_reg;
+    uint64_t busy_until;
+} htu;
+
+
+/* Standard normal noise, Box-Muller */
+static double noise(void)
+{
+    double u = (rand_r(&bus.seed) + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand_r(&bus.seed) + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+
+static void put_word(uint8_t reg, double value)
+{
+    int16_t word = (int16_t) lround(value);
+
+    bno.regs[reg] = word & 0xFF;
+    bno.regs[reg + 1] = (word >> 8) & 0xFF;
+}
+
+
+static void bno_reset(void)
+{
+    memset(bno.regs, 0, sizeof(bno.regs));
+    bno.regs[BNO055_CHIP_ID_ADDR] = BNO055_ID;
+    bno.regs[0x01] = 0xFB;
+    bno.regs[0x02] = 0x32;
+    bno.regs[0x03] = 0x0F;
+    bno.regs[BNO055_OPR_MODE_ADDR] = OPERATION_MODE_CONFIG;
+    bno.pointer = 0;
+}
+
+
+/**
+ * bno_fuse: bring the data registers up to date. The fusion output only
+ * changes every BNO_FUSION_US; between epochs reads see the same values.
+ */
+
+static void bno_fuse(void)
+{
+    uint64_t now = sim_now_us();
+    uint64_t epoch = now / BNO_FUSION_US;
+    sim_world_t world;
+    double dt;
+    double cr, sr, cp, sp, cy, sy;
+    double g[3];
+    double lin[3];
+    int i;
+
+    if (epoch == bno.epoch || bno.regs[BNO055_OPR_MODE_ADDR] == OPERATION_MODE_CONFIG)
+    {
+        return;
+    }
+
+    sim_world(&world);
+
+    dt = (now - bno.updated) / 1e6;
+    bno.updated = now;
+    bno.epoch = epoch;
+
+    for (i = 0; i < 3; i++)
+    {
+        bno.angle[i] = fmod(bno.angle[i] + world.rate[i] * dt + 360.0, 360.0);
+        lin[i] = world.shake * noise();
+    }
+
+    /* angle[] is roll, pitch, heading in degrees */
+    cr = cos(bno.angle[0] * DEG / 2);
+    sr = sin(bno.angle[0] * DEG / 2);
+    cp = cos(bno.angle[1] * DEG / 2);
+    sp = sin(bno.angle[1] * DEG / 2);
+    cy = cos(bno.angle[2] * DEG / 2);
+    sy = sin(bno.angle[2] * DEG / 2);
+
+    put_word(BNO055_QUATERNION_DATA_W_LSB_ADDR, (cr * cp * cy + sr * sp * sy) * 16384);
+    put_word(BNO055_QUATERNION_DATA_W_LSB_ADDR + 2, (sr * cp * cy - cr * sp * sy) * 16384);
+    put_word(BNO055_QUATERNION_DATA_W_LSB_ADDR + 4, (cr * sp * cy + sr * cp * sy) * 16384);
+    put_word(BNO055_QUATERNION_DATA_W_LSB_ADDR + 6, (cr * cp * sy - sr * sp * cy) * 16384);
+
+    put_word(BNO055_EULER_H_LSB_ADDR, bno.angle[2] * 16);
+    put_word(BNO055_EULER_H_LSB_ADDR + 2, remainder(bno.angle[0], 360.0) * 16);
+    put_word(BNO055_EULER_H_LSB_ADDR + 4, remainder(bno.angle[1], 360.0) * 16);
+
+    /* Gravity in the sensor frame */
+    g[0] = -GRAVITY * sin(bno.angle[1] * DEG);
+    g[1] = GRAVITY * sin(bno.angle[0] * DEG) * cos(bno.angle[1] * DEG);
+    g[2] = GRAVITY * cos(bno.angle[0] * DEG) * cos(bno.angle[1] * DEG);
+
+    for (i = 0; i < 3; i++)
+    {
+        put_word(BNO055_GRAVITY_DATA_X_LSB_ADDR + 2 * i, g[i] * 100);
+        put_word(BNO055_LINEAR_ACCEL_DATA_X_LSB_ADDR + 2 * i, lin[i] * 100);
+        put_word(BNO055_ACCEL_DATA_X_LSB_ADDR + 2 * i, (g[i] + lin[i] + 0.02 * noise()) * 100);
+        put_word(BNO055_GYRO_DATA_X_LSB_ADDR + 2 * i, world.rate[i] * 16);
+        put_word(BNO055_MAG_DATA_X_LSB_ADDR + 2 * i, (i == 0 ? 20.0 : 0.0) * 16);
+    }
+
+    bno.regs[BNO055_TEMP_ADDR] = (uint8_t)(int8_t) lround(world.temperature);
+}
+
+
+static KI2CStatus bno_write(uint8_t * buf, int len, uint64_t * hold)
+{
+    uint64_t now = sim_now_us();
+    uint8_t reg;
+    uint8_t value;
+    int i;
+
+    (void) hold;
+
+    if (now < bno.busy_until || len < 1)
+    {
+        return I2C_ERROR_NACK;
+    }
+
+    bno.pointer = buf[0];
+
+    for (i = 1; i < len; i++)
+    {
+        reg = bno.pointer++ & 0x7F;
+        value = buf[i];
+
+        if (reg == BNO055_OPR_MODE_ADDR)
+        {
+            bno.busy_until = now + ((value & 0x0F) == OPERATION_MODE_CONFIG ? BNO_TO_CONFIG_US
+                                                                             : BNO_FROM_CONFIG_US);
+            bno.regs[reg] = value & 0x0F;
+            bno.epoch = 0;
+            bno.updated = now;
+        }
+        else if (reg == BNO055_SYS_TRIGGER_ADDR && (value & 0x20))
+        {
+            bno_reset();
+            bno.busy_until = now + BNO_RESET_US;
+            return I2C_OK;
+        }
+        else if (reg >= ACCEL_OFFSET_X_LSB_ADDR && reg <= MAG_RADIUS_MSB_ADDR)
+        {
+            /* Offsets only take in config mode */
+            if (bno.regs[BNO055_OPR_MODE_ADDR] == OPERATION_MODE_CONFIG)
+            {
+                bno.regs[reg] = value;
+                bno.offset_writes++;
+            }
+        }
+        else if (reg >= BNO055_PAGE_ID_ADDR)
+        {
+            bno.regs[reg] = value;
+        }
+    }
+
+    return I2C_OK;
+}
+
+
+static KI2CStatus bno_read(uint8_t * buf, int len, uint64_t * hold)
+{
+    sim_world_t world;
+    int i;
+
+    (void) hold;
+
+    if (sim_now_us() < bno.busy_until)
+    {
+        return I2C_ERROR_NACK;
+    }
+
+    sim_world(&world);
+    bno.regs[BNO055_CALIB_STAT_ADDR] = world.calib_stat;
+    bno_fuse();
+
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = bno.regs[bno.pointer++ & 0x7F];
+    }
+
+    return I2C_OK;
+}
+
+
+/* CRC-8 of an HTU21D reading, polynomial x^8 + x^5 + x^4 + 1 */
+static uint8_t htu_crc(const uint8_t * data, int len)
+{
+    uint8_t crc = 0;
+    int bit;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+
+static void htu_measure(uint8_t * buf)
+{
+    sim_world_t world;
+    bool temp = (htu.command == HTU21D_TRIGGER_TEMP_HOLD ||
+                 htu.command == HTU21D_TRIGGER_TEMP_NOHOLD);
+    double raw;
+    uint16_t word;
+
+    sim_world(&world);
+
+    if (temp)
+    {
+        raw = (world.temperature + 0.01 * noise() + 46.85) / 175.72 * 65536.0;
+        word = (uint16_t) raw & 0xFFFC;
+    }
+    else
+    {
+        raw = (world.humidity + 0.05 * noise() + 6.0) / 125.0 * 65536.0;
+        word = ((uint16_t) raw & 0xFFFC) | 0x02;
+    }
+
+    buf[0] = word >> 8;
+    buf[1] = word & 0xFF;
+    buf[2] = htu_crc(buf, 2);
+}
+
+
+static KI2CStatus htu_write(uint8_t * buf, int len, uint64_t * hold)
+{
+    uint64_t now = sim_now_us();
+
+    (void) hold;
+
+    if (now < htu.busy_until || len < 1)
+    {
+        return I2C_ERROR_NACK;
+    }
+
+    switch (buf[0])
+    {
+    case HTU21D_TRIGGER_TEMP_HOLD:
+    case HTU21D_TRIGGER_TEMP_NOHOLD:
+    case HTU21D_TRIGGER_HUM_HOLD:
+    case HTU21D_TRIGGER_HUM_NOHOLD:
+        htu.command = buf[0];
+        htu.pending = true;
+        htu.ready_at = now + ((buf[0] == HTU21D_TRIGGER_TEMP_HOLD ||
+                               buf[0] == HTU21D_TRIGGER_TEMP_NOHOLD) ? HTU_TEMP_US : HTU_HUM_US);
+        break;
+
+    case HTU21D_SOFT_RESET:
+        htu.pending = false;
+        htu.user_reg = 0x02;
+        htu.busy_until = now + HTU_RESET_US;
+        break;
+
+    case HTU21D_WRITE_USER_REG:
+        if (len > 1)
+        {
+            htu.user_reg = buf[1];
+        }
+        break;
+
+    default:
+        htu.command = buf[0];
+        break;
+    }
+
+    return I2C_OK;
+}
+
+
+static KI2CStatus htu_read(uint8_t * buf, int len, uint64_t * hold)
+{
+    uint8_t data[3];
+    uint64_t now = sim_now_us();
+
+    if (now < htu.busy_until)
+    {
+        return I2C_ERROR_NACK;
+    }
+
+    if (htu.command == HTU21D_READ_USER_REG)
+    {
+        buf[0] = htu.user_reg;
+        return I2C_OK;
+    }
+
+    if (!htu.pending)
+    {
+        return I2C_ERROR_NACK;
+    }
+
+    if (now < htu.ready_at)
+    {
+        /* No hold master: the sensor NACKs until the conversion is done */
+        if (htu.command == HTU21D_TRIGGER_TEMP_NOHOLD || htu.command == HTU21D_TRIGGER_HUM_NOHOLD)
+        {
+            return I2C_ERROR_NACK;
+        }
+
+        /* Hold master: the sensor stretches the clock instead */
+        *hold = htu.ready_at - now;
+    }
+
+    htu_measure(data);
+    memcpy(buf, data, (len < 3) ? len : 3);
+    htu.pending = false;
+
+    return I2C_OK;
+}
+
+
+static const struct {
+    uint16_t addr;
+    device_op_t write;
+    device_op_t read;
+} devices[] = {
+    { BNO055_ADDRESS_A, bno_write, bno_read },
+    { HTU21D_I2C_ADDR, htu_write, htu_read },
+};
+
+
+void sim_i2c_init(void)
+{
+    bus.clock = sim_env_long("UKUB_SIM_I2C_CLOCK", 100000);
+    bus.overhead_us = sim_env_long("UKUB_SIM_I2C_OVERHEAD", 50);
+    bus.seed = sim_env_long("UKUB_SIM_SEED", 1);
+
+    bno_reset();
+    htu.user_reg = 0x02;
+}
+
+
+static KI2CStatus transfer(KI2CNum i2c, uint16_t addr, uint8_t * ptr, int len, bool read)
+{
+    uint64_t start;
+    uint64_t hold = 0;
+    uint64_t bits = 9;
+    KI2CStatus status = I2C_ERROR_NACK;
+    unsigned int i;
+
+    if (pthread_mutex_trylock(&bus.lock) != 0)
+    {
+        bus.contention++;
+        pthread_mutex_lock(&bus.lock);
+    }
+
+    start = sim_now_us();
+
+    if (i2c == K_I2C1 && !sim_take_i2c_fault())
+    {
+        for (i = 0; i < sizeof(devices) / sizeof(devices[0]); i++)
+        {
+            if (devices[i].addr == addr)
+            {
+                status = read ? devices[i].read(ptr, len, &hold) : devices[i].write(ptr, len, &hold);
+                break;
+            }
+        }
+    }
+
+    /* A NACKed transfer stops after the address byte */
+    if (status == I2C_OK)
+    {
+        bits += 9 * len;
+    }
+    else
+    {
+        bus.nacks++;
+    }
+
+    sim_sleep_until_us(start + bus.overhead_us + bits * 1000000 / bus.clock + hold);
+
+    bus.transfers++;
+    bus.bytes += (status == I2C_OK) ? len : 0;
+    bus.busy_us += sim_now_us() - start;
+
+    pthread_mutex_unlock(&bus.lock);
+
+    return status;
+}
+
+
+KI2CStatus k_i2c_write(KI2CNum i2c, uint16_t addr, uint8_t * ptr, int len)
+{
+    return transfer(i2c, addr, ptr, len, false);
+}
+
+
+KI2CStatus k_i2c_read(KI2CNum i2c, uint16_t addr, uint8_t * ptr, int len)
+{
+    return transfer(i2c, addr, ptr, len, true);
+}
+
+
+void sim_i2c_report(void)
+{
+    uint64_t now = sim_now_us();
+
+    sim_log("i2c: %llu transfers, %llu bytes, %llu NACKs, bus busy %.1f%%, "
+            "%llu contended, %u offset writes",
+            (unsigned long long) bus.transfers, (unsigned long long) bus.bytes,
+            (unsigned long long) bus.nacks, now ? 100.0 * bus.busy_us / now : 0.0,
+            (unsigned long long) bus.contention, bno.offset_writes);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_CSP_QUEUE_H
+#define SIM_CSP_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CSP_QUEUE_FULL 0
+#define CSP_QUEUE_ERROR 0
+#define CSP_QUEUE_OK 1
+
+typedef struct sim_queue * csp_queue_handle_t;
+
+csp_queue_handle_t csp_queue_create(int length, size_t item_size);
+
+void csp_queue_remove(csp_queue_handle_t queue);
+
+int csp_queue_enqueue(csp_queue_handle_t handle, void * value, uint32_t timeout);
+
+int csp_queue_enqueue_isr(csp_queue_handle_t handle, void * value, void * pxTaskWoken);
+
+int csp_queue_dequeue(csp_queue_handle_t handle, void * buf, uint32_t timeout);
+
+int csp_queue_size(csp_queue_handle_t handle);
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_CSP_SEMAPHORE_H
+#define SIM_CSP_SEMAPHORE_H
+
+#include <stdint.h>
+
+#include <csp/csp.h>
+
+#define CSP_SEMAPHORE_OK 1
+#define CSP_SEMAPHORE_ERROR 2
+#define CSP_MUTEX_OK CSP_SEMAPHORE_OK
+#define CSP_MUTEX_ERROR CSP_SEMAPHORE_ERROR
+
+typedef struct sim_sem * csp_mutex_t;
+typedef struct sim_sem * csp_bin_sem_handle_t;
+
+int csp_mutex_create(csp_mutex_t * mutex);
+
+int csp_mutex_remove(csp_mutex_t * mutex);
+
+int csp_mutex_lock(csp_mutex_t * mutex, uint32_t timeout);
+
+int csp_mutex_unlock(csp_mutex_t * mutex);
+
+int csp_bin_sem_create(csp_bin_sem_handle_t * sem);
+
+int csp_bin_sem_remove(csp_bin_sem_handle_t * sem);
+
+int csp_bin_sem_wait(csp_bin_sem_handle_t * sem, uint32_t timeout);
+
+int csp_bin_sem_post(csp_bin_sem_handle_t * sem);
+
+int csp_bin_sem_post_isr(csp_bin_sem_handle_t * sem, void * pxTaskWoken);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_CSP_THREAD_H
+#define SIM_CSP_THREAD_H
+
+#include <stdint.h>
+
+typedef struct sim_task * csp_thread_handle_t;
+typedef void csp_thread_return_t;
+
+#define CSP_DEFINE_TASK(task_name) csp_thread_return_t task_name(void * param)
+#define csp_thread_exit() return
+
+int csp_thread_create(csp_thread_return_t (*routine)(void *), const char * const thread_name,
+                      unsigned short stack_depth, void * parameters, unsigned int priority,
+                      csp_thread_handle_t * handle);
+
+void csp_sleep_ms(uint32_t time_ms);
+
+#endif
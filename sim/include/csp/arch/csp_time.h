@@ -13,13 +13,13 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include "misc.h"
-#include <kubos-hal/gpio.h>
-#include <FreeRTOS.h>
-#include <task.h>
+#ifndef SIM_CSP_TIME_H
+#define SIM_CSP_TIME_H
 
-inline void blink(int pin) {
-    k_gpio_write(pin, 1);
-    vTaskDelay(1);
-    k_gpio_write(pin, 0);
-}
+#include <stdint.h>
+
+uint32_t csp_get_ms(void);
+
+uint32_t csp_get_ms_isr(void);
+
+#endif
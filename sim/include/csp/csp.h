@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_CSP_H
+#define SIM_CSP_H
+
+/**
+ * Host stand-in for the libcsp 1.x API: buffers, connections, sockets,
+ * routing and a simplified RDP. Packets keep the libcsp layout so the
+ * KISS interface puts the same bytes on the wire as the flight build.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+
+#define CSP_ANY 255
+#define CSP_NODE_MAC 0xFF
+#define CSP_MAX_DELAY 0xFFFFFFFF
+
+#define CSP_PRIO_CRITICAL 0
+#define CSP_PRIO_HIGH 1
+#define CSP_PRIO_NORM 2
+#define CSP_PRIO_LOW 3
+
+/* Error codes, as csp_error.h */
+#define CSP_ERR_NONE 0
+#define CSP_ERR_NOMEM -1
+#define CSP_ERR_TIMEOUT -3
+#define CSP_ERR_TX -7
+
+#define CSP_SO_NONE 0x0000
+
+#define CSP_O_NONE 0x0000
+#define CSP_O_RDP 0x0001
+#define CSP_O_CRC32 0x0040
+
+/* Header flags */
+#define CSP_FCRC32 0x01
+#define CSP_FRDP 0x02
+
+typedef union {
+    uint32_t ext;
+    struct __attribute__((packed)) {
+        unsigned int flags : 8;
+        unsigned int sport : 6;
+        unsigned int dport : 6;
+        unsigned int dst : 5;
+        unsigned int src : 5;
+        unsigned int pri : 2;
+    };
+} csp_id_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t padding[8];
+    uint16_t length;
+    csp_id_t id;
+    union {
+        uint8_t data[0];
+        uint16_t data16[0];
+        uint32_t data32[0];
+    };
+} csp_packet_t;
+
+typedef struct csp_iface_s {
+    const char * name;
+    void * driver;
+    int (*nexthop)(struct csp_iface_s * ifc, csp_packet_t * packet, uint32_t timeout);
+    uint16_t mtu;
+    uint32_t tx;
+    uint32_t rx;
+    uint32_t tx_error;
+    uint32_t rx_error;
+    uint32_t drop;
+    uint32_t frame;
+    struct csp_iface_s * next;
+} csp_iface_t;
+
+typedef struct csp_conn_s csp_conn_t;
+typedef struct csp_socket_s csp_socket_t;
+
+int csp_init(uint8_t my_node_address);
+
+csp_socket_t * csp_socket(uint32_t opts);
+
+int csp_bind(csp_socket_t * socket, uint8_t port);
+
+int csp_listen(csp_socket_t * socket, size_t conn_queue_length);
+
+csp_conn_t * csp_accept(csp_socket_t * socket, uint32_t timeout);
+
+csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout);
+
+csp_conn_t * csp_connect(uint8_t prio, uint8_t dest, uint8_t dport, uint32_t timeout, uint32_t opts);
+
+int csp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout);
+
+int csp_close(csp_conn_t * conn);
+
+int csp_conn_dport(csp_conn_t * conn);
+
+int csp_conn_sport(csp_conn_t * conn);
+
+int csp_conn_src(csp_conn_t * conn);
+
+int csp_conn_dst(csp_conn_t * conn);
+
+void * csp_buffer_get(size_t size);
+
+void csp_buffer_free(void * packet);
+
+int csp_buffer_remaining(void);
+
+int csp_buffer_size(void);
+
+void csp_service_handler(csp_conn_t * conn, csp_packet_t * packet);
+
+int csp_route_set(uint8_t node, csp_iface_t * ifc, uint8_t nexthop_mac_addr);
+
+void csp_new_packet(csp_packet_t * packet, csp_iface_t * ifc, void * pxTaskWoken);
+
+#endif
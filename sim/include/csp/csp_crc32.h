@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_CSP_CRC32_H
+#define SIM_CSP_CRC32_H
+
+#include <stdint.h>
+
+/* CRC32-C of a block, as used by the KISS interface */
+uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length);
+
+#endif
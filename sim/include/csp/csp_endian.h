@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_CSP_ENDIAN_H
+#define SIM_CSP_ENDIAN_H
+
+#include <arpa/inet.h>
+#include <stdint.h>
+
+static inline uint32_t csp_hton32(uint32_t h32)
+{
+    return htonl(h32);
+}
+
+static inline uint32_t csp_ntoh32(uint32_t n32)
+{
+    return ntohl(n32);
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_USART_H
+#define SIM_USART_H
+
+/**
+ * Host stand-in for the CSP usart driver. The link is either a pty, for
+ * attaching a log node by hand, or a socket pair to a log node command
+ * started by the simulator (see sim/README.md). Bytes are paced at the
+ * configured baud rate.
+ */
+
+#include <stdint.h>
+
+struct usart_conf {
+    const char * device;
+    uint32_t baudrate;
+    uint8_t databits;
+    uint8_t stopbits;
+    uint8_t paritysetting;
+    uint8_t checkparity;
+};
+
+typedef void (*usart_callback_t)(uint8_t * buf, int len, void * pxTaskWoken);
+
+void usart_init(struct usart_conf * conf);
+
+void usart_set_callback(usart_callback_t callback);
+
+void usart_insert(char c, void * pxTaskWoken);
+
+void usart_putc(char c);
+
+void usart_putstr(char * buf, int len);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_CSP_IF_KISS_H
+#define SIM_CSP_IF_KISS_H
+
+#include <csp/csp.h>
+
+typedef void (*csp_kiss_putc_f)(char buf);
+typedef void (*csp_kiss_discard_f)(char c, void * pxTaskWoken);
+
+typedef enum {
+    KISS_MODE_NOT_STARTED,
+    KISS_MODE_STARTED,
+    KISS_MODE_ESCAPED,
+    KISS_MODE_SKIP_FRAME,
+} kiss_mode_e;
+
+typedef struct {
+    csp_kiss_putc_f kiss_putc;
+    csp_kiss_discard_f kiss_discard;
+    unsigned int rx_length;
+    kiss_mode_e rx_mode;
+    unsigned int rx_first;
+    csp_packet_t * rx_packet;
+} csp_kiss_handle_t;
+
+int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout);
+
+void csp_kiss_rx(csp_iface_t * interface, uint8_t * buf, int len, void * pxTaskWoken);
+
+void csp_kiss_init(csp_iface_t * csp_iface, csp_kiss_handle_t * csp_kiss_handle,
+                   csp_kiss_putc_f kiss_putc_f, csp_kiss_discard_f kiss_discard_f,
+                   const char * name);
+
+#endif
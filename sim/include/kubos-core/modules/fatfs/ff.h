@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_FF_H
+#define SIM_FF_H
+
+/**
+ * Host stand-in for FatFs (R0.11 API). The volume is a directory on the
+ * host (UKUB_SIM_SD, "sim_sd" by default) and every call can be given
+ * the latency of a real card, see sim/fatfs.c.
+ */
+
+#include <stdint.h>
+
+#define _FATFS 64180
+
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef char TCHAR;
+
+typedef struct {
+    BYTE fs_type;
+} FATFS;
+
+typedef struct {
+    int fd;
+    BYTE flag;
+    DWORD fptr;
+    DWORD fsize;
+} FIL;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER
+} FRESULT;
+
+#define FA_READ 0x01
+#define FA_OPEN_EXISTING 0x00
+#define FA_WRITE 0x02
+#define FA_CREATE_NEW 0x04
+#define FA_CREATE_ALWAYS 0x08
+#define FA_OPEN_ALWAYS 0x10
+
+#define f_eof(fp) ((int)((fp)->fptr == (fp)->fsize))
+#define f_tell(fp) ((fp)->fptr)
+#define f_size(fp) ((fp)->fsize)
+
+FRESULT f_mount(FATFS * fs, const TCHAR * path, BYTE opt);
+
+FRESULT f_open(FIL * fp, const TCHAR * path, BYTE mode);
+
+FRESULT f_close(FIL * fp);
+
+FRESULT f_read(FIL * fp, void * buff, UINT btr, UINT * br);
+
+FRESULT f_write(FIL * fp, const void * buff, UINT btw, UINT * bw);
+
+FRESULT f_lseek(FIL * fp, DWORD ofs);
+
+FRESULT f_truncate(FIL * fp);
+
+FRESULT f_sync(FIL * fp);
+
+FRESULT f_unlink(const TCHAR * path);
+
+FRESULT f_rename(const TCHAR * path_old, const TCHAR * path_new);
+
+int f_printf(FIL * fp, const TCHAR * str, ...);
+
+TCHAR * f_gets(TCHAR * buff, int len, FIL * fp);
+
+#endif
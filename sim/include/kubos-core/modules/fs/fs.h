@@ -13,13 +13,9 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#ifndef MISC_H
-#define MISC_H
+#ifndef SIM_FS_H
+#define SIM_FS_H
 
-#include <csp/arch/csp_semaphore.h>
-
-csp_mutex_t bno_lock;
-
-void blink(int pin);
+#include <kubos-core/modules/fatfs/ff.h>
 
 #endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_BNO055_H
+#define SIM_BNO055_H
+
+/**
+ * Host stand-in for the kubos-core BNO055 driver, talking to the
+ * simulated sensor over the simulated I2C bus. Register names follow
+ * the kubos-core header.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+#define BNO055_ADDRESS_A 0x28
+#define BNO055_ADDRESS_B 0x29
+#define BNO055_ID 0xA0
+
+typedef enum {
+    BNO055_CHIP_ID_ADDR = 0x00,
+    BNO055_PAGE_ID_ADDR = 0x07,
+    BNO055_ACCEL_DATA_X_LSB_ADDR = 0x08,
+    BNO055_MAG_DATA_X_LSB_ADDR = 0x0E,
+    BNO055_GYRO_DATA_X_LSB_ADDR = 0x14,
+    BNO055_EULER_H_LSB_ADDR = 0x1A,
+    BNO055_QUATERNION_DATA_W_LSB_ADDR = 0x20,
+    BNO055_LINEAR_ACCEL_DATA_X_LSB_ADDR = 0x28,
+    BNO055_GRAVITY_DATA_X_LSB_ADDR = 0x2E,
+    BNO055_TEMP_ADDR = 0x34,
+    BNO055_CALIB_STAT_ADDR = 0x35,
+    BNO055_SYS_STAT_ADDR = 0x39,
+    BNO055_SYS_ERR_ADDR = 0x3A,
+    BNO055_UNIT_SEL_ADDR = 0x3B,
+    BNO055_OPR_MODE_ADDR = 0x3D,
+    BNO055_PWR_MODE_ADDR = 0x3E,
+    BNO055_SYS_TRIGGER_ADDR = 0x3F,
+    ACCEL_OFFSET_X_LSB_ADDR = 0x55,
+    MAG_RADIUS_MSB_ADDR = 0x6A
+} bno055_reg_t;
+
+typedef enum {
+    POWER_MODE_NORMAL = 0x00,
+    POWER_MODE_LOWPOWER = 0x01,
+    POWER_MODE_SUSPEND = 0x02
+} bno055_powermode_t;
+
+typedef enum {
+    OPERATION_MODE_CONFIG = 0x00,
+    OPERATION_MODE_ACCONLY = 0x01,
+    OPERATION_MODE_IMUPLUS = 0x08,
+    OPERATION_MODE_NDOF_FMC_OFF = 0x0B,
+    OPERATION_MODE_NDOF = 0x0C
+} bno055_opmode_t;
+
+typedef enum {
+    VECTOR_ACCELEROMETER = BNO055_ACCEL_DATA_X_LSB_ADDR,
+    VECTOR_MAGNETOMETER = BNO055_MAG_DATA_X_LSB_ADDR,
+    VECTOR_GYROSCOPE = BNO055_GYRO_DATA_X_LSB_ADDR,
+    VECTOR_EULER = BNO055_EULER_H_LSB_ADDR,
+    VECTOR_LINEARACCEL = BNO055_LINEAR_ACCEL_DATA_X_LSB_ADDR,
+    VECTOR_GRAVITY = BNO055_GRAVITY_DATA_X_LSB_ADDR
+} vector_type_t;
+
+typedef struct {
+    double w;
+    double x;
+    double y;
+    double z;
+} bno055_quat_data_t;
+
+typedef struct {
+    double x;
+    double y;
+    double z;
+} bno055_vector_data_t;
+
+typedef struct {
+    uint8_t sys;
+    uint8_t gyro;
+    uint8_t accel;
+    uint8_t mag;
+} bno055_calibration_data_t;
+
+typedef struct {
+    uint16_t accel_offset_x;
+    uint16_t accel_offset_y;
+    uint16_t accel_offset_z;
+    uint16_t gyro_offset_x;
+    uint16_t gyro_offset_y;
+    uint16_t gyro_offset_z;
+    uint16_t mag_offset_x;
+    uint16_t mag_offset_y;
+    uint16_t mag_offset_z;
+    uint16_t accel_radius;
+    uint16_t mag_radius;
+} bno055_offsets_t;
+
+KSensorStatus bno055_setup(bno055_opmode_t mode);
+
+KSensorStatus bno055_set_mode(bno055_opmode_t mode);
+
+KSensorStatus bno055_get_position(bno055_quat_data_t * quat);
+
+KSensorStatus bno055_get_data_vector(vector_type_t type, bno055_vector_data_t * vector);
+
+KSensorStatus bno055_get_calibration(bno055_calibration_data_t * calib);
+
+KSensorStatus bno055_check_calibration(uint8_t * calibCount, uint8_t retries,
+                                       bno055_offsets_t * offsets);
+
+KSensorStatus bno055_get_sensor_offset_struct(bno055_offsets_t * offsets);
+
+KSensorStatus bno055_set_sensor_offset_struct(bno055_offsets_t offsets);
+
+#endif
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_HTU21D_H
+#define SIM_HTU21D_H
+
+/**
+ * Host stand-in for the kubos-core HTU21D driver, talking to the
+ * simulated sensor over the simulated I2C bus.
+ */
+
+#include "sensors.h"
+
+#define HTU21D_I2C_ADDR 0x40
+
+#define HTU21D_TRIGGER_TEMP_HOLD 0xE3
+#define HTU21D_TRIGGER_HUM_HOLD 0xE5
+#define HTU21D_TRIGGER_TEMP_NOHOLD 0xF3
+#define HTU21D_TRIGGER_HUM_NOHOLD 0xF5
+#define HTU21D_WRITE_USER_REG 0xE6
+#define HTU21D_READ_USER_REG 0xE7
+#define HTU21D_SOFT_RESET 0xFE
+
+KSensorStatus htu21d_setup(void);
+
+KSensorStatus htu21d_reset(void);
+
+KSensorStatus htu21d_read_temperature(float * temp);
+
+KSensorStatus htu21d_read_humidity(float * hum);
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_K_I2C_H
+#define SIM_K_I2C_H
+
+/**
+ * Host stand-in for kubos-hal I2C. Transfers go to the simulated devices
+ * in sim/i2c.c and take as long as they would on a real bus.
+ */
+
+#include <stdint.h>
+
+typedef enum {
+    K_I2C_NO_BUS = 0,
+    K_I2C1,
+    K_I2C2,
+    K_I2C3
+} KI2CNum;
+
+typedef enum {
+    I2C_OK = 0,
+    I2C_ERROR,
+    I2C_ERROR_AF,
+    I2C_ERROR_ADDR_TIMEOUT,
+    I2C_ERROR_TIMEOUT,
+    I2C_ERROR_NACK,
+    I2C_ERROR_TXE_TIMEOUT,
+    I2C_ERROR_BTF_TIMEOUT,
+    I2C_ERROR_NULL_HANDLE,
+    I2C_ERROR_CONFIG
+} KI2CStatus;
+
+KI2CStatus k_i2c_write(KI2CNum i2c, uint16_t addr, uint8_t * ptr, int len);
+
+KI2CStatus k_i2c_read(KI2CNum i2c, uint16_t addr, uint8_t * ptr, int len);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_K_UART_H
+#define SIM_K_UART_H
+
+#include <stdint.h>
+
+typedef enum {
+    K_UART1 = 0,
+    K_UART2,
+    K_UART3,
+    K_UART4,
+    K_UART5,
+    K_UART6,
+    K_NUM_UARTS
+} KUARTNum;
+
+void k_uart_console_init(void);
+
+int k_uart_write(KUARTNum uart, char * ptr, int len);
+
+int k_uart_read(KUARTNum uart, char * ptr, int len);
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_AGGREGATOR_H
+#define SIM_AGGREGATOR_H
+
+#include <csp/arch/csp_thread.h>
+#include <telemetry/telemetry.h>
+
+#define INIT_AGGREGATOR_THREAD \
+    csp_thread_handle_t telem_aggregator_handle; \
+    csp_thread_create(aggregator, "TELEM_AGG", 1000, NULL, 0, &telem_aggregator_handle);
+
+CSP_DEFINE_TASK(aggregator);
+
+void user_aggregator();
+
+void aggregator_submit(telemetry_source source, float data);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_TELEMETRY_H
+#define SIM_TELEMETRY_H
+
+/**
+ * Host stand-in for the Kubos telemetry types. telemetry_init brings up
+ * CSP the way the flight service does; publishing and subscribing are
+ * not simulated since the node downlinks samples directly.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <csp/csp.h>
+
+typedef enum {
+    TELEMETRY_TYPE_INT = 0,
+    TELEMETRY_TYPE_FLOAT
+} telemetry_data_type;
+
+typedef union {
+    int i;
+    float f;
+} telemetry_union;
+
+typedef struct {
+    uint8_t source_id;
+    telemetry_data_type data_type;
+    uint16_t subsystem_mask;
+} telemetry_source;
+
+typedef struct {
+    telemetry_source source;
+    telemetry_union data;
+    uint16_t timestamp;
+} telemetry_packet;
+
+void telemetry_init(void);
+
+#endif
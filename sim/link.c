@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define _GNU_SOURCE
+#include "sim.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <csp/drivers/usart.h>
+#include <kubos-hal/uart.h>
+
+/**
+ * The UART carrying KISS to the log node. Bytes written by usart_putc
+ * go through a transmit queue the size of the flight UART's and leave
+ * it at the configured baud rate (10 bit times per byte), so the log
+ * node sees each byte when its stop bit would have gone out.
+ *
+ * UKUB_SIM_LOGNODE names a command to run as the log node, talking KISS
+ * on its stdin and stdout. Without it a pty is opened and its name is
+ * logged so a log node can be attached by hand.
+ */
+
+#define CSP_UART_BUS YOTTA_CFG_CSP_UART_BUS
+
+#ifdef YOTTA_CFG_HARDWARE_UARTDEFAULTS_TXQUEUELEN
+#define TX_QUEUE_LEN YOTTA_CFG_HARDWARE_UARTDEFAULTS_TXQUEUELEN
+#else
+#define TX_QUEUE_LEN 128
+#endif
+
+static struct {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t queue[TX_QUEUE_LEN];
+    int head;
+    int count;
+    uint64_t byte_us;
+    usart_callback_t callback;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t dropped;
+} uart = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+
+static bool link_down(void)
+{
+    sim_world_t world;
+
+    sim_world(&world);
+
+    return world.link_down;
+}
+
+
+/* Clock queued bytes out onto the wire */
+static void * tx_thread(void * arg)
+{
+    uint8_t chunk[64];
+    uint64_t wire = 0;
+    int per_ms = (int)(1000 / uart.byte_us) + 1;
+    int n;
+    int i;
+
+    (void) arg;
+
+    if (per_ms > (int) sizeof(chunk))
+    {
+        per_ms = sizeof(chunk);
+    }
+
+    while (1)
+    {
+        pthread_mutex_lock(&uart.lock);
+        while (uart.count == 0)
+        {
+            pthread_cond_wait(&uart.cond, &uart.lock);
+        }
+
+        n = (uart.count < per_ms) ? uart.count : per_ms;
+        for (i = 0; i < n; i++)
+        {
+            chunk[i] = uart.queue[(uart.head + i) % TX_QUEUE_LEN];
+        }
+        pthread_mutex_unlock(&uart.lock);
+
+        /* The line idles between frames */
+        if (wire < sim_now_us())
+        {
+            wire = sim_now_us();
+        }
+        wire += n * uart.byte_us;
+        sim_sleep_until_us(wire);
+
+        if (link_down())
+        {
+            uart.dropped += n;
+        }
+        else if (write(uart.fd, chunk, n) == n)
+        {
+            uart.tx_bytes += n;
+        }
+
+        pthread_mutex_lock(&uart.lock);
+        uart.head = (uart.head + n) % TX_QUEUE_LEN;
+        uart.count -= n;
+        pthread_cond_broadcast(&uart.cond);
+        pthread_mutex_unlock(&uart.lock);
+    }
+
+    return NULL;
+}
+
+
+static void * rx_thread(void * arg)
+{
+    uint8_t buf[64];
+    ssize_t n;
+
+    (void) arg;
+
+    while ((n = read(uart.fd, buf, sizeof(buf))) != 0)
+    {
+        if (n < 0)
+        {
+            sim_sleep_us(10000);
+            continue;
+        }
+
+        uart.rx_bytes += n;
+
+        if (uart.callback != NULL && !link_down())
+        {
+            uart.callback(buf, n, NULL);
+        }
+    }
+
+    sim_log("log node closed the KISS link");
+
+    return NULL;
+}
+
+
+static int open_lognode(const char * command)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        return -1;
+    }
+
+    if (fork() == 0)
+    {
+        char epoch[24];
+
+        /* Lets the log node time arrivals on the node's clock */
+        snprintf(epoch, sizeof(epoch), "%llu", (unsigned long long) sim_epoch_ns());
+        setenv("UKUB_SIM_EPOCH_NS", epoch, 1);
+
+        dup2(fds[1], STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    sim_log("KISS link to '%s'", command);
+
+    return fds[0];
+}
+
+
+static int open_pty(void)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    struct termios raw;
+    int slave;
+
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+    {
+        return -1;
+    }
+
+    /* Keep the far end open and raw, so nothing is echoed back at us */
+    if ((slave = open(ptsname(fd), O_RDWR | O_NOCTTY)) >= 0)
+    {
+        tcgetattr(slave, &raw);
+        cfmakeraw(&raw);
+        tcsetattr(slave, TCSANOW, &raw);
+    }
+
+    sim_log("KISS link on %s", ptsname(fd));
+
+    return fd;
+}
+
+
+/**
+ * usart_init: open the uart. conf->device and conf->baudrate are not
+ * used; the rate comes from csp.baudrate, or UKUB_SIM_BAUD.
+ */
+
+void usart_init(struct usart_conf * conf)
+{
+    const char * command = sim_env_str("UKUB_SIM_LOGNODE", NULL);
+    long baud = sim_env_long("UKUB_SIM_BAUD", YOTTA_CFG_CSP_BAUDRATE);
+    pthread_t thread;
+
+    (void) conf;
+
+    uart.byte_us = 10000000 / baud;
+    uart.fd = (command != NULL) ? open_lognode(command) : open_pty();
+    if (uart.fd < 0)
+    {
+        sim_log("couldn't open the KISS link");
+        exit(1);
+    }
+
+    pthread_create(&thread, NULL, tx_thread, NULL);
+    pthread_create(&thread, NULL, rx_thread, NULL);
+}
+
+
+void usart_set_callback(usart_callback_t callback)
+{
+    uart.callback = callback;
+}
+
+
+void usart_insert(char c, void * pxTaskWoken)
+{
+    (void) pxTaskWoken;
+
+    putchar(c);
+}
+
+
+/* Queue bytes for the wire, waiting for room as the flight UART does */
+static void uart_queue(const char * buf, int len)
+{
+    pthread_mutex_lock(&uart.lock);
+    while (len > 0)
+    {
+        while (uart.count == TX_QUEUE_LEN)
+        {
+            pthread_cond_wait(&uart.cond, &uart.lock);
+        }
+
+        while (len > 0 && uart.count < TX_QUEUE_LEN)
+        {
+            uart.queue[(uart.head + uart.count) % TX_QUEUE_LEN] = *buf++;
+            uart.count++;
+            len--;
+        }
+        pthread_cond_broadcast(&uart.cond);
+    }
+    pthread_mutex_unlock(&uart.lock);
+}
+
+
+void usart_putc(char c)
+{
+    uart_queue(&c, 1);
+}
+
+
+void usart_putstr(char * buf, int len)
+{
+    uart_queue(buf, len);
+}
+
+
+void sim_link_report(void)
+{
+    sim_log("link: %llu bytes sent, %llu received, %llu lost while down",
+            (unsigned long long) uart.tx_bytes, (unsigned long long) uart.rx_bytes,
+            (unsigned long long) uart.dropped);
+}
+
+
+void k_uart_console_init(void)
+{
+}
+
+
+/* The CSP bus is the KISS link; anything else is the console */
+int k_uart_write(KUARTNum uart, char * ptr, int len)
+{
+    if (uart == CSP_UART_BUS)
+    {
+        usart_putstr(ptr, len);
+        return len;
+    }
+
+    return fwrite(ptr, 1, len, stdout);
+}
+
+
+int k_uart_read(KUARTNum uart, char * ptr, int len)
+{
+    (void) uart;
+    (void) ptr;
+    (void) len;
+
+    return 0;
+}
@@ -0,0 +1,665 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <timers.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+
+/**
+ * FreeRTOS and the CSP arch layer on POSIX threads. Every task is a
+ * thread with its own notification count. Priorities are ignored, so the
+ * host scheduler decides who runs; timing is real time, not simulated
+ * time, so anything measured here includes the host's own latency.
+ * Software timers each get a thread of their own instead of sharing the
+ * FreeRTOS timer task.
+ */
+
+#define FOREVER 0xFFFFFFFFUL
+
+struct sim_task {
+    pthread_t thread;
+    const char * name;
+    void (*routine)(void *);
+    void * param;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+};
+
+struct sim_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int count;
+};
+
+struct sim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t * items;
+    size_t item_size;
+    int length;
+    int head;
+    int count;
+};
+
+struct sim_timer {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    TickType_t period;
+    bool reload;
+    bool running;
+    void * id;
+    TimerCallbackFunction_t callback;
+};
+
+static struct timespec start;
+static pthread_condattr_t monotonic;
+static __thread struct sim_task * current;
+
+
+__attribute__((constructor))
+static void sim_start(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_condattr_init(&monotonic);
+    pthread_condattr_setclock(&monotonic, CLOCK_MONOTONIC);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    sim_script_init();
+    sim_i2c_init();
+}
+
+
+uint64_t sim_epoch_ns(void)
+{
+    return (uint64_t) start.tv_sec * 1000000000 + start.tv_nsec;
+}
+
+
+uint64_t sim_now_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - start.tv_sec) * 1000000
+         + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+
+void sim_sleep_us(uint64_t us)
+{
+    struct timespec delay = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR);
+}
+
+
+void sim_sleep_until_us(uint64_t when)
+{
+    uint64_t now = sim_now_us();
+
+    if (when > now)
+    {
+        sim_sleep_us(when - now);
+    }
+}
+
+
+long sim_env_long(const char * name, long fallback)
+{
+    const char * value = getenv(name);
+
+    return (value != NULL && *value != '\0') ? strtol(value, NULL, 0) : fallback;
+}
+
+
+const char * sim_env_str(const char * name, const char * fallback)
+{
+    const char * value = getenv(name);
+
+    return (value != NULL && *value != '\0') ? value : fallback;
+}
+
+
+void sim_log(const char * fmt, ...)
+{
+    va_list args;
+    uint64_t now = sim_now_us();
+
+    fprintf(stderr, "[sim %6lu.%03lu] ", (unsigned long)(now / 1000000),
+            (unsigned long)(now / 1000 % 1000));
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+
+/* Absolute CLOCK_MONOTONIC deadline for a timeout in ms */
+static struct timespec deadline(uint32_t timeout)
+{
+    struct timespec when;
+
+    clock_gettime(CLOCK_MONOTONIC, &when);
+    when.tv_sec += timeout / 1000;
+    when.tv_nsec += (long)(timeout % 1000) * 1000000;
+    if (when.tv_nsec >= 1000000000)
+    {
+        when.tv_sec++;
+        when.tv_nsec -= 1000000000;
+    }
+
+    return when;
+}
+
+
+/* Wait on a condition; false once the timeout has run out */
+static bool timed_wait(pthread_cond_t * cond, pthread_mutex_t * lock,
+                       const struct timespec * when, uint32_t timeout)
+{
+    if (timeout == FOREVER)
+    {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+
+    return pthread_cond_timedwait(cond, lock, when) != ETIMEDOUT;
+}
+
+
+static struct sim_task * task_new(const char * name)
+{
+    struct sim_task * task = calloc(1, sizeof(*task));
+
+    task->name = name;
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, &monotonic);
+
+    return task;
+}
+
+
+static void * task_entry(void * arg)
+{
+    current = arg;
+    current->routine(current->param);
+
+    return NULL;
+}
+
+
+int csp_thread_create(csp_thread_return_t (*routine)(void *), const char * const thread_name,
+                      unsigned short stack_depth, void * parameters, unsigned int priority,
+                      csp_thread_handle_t * handle)
+{
+    struct sim_task * task = task_new(thread_name);
+
+    (void) stack_depth;
+    (void) priority;
+
+    task->routine = routine;
+    task->param = parameters;
+
+    if (pthread_create(&task->thread, NULL, task_entry, task) != 0)
+    {
+        free(task);
+        return -1;
+    }
+
+    if (handle != NULL)
+    {
+        *handle = task;
+    }
+
+    return 0;
+}
+
+
+void csp_sleep_ms(uint32_t time_ms)
+{
+    sim_sleep_us((uint64_t) time_ms * 1000);
+}
+
+
+uint32_t csp_get_ms(void)
+{
+    return (uint32_t)(sim_now_us() / 1000);
+}
+
+
+uint32_t csp_get_ms_isr(void)
+{
+    return csp_get_ms();
+}
+
+
+void vTaskDelay(TickType_t ticks)
+{
+    sim_sleep_us((uint64_t) ticks * portTICK_PERIOD_MS * 1000);
+}
+
+
+TickType_t xTaskGetTickCount(void)
+{
+    return csp_get_ms() / portTICK_PERIOD_MS;
+}
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (current == NULL)
+    {
+        current = task_new("main");
+        current->thread = pthread_self();
+    }
+
+    return current;
+}
+
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct sim_task * task = xTaskGetCurrentTaskHandle();
+    uint32_t timeout = (ticks == portMAX_DELAY) ? FOREVER : ticks * portTICK_PERIOD_MS;
+    struct timespec when = deadline(timeout);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify == 0 && timed_wait(&task->cond, &task->lock, &when, timeout));
+
+    value = task->notify;
+    if (value > 0)
+    {
+        task->notify = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+
+    return value;
+}
+
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+
+    return pdPASS;
+}
+
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t * woken)
+{
+    xTaskNotifyGive(task);
+
+    if (woken != NULL)
+    {
+        *woken = pdTRUE;
+    }
+}
+
+
+/**
+ * vTaskStartScheduler: the tasks are already running as threads, so
+ * this only waits out the run. With UKUB_SIM_DURATION (ms) set the
+ * simulator prints its counters and exits when the time is up.
+ */
+
+void vTaskStartScheduler(void)
+{
+    long duration = sim_env_long("UKUB_SIM_DURATION", 0);
+
+    if (duration <= 0)
+    {
+        while (1)
+        {
+            sim_sleep_us(1000000);
+        }
+    }
+
+    sim_sleep_until_us((uint64_t) duration * 1000);
+
+    sim_link_report();
+    sim_i2c_report();
+    sim_gpio_report();
+    fflush(NULL);
+
+    exit(0);
+}
+
+
+static void * timer_entry(void * arg)
+{
+    struct sim_timer * timer = arg;
+    struct timespec when;
+    bool expired;
+
+    pthread_mutex_lock(&timer->lock);
+    while (1)
+    {
+        while (!timer->running)
+        {
+            pthread_cond_wait(&timer->cond, &timer->lock);
+        }
+
+        /* A start or stop while waiting restarts the period */
+        when = deadline(timer->period * portTICK_PERIOD_MS);
+        expired = !timed_wait(&timer->cond, &timer->lock, &when, timer->period * portTICK_PERIOD_MS);
+        if (!expired || !timer->running)
+        {
+            continue;
+        }
+
+        timer->running = timer->reload;
+        pthread_mutex_unlock(&timer->lock);
+        timer->callback(timer);
+        pthread_mutex_lock(&timer->lock);
+    }
+
+    return NULL;
+}
+
+
+TimerHandle_t xTimerCreate(const char * const name, TickType_t period, UBaseType_t reload,
+                           void * id, TimerCallbackFunction_t callback)
+{
+    struct sim_timer * timer = calloc(1, sizeof(*timer));
+
+    (void) name;
+
+    pthread_mutex_init(&timer->lock, NULL);
+    pthread_cond_init(&timer->cond, &monotonic);
+    timer->period = period;
+    timer->reload = reload;
+    timer->id = id;
+    timer->callback = callback;
+
+    if (pthread_create(&timer->thread, NULL, timer_entry, timer) != 0)
+    {
+        free(timer);
+        return NULL;
+    }
+
+    return timer;
+}
+
+
+static BaseType_t timer_set(TimerHandle_t timer, bool running)
+{
+    pthread_mutex_lock(&timer->lock);
+    timer->running = running;
+    pthread_cond_signal(&timer->cond);
+    pthread_mutex_unlock(&timer->lock);
+
+    return pdPASS;
+}
+
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks)
+{
+    (void) ticks;
+
+    return timer_set(timer, true);
+}
+
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks)
+{
+    (void) ticks;
+
+    return timer_set(timer, false);
+}
+
+
+void * pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
+
+
+static struct sim_sem * sem_new(int count)
+{
+    struct sim_sem * sem = calloc(1, sizeof(*sem));
+
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->cond, &monotonic);
+    sem->count = count;
+
+    return sem;
+}
+
+
+static int sem_take(struct sim_sem * sem, uint32_t timeout)
+{
+    struct timespec when = deadline(timeout);
+    int ret = CSP_SEMAPHORE_ERROR;
+
+    pthread_mutex_lock(&sem->lock);
+    while (sem->count == 0 && timed_wait(&sem->cond, &sem->lock, &when, timeout));
+
+    if (sem->count > 0)
+    {
+        sem->count--;
+        ret = CSP_SEMAPHORE_OK;
+    }
+    pthread_mutex_unlock(&sem->lock);
+
+    return ret;
+}
+
+
+static int sem_give(struct sim_sem * sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    sem->count = 1;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+
+    return CSP_SEMAPHORE_OK;
+}
+
+
+int csp_mutex_create(csp_mutex_t * mutex)
+{
+    *mutex = sem_new(1);
+
+    return CSP_MUTEX_OK;
+}
+
+
+int csp_mutex_remove(csp_mutex_t * mutex)
+{
+    free(*mutex);
+    *mutex = NULL;
+
+    return CSP_MUTEX_OK;
+}
+
+
+/* FreeRTOS would fault here; report it and carry on without the lock */
+static bool mutex_missing(csp_mutex_t * mutex, const char * what)
+{
+    static bool reported;
+
+    if (*mutex != NULL)
+    {
+        return false;
+    }
+
+    if (!reported)
+    {
+        sim_log("%s on a mutex that was never created", what);
+        reported = true;
+    }
+
+    return true;
+}
+
+
+int csp_mutex_lock(csp_mutex_t * mutex, uint32_t timeout)
+{
+    if (mutex_missing(mutex, "csp_mutex_lock"))
+    {
+        return CSP_MUTEX_ERROR;
+    }
+
+    return sem_take(*mutex, timeout);
+}
+
+
+int csp_mutex_unlock(csp_mutex_t * mutex)
+{
+    if (mutex_missing(mutex, "csp_mutex_unlock"))
+    {
+        return CSP_MUTEX_ERROR;
+    }
+
+    return sem_give(*mutex);
+}
+
+
+int csp_bin_sem_create(csp_bin_sem_handle_t * sem)
+{
+    *sem = sem_new(1);
+
+    return CSP_SEMAPHORE_OK;
+}
+
+
+int csp_bin_sem_remove(csp_bin_sem_handle_t * sem)
+{
+    return csp_mutex_remove(sem);
+}
+
+
+int csp_bin_sem_wait(csp_bin_sem_handle_t * sem, uint32_t timeout)
+{
+    return sem_take(*sem, timeout);
+}
+
+
+int csp_bin_sem_post(csp_bin_sem_handle_t * sem)
+{
+    return sem_give(*sem);
+}
+
+
+int csp_bin_sem_post_isr(csp_bin_sem_handle_t * sem, void * pxTaskWoken)
+{
+    (void) pxTaskWoken;
+
+    return sem_give(*sem);
+}
+
+
+csp_queue_handle_t csp_queue_create(int length, size_t item_size)
+{
+    struct sim_queue * queue = calloc(1, sizeof(*queue));
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, &monotonic);
+    queue->items = calloc(length, item_size);
+    queue->item_size = item_size;
+    queue->length = length;
+
+    return queue;
+}
+
+
+void csp_queue_remove(csp_queue_handle_t queue)
+{
+    free(queue->items);
+    free(queue);
+}
+
+
+int csp_queue_enqueue(csp_queue_handle_t queue, void * value, uint32_t timeout)
+{
+    struct timespec when = deadline(timeout);
+    int ret = CSP_QUEUE_FULL;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length && timed_wait(&queue->cond, &queue->lock, &when, timeout));
+
+    if (queue->count < queue->length)
+    {
+        memcpy(queue->items + ((queue->head + queue->count) % queue->length) * queue->item_size,
+               value, queue->item_size);
+        queue->count++;
+        pthread_cond_broadcast(&queue->cond);
+        ret = CSP_QUEUE_OK;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return ret;
+}
+
+
+int csp_queue_enqueue_isr(csp_queue_handle_t queue, void * value, void * pxTaskWoken)
+{
+    (void) pxTaskWoken;
+
+    return csp_queue_enqueue(queue, value, 0);
+}
+
+
+int csp_queue_dequeue(csp_queue_handle_t queue, void * buf, uint32_t timeout)
+{
+    struct timespec when = deadline(timeout);
+    int ret = CSP_QUEUE_ERROR;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && timed_wait(&queue->cond, &queue->lock, &when, timeout));
+
+    if (queue->count > 0)
+    {
+        memcpy(buf, queue->items + queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->cond);
+        ret = CSP_QUEUE_OK;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return ret;
+}
+
+
+int csp_queue_size(csp_queue_handle_t queue)
+{
+    int count;
+
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+
+    return count;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The scripted environment the simulated sensors and link see. A script
+ * (UKUB_SIM_SCRIPT) is a list of timed changes, one per line:
+ *
+ *     # ms   setting      value(s)
+ *     0      temperature  21.5
+ *     0      humidity     40
+ *     0      rate         0 0 10
+ *     5000   shake        2.0
+ *     8000   calib        0xFF
+ *     9000   i2c_faults   3
+ *     12000  link         down
+ *     15000  link         up
+ *
+ * Lines must be in time order. Settings not in the script keep the
+ * defaults below.
+ */
+
+#define MAX_EVENTS 256
+
+typedef struct {
+    uint32_t at;
+    char key[16];
+    double value[3];
+} sim_event_t;
+
+static struct {
+    pthread_mutex_t lock;
+    sim_world_t world;
+    sim_event_t events[MAX_EVENTS];
+    int count;
+    int next;
+} script = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .world = {
+        .temperature = 22.5,
+        .humidity = 45.0,
+        .rate = { 0.0, 0.0, 10.0 },
+        .shake = 0.05,
+        .calib_stat = 0xFF
+    }
+};
+
+
+void sim_script_init(void)
+{
+    const char * path = sim_env_str("UKUB_SIM_SCRIPT", NULL);
+    char line[128];
+    sim_event_t * event;
+    FILE * file;
+
+    if (path == NULL)
+    {
+        return;
+    }
+
+    if ((file = fopen(path, "r")) == NULL)
+    {
+        sim_log("can't open script %s", path);
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL && script.count < MAX_EVENTS)
+    {
+        char value[3][32] = { "", "", "" };
+
+        event = &script.events[script.count];
+        if (line[0] == '#' ||
+            sscanf(line, "%u %15s %31s %31s %31s", &event->at, event->key,
+                   value[0], value[1], value[2]) < 3)
+        {
+            continue;
+        }
+
+        if (strcmp(event->key, "link") == 0)
+        {
+            event->value[0] = (strcmp(value[0], "down") == 0);
+        }
+        else
+        {
+            event->value[0] = strtod(value[0], NULL);
+            event->value[1] = strtod(value[1], NULL);
+            event->value[2] = strtod(value[2], NULL);
+        }
+
+        script.count++;
+    }
+
+    fclose(file);
+}
+
+
+static void apply(const sim_event_t * event)
+{
+    sim_world_t * world = &script.world;
+
+    if (strcmp(event->key, "temperature") == 0)
+    {
+        world->temperature = event->value[0];
+    }
+    else if (strcmp(event->key, "humidity") == 0)
+    {
+        world->humidity = event->value[0];
+    }
+    else if (strcmp(event->key, "rate") == 0)
+    {
+        memcpy(world->rate, event->value, sizeof(world->rate));
+    }
+    else if (strcmp(event->key, "shake") == 0)
+    {
+        world->shake = event->value[0];
+    }
+    else if (strcmp(event->key, "calib") == 0)
+    {
+        world->calib_stat = (uint8_t) event->value[0];
+    }
+    else if (strcmp(event->key, "i2c_faults") == 0)
+    {
+        world->i2c_faults += (uint32_t) event->value[0];
+    }
+    else if (strcmp(event->key, "link") == 0)
+    {
+        world->link_down = event->value[0] != 0;
+        sim_log("link %s", world->link_down ? "down" : "up");
+    }
+    else
+    {
+        sim_log("unknown script setting '%s'", event->key);
+    }
+}
+
+
+/* Catch the world up with the script; script.lock must be held */
+static void advance(void)
+{
+    uint32_t now = (uint32_t)(sim_now_us() / 1000);
+
+    while (script.next < script.count && script.events[script.next].at <= now)
+    {
+        apply(&script.events[script.next++]);
+    }
+}
+
+
+void sim_world(sim_world_t * world)
+{
+    pthread_mutex_lock(&script.lock);
+    advance();
+    *world = script.world;
+    pthread_mutex_unlock(&script.lock);
+}
+
+
+bool sim_take_i2c_fault(void)
+{
+    bool fault = false;
+
+    pthread_mutex_lock(&script.lock);
+    advance();
+    if (script.world.i2c_faults > 0)
+    {
+        script.world.i2c_faults--;
+        fault = true;
+    }
+    pthread_mutex_unlock(&script.lock);
+
+    return fault;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "sim.h"
+
+#include <csp/csp.h>
+#include <telemetry/config.h>
+#include <telemetry/telemetry.h>
+#include <telemetry-aggregator/aggregator.h>
+
+/**
+ * The telemetry service and aggregator loop the node links against.
+ * telemetry_init brings up CSP as the flight service does; the
+ * aggregator calls user_aggregator and sleeps for the configured
+ * interval, as telemetry-aggregator does.
+ */
+
+#define AGGREGATOR_INTERVAL YOTTA_CFG_TELEMETRY_AGGREGATOR_INTERVAL
+
+
+void telemetry_init(void)
+{
+    csp_init(TELEMETRY_CSP_ADDRESS);
+}
+
+
+void aggregator_submit(telemetry_source source, float data)
+{
+    (void) source;
+    (void) data;
+}
+
+
+CSP_DEFINE_TASK(aggregator)
+{
+    while (1)
+    {
+        user_aggregator();
+        csp_sleep_ms(AGGREGATOR_INTERVAL);
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+/**
+ * Shared pieces of the host simulator. Everything the node normally gets
+ * from FreeRTOS, kubos-hal, kubos-core and libcsp is provided by the
+ * files in this directory on top of POSIX, behind the same headers as
+ * the flight build.
+ *
+ * Run time settings come from UKUB_SIM_* environment variables, so a
+ * benchmark can sweep them without rebuilding.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* CLOCK_MONOTONIC time the simulator started at, in ns */
+uint64_t sim_epoch_ns(void);
+
+/* Microseconds since the simulator started */
+uint64_t sim_now_us(void);
+
+void sim_sleep_us(uint64_t us);
+
+/* Sleep until an absolute sim_now_us time */
+void sim_sleep_until_us(uint64_t when);
+
+long sim_env_long(const char * name, long fallback);
+
+const char * sim_env_str(const char * name, const char * fallback);
+
+void sim_log(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* Scripted environment, see sim/script.c */
+typedef struct {
+    double temperature;
+    double humidity;
+    /* Rotation rate about each axis in deg/s */
+    double rate[3];
+    /* Amplitude of random linear acceleration in m/s^2 */
+    double shake;
+    /* CALIB_STAT register value */
+    uint8_t calib_stat;
+    /* Fail this many upcoming I2C transfers */
+    uint32_t i2c_faults;
+    /* Drop the KISS link while true */
+    bool link_down;
+} sim_world_t;
+
+void sim_script_init(void);
+
+/* Snapshot of the scripted environment at the current time */
+void sim_world(sim_world_t * world);
+
+/* Take one pending I2C fault, if any */
+bool sim_take_i2c_fault(void);
+
+void sim_i2c_init(void);
+
+void sim_link_report(void);
+
+void sim_i2c_report(void);
+
+void sim_gpio_report(void);
+
+#endif
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2016 Kubos Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Write the YOTTA_CFG_* definitions yotta would generate from config.json,
+so the host simulator builds against the same configuration.
+"""
+
+import json
+import re
+import sys
+
+
+def macro(path):
+    return 'YOTTA_CFG_' + '_'.join(re.sub('[^A-Za-z0-9]', '_', key).upper() for key in path)
+
+
+def walk(path, value, out):
+    if isinstance(value, dict):
+        out.append('#define %s 1' % macro(path))
+        for key, child in value.items():
+            walk(path + [key], child, out)
+    elif isinstance(value, bool):
+        out.append('#define %s %d' % (macro(path), 1 if value else 0))
+    else:
+        out.append('#define %s %s' % (macro(path), value))
+
+
+def main():
+    config = json.load(open(sys.argv[1]))
+    out = ['/* Generated from %s, do not edit */' % sys.argv[1],
+           '#ifndef YOTTA_CONFIG_H', '#define YOTTA_CONFIG_H']
+    for key, value in config.items():
+        walk([key], value, out)
+    out.append('#endif')
+    print('\n'.join(out))
+
+
+if __name__ == '__main__':
+    main()
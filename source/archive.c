@@ -0,0 +1,629 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "archive.h"
+#include "disk.h"
+#include "downlink.h"
+
+#include <string.h>
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+/**
+ * The archive keeps every live telemetry packet the node sends, whether
+ * it got through or not, so the ground can fetch what it missed. Burst
+ * capture samples are not archived: they are drained by the log node
+ * task and appending to the archive is left to the sender task. Like the
+ * journal it is a preallocated file used as a ring of sectors: sector 0
+ * holds the header and sectors 1..ARCHIVE_SECTORS hold packets. A second
+ * file holds a sparse index, one entry for every ARCHIVE_INDEX_STRIDE'th
+ * data sector, so a query finds its first sector with a binary search of
+ * the index instead of a scan of the data.
+ *
+ * Archive time is ms since boot, carried on across reboots from the last
+ * archived packet in steps of 65536 ms, so it never goes backwards and
+ * its low 16 bits are still the live packet timestamps.
+ *
+ * Packets are appended by the sender task. Queries are answered by the
+ * archive task, a sector at a time under disk_lock, with one sector and
+ * one reply frame of RAM, and paced so the live stream keeps the link.
+ */
+
+#define ARCHIVE_PATH "TLM.ARC"
+#define ARCHIVE_INDEX_PATH "TLM.IDX"
+#define ARCHIVE_MAGIC 0x4152
+#define ARCHIVE_FORMAT 1
+
+#define ARCHIVE_INDEX_ENTRIES (ARCHIVE_SECTORS / ARCHIVE_INDEX_STRIDE)
+
+/* A query: start and end archive time, then up to this many source ids */
+#define ARCHIVE_QUERY_IDS 32
+#define ARCHIVE_QUERY_TIMEOUT 100
+#define ARCHIVE_SEND_TIMEOUT 100
+
+#define ARCHIVE_FRAME_PACKETS \
+    ((DOWNLINK_MTU - sizeof(archive_header_t)) / sizeof(telemetry_packet))
+
+#if ARCHIVE_SECTORS % ARCHIVE_INDEX_STRIDE
+#error "archive.sectors must be a multiple of archive.index_stride"
+#endif
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t format;
+    uint8_t reserved;
+    uint32_t seq;
+} archive_file_header_t;
+
+static struct {
+    FIL file;
+    FIL index;
+    bool open;
+    /* Sequence number of the next sector written, in slot seq % ARCHIVE_SECTORS */
+    uint32_t seq;
+    uint16_t unsynced;
+    /* Added to csp_get_ms() to get archive time */
+    uint32_t offset;
+    /* Sector being filled */
+    archive_sector_t wbuf;
+    uint32_t dropped;
+} archive;
+
+/* The archive task's sector buffer */
+static archive_sector_t query_sector;
+
+
+static uint32_t archive_now(void)
+{
+    return archive.offset + csp_get_ms();
+}
+
+
+/* Archive time of a packet timestamp, given a time at or shortly after it */
+static uint32_t extend_time(uint32_t reference, uint16_t timestamp)
+{
+    return reference - (uint16_t)((uint16_t) reference - timestamp);
+}
+
+
+/* Oldest sequence number still in the ring; the caller holds disk_lock */
+static uint32_t oldest_seq(void)
+{
+    return (archive.seq > ARCHIVE_SECTORS + 1) ? archive.seq - ARCHIVE_SECTORS : 1;
+}
+
+
+static uint16_t write_header(void)
+{
+    UINT bw;
+    uint16_t ret;
+    archive_file_header_t header = {
+        .magic = ARCHIVE_MAGIC,
+        .format = ARCHIVE_FORMAT,
+        .seq = archive.seq
+    };
+
+    if ((ret = f_lseek(&archive.file, 0)) == FR_OK &&
+        (ret = f_write(&archive.file, &header, sizeof(header), &bw)) == FR_OK &&
+        (ret = f_sync(&archive.file)) == FR_OK)
+    {
+        ret = f_sync(&archive.index);
+    }
+
+    archive.unsynced = 0;
+
+    return ret;
+}
+
+
+static uint16_t write_sector(uint32_t seq, const archive_sector_t * sector)
+{
+    UINT bw = 0;
+    uint16_t ret;
+    DWORD offset = (seq % ARCHIVE_SECTORS + 1) * ARCHIVE_SECTOR_SIZE;
+
+    if ((ret = f_lseek(&archive.file, offset)) == FR_OK &&
+        (ret = f_write(&archive.file, sector->raw, ARCHIVE_SECTOR_SIZE, &bw)) == FR_OK &&
+        bw != ARCHIVE_SECTOR_SIZE)
+    {
+        ret = FR_DISK_ERR;
+    }
+
+    return ret;
+}
+
+
+/**
+ * read_sector: read a data sector back.
+ * @return FR_OK only if the slot still holds sector seq
+ */
+
+static uint16_t read_sector(uint32_t seq, archive_sector_t * sector)
+{
+    UINT br = 0;
+    uint16_t ret;
+    DWORD offset = (seq % ARCHIVE_SECTORS + 1) * ARCHIVE_SECTOR_SIZE;
+
+    if ((ret = f_lseek(&archive.file, offset)) == FR_OK &&
+        (ret = f_read(&archive.file, sector->raw, ARCHIVE_SECTOR_SIZE, &br)) == FR_OK &&
+        (br != ARCHIVE_SECTOR_SIZE || sector->data.seq != seq ||
+         sector->data.count > ARCHIVE_SECTOR_PACKETS))
+    {
+        ret = FR_INT_ERR;
+    }
+
+    return ret;
+}
+
+
+static uint16_t write_index(uint32_t seq, uint32_t start)
+{
+    UINT bw = 0;
+    uint16_t ret;
+    archive_index_t entry = { .seq = seq, .start = start };
+    DWORD offset = (seq / ARCHIVE_INDEX_STRIDE % ARCHIVE_INDEX_ENTRIES) * sizeof(entry);
+
+    if ((ret = f_lseek(&archive.index, offset)) == FR_OK &&
+        (ret = f_write(&archive.index, &entry, sizeof(entry), &bw)) == FR_OK &&
+        bw != sizeof(entry))
+    {
+        ret = FR_DISK_ERR;
+    }
+
+    return ret;
+}
+
+
+/**
+ * read_index: read the index entry of sector seq, a multiple of
+ * ARCHIVE_INDEX_STRIDE.
+ * @return FR_OK only if the entry is for sector seq
+ */
+
+static uint16_t read_index(uint32_t seq, archive_index_t * entry)
+{
+    UINT br = 0;
+    uint16_t ret;
+    DWORD offset = (seq / ARCHIVE_INDEX_STRIDE % ARCHIVE_INDEX_ENTRIES) * sizeof(*entry);
+
+    if ((ret = f_lseek(&archive.index, offset)) == FR_OK &&
+        (ret = f_read(&archive.index, entry, sizeof(*entry), &br)) == FR_OK &&
+        (br != sizeof(*entry) || entry->seq != seq))
+    {
+        ret = FR_INT_ERR;
+    }
+
+    return ret;
+}
+
+
+/**
+ * create_archive: size new archive and index files and write an empty
+ * header.
+ */
+
+static uint16_t create_archive(void)
+{
+    uint16_t ret;
+    DWORD size = (ARCHIVE_SECTORS + 1) * ARCHIVE_SECTOR_SIZE;
+    DWORD index_size = ARCHIVE_INDEX_ENTRIES * sizeof(archive_index_t);
+
+#if _FATFS >= 88100
+    if ((ret = f_expand(&archive.file, size, 1)) != FR_OK ||
+        (ret = f_expand(&archive.index, index_size, 1)) != FR_OK)
+#else
+    if ((ret = f_lseek(&archive.file, size)) != FR_OK ||
+        (ret = f_lseek(&archive.index, index_size)) != FR_OK)
+#endif
+    {
+        return ret;
+    }
+
+    archive.seq = 1;
+    archive.offset = 0;
+
+    return write_header();
+}
+
+
+/**
+ * recover_archive: load the header, walk forward over any sectors
+ * written after it was last synced, and carry archive time on from the
+ * newest packet.
+ */
+
+static uint16_t recover_archive(void)
+{
+    UINT br = 0;
+    uint16_t ret;
+    uint32_t last;
+    archive_file_header_t header;
+    archive_sector_t * sector = &archive.wbuf;
+
+    if ((ret = f_lseek(&archive.file, 0)) != FR_OK ||
+        (ret = f_read(&archive.file, &header, sizeof(header), &br)) != FR_OK)
+    {
+        return ret;
+    }
+
+    if (br != sizeof(header) || header.magic != ARCHIVE_MAGIC ||
+        header.format != ARCHIVE_FORMAT || header.seq == 0)
+    {
+        return create_archive();
+    }
+
+    archive.seq = header.seq;
+
+    while (read_sector(archive.seq, sector) == FR_OK)
+    {
+        archive.seq++;
+    }
+
+    if (archive.seq > 1 && read_sector(archive.seq - 1, sector) == FR_OK && sector->data.count > 0)
+    {
+        last = extend_time(sector->data.start + 0xFFFF,
+                           sector->data.packets[sector->data.count - 1].timestamp);
+        archive.offset = (last | 0xFFFF) + 1;
+    }
+
+    sector->data.count = 0;
+
+    return write_header();
+}
+
+
+/**
+ * archive_open: open the archive and its index, creating them if needed.
+ * Without an SD card (or with the archive disabled) appended packets are
+ * dropped and queries get an empty reply.
+ * @return true if the archive is usable
+ */
+
+bool archive_open(void)
+{
+#if ARCHIVE_ENABLED
+    uint16_t ret;
+
+    disk_lock();
+
+    if ((ret = mount_disk()) == FR_OK &&
+        (ret = f_open(&archive.file, ARCHIVE_PATH, FA_READ | FA_WRITE | FA_OPEN_ALWAYS)) == FR_OK)
+    {
+        if ((ret = f_open(&archive.index, ARCHIVE_INDEX_PATH,
+                          FA_READ | FA_WRITE | FA_OPEN_ALWAYS)) == FR_OK)
+        {
+            if (f_size(&archive.file) == 0 || f_size(&archive.index) == 0)
+            {
+                ret = create_archive();
+            }
+            else
+            {
+                ret = recover_archive();
+            }
+
+            if (ret != FR_OK)
+            {
+                f_close(&archive.index);
+            }
+        }
+
+        if (ret == FR_OK)
+        {
+            archive.open = true;
+        }
+        else
+        {
+            f_close(&archive.file);
+        }
+    }
+
+    disk_unlock();
+#endif
+
+    return archive.open;
+}
+
+
+/**
+ * commit_sector: write the RAM sector out at the head of the ring,
+ * overwriting the oldest sector once the ring is full, and index it if
+ * it falls on the stride.
+ */
+
+static void commit_sector(void)
+{
+    archive.wbuf.data.seq = archive.seq;
+
+    disk_lock();
+
+    if (write_sector(archive.seq, &archive.wbuf) == FR_OK)
+    {
+        if (archive.seq % ARCHIVE_INDEX_STRIDE == 0)
+        {
+            write_index(archive.seq, archive.wbuf.data.start);
+        }
+
+        archive.seq++;
+
+        if (++archive.unsynced >= ARCHIVE_SYNC_INTERVAL)
+        {
+            write_header();
+        }
+    }
+    else
+    {
+        archive.dropped += archive.wbuf.data.count;
+    }
+
+    disk_unlock();
+
+    archive.wbuf.data.count = 0;
+}
+
+
+/**
+ * archive_append: add a packet to the archive. It is buffered in RAM
+ * until a whole sector's worth has been gathered, or until the sector
+ * would span more time than its 16-bit timestamps can tell apart.
+ * Sender task only.
+ * @param packet the packet to store
+ */
+
+void archive_append(const telemetry_packet * packet)
+{
+    uint32_t time;
+
+    if (!archive.open)
+    {
+        archive.dropped++;
+        return;
+    }
+
+    time = extend_time(archive_now(), packet->timestamp);
+
+    if (archive.wbuf.data.count > 0 && time - archive.wbuf.data.start >= 0xFFFF)
+    {
+        commit_sector();
+    }
+
+    if (archive.wbuf.data.count == 0)
+    {
+        archive.wbuf.data.start = time;
+    }
+
+    archive.wbuf.data.packets[archive.wbuf.data.count++] = *packet;
+
+    if (archive.wbuf.data.count == ARCHIVE_SECTOR_PACKETS)
+    {
+        commit_sector();
+    }
+}
+
+
+/**
+ * find_start: binary search the index for the last indexed sector that
+ * starts no later than a time. Caller holds disk_lock.
+ * @param time the start of the query
+ * @return the sequence number to start scanning from
+ */
+
+static uint32_t find_start(uint32_t time)
+{
+    archive_index_t entry;
+    uint32_t start = oldest_seq();
+    uint32_t lo = (start + ARCHIVE_INDEX_STRIDE - 1) / ARCHIVE_INDEX_STRIDE;
+    uint32_t hi;
+    uint32_t mid;
+
+    if (archive.seq <= start)
+    {
+        return start;
+    }
+
+    /* Index entries lo..hi are for sectors lo * stride .. hi * stride */
+    hi = (archive.seq - 1) / ARCHIVE_INDEX_STRIDE;
+
+    while (lo <= hi)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        /* A stale entry ends the search; scanning from here is still right */
+        if (read_index(mid * ARCHIVE_INDEX_STRIDE, &entry) != FR_OK)
+        {
+            break;
+        }
+
+        if ((int32_t)(entry.start - time) <= 0)
+        {
+            start = mid * ARCHIVE_INDEX_STRIDE;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return start;
+}
+
+
+/**
+ * send_frame: send a reply frame on the query's connection, then leave
+ * the link to live telemetry for a while.
+ * @return false if the ground is gone and the query should stop
+ */
+
+static bool send_frame(csp_conn_t * conn, const telemetry_packet * packets, uint8_t count,
+                       uint32_t start, uint8_t flags)
+{
+    csp_packet_t * packet;
+    archive_header_t * header;
+
+    while ((packet = csp_buffer_get(DOWNLINK_MTU)) == NULL)
+    {
+        csp_sleep_ms(ARCHIVE_FRAME_INTERVAL);
+    }
+
+    header = (archive_header_t *) packet->data;
+    header->type = ARCHIVE_FRAME_TYPE;
+    header->count = count;
+    header->flags = flags;
+    header->reserved = 0;
+    header->start = start;
+    memcpy(packet->data + sizeof(*header), packets, count * sizeof(telemetry_packet));
+    packet->length = sizeof(*header) + count * sizeof(telemetry_packet);
+
+    if (!csp_send(conn, packet, ARCHIVE_SEND_TIMEOUT))
+    {
+        csp_buffer_free(packet);
+        return false;
+    }
+
+    csp_sleep_ms(ARCHIVE_FRAME_INTERVAL);
+
+    return true;
+}
+
+
+static uint32_t get_u32(const uint8_t * bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+
+/**
+ * archive_query: answer one query. The request is the start and end
+ * archive time, 4 bytes little-endian each, then the source ids wanted;
+ * no ids means every source. Matching packets come back in order, in
+ * ARCHIVE_FRAME_TYPE frames, the last one flagged ARCHIVE_FLAG_LAST.
+ * @param conn the query's connection
+ * @param request the request packet; always consumed
+ */
+
+static void archive_query(csp_conn_t * conn, csp_packet_t * request)
+{
+    telemetry_packet packets[ARCHIVE_FRAME_PACKETS];
+    const archive_sector_t * sector = &query_sector;
+    uint8_t wanted[256 / 8];
+    uint8_t count = 0;
+    uint32_t frame_start = 0;
+    uint32_t from;
+    uint32_t to;
+    uint32_t seq;
+    uint32_t time;
+    uint16_t ret;
+    bool all;
+    int i;
+
+    if (request->length < 8 || request->length > 8 + ARCHIVE_QUERY_IDS)
+    {
+        csp_buffer_free(request);
+        send_frame(conn, packets, 0, 0, ARCHIVE_FLAG_LAST);
+        return;
+    }
+
+    from = get_u32(request->data);
+    to = get_u32(request->data + 4);
+    all = (request->length == 8);
+    memset(wanted, 0, sizeof(wanted));
+    for (i = 8; i < request->length; i++)
+    {
+        wanted[request->data[i] / 8] |= 1 << (request->data[i] % 8);
+    }
+    csp_buffer_free(request);
+
+    disk_lock();
+    seq = archive.open ? find_start(from) : archive.seq;
+    disk_unlock();
+
+    while (1)
+    {
+        disk_lock();
+        if (archive.open && seq < oldest_seq())
+        {
+            /* The writer went past the query's position while it was paced */
+            seq = oldest_seq();
+        }
+        ret = (archive.open && seq < archive.seq) ? read_sector(seq, &query_sector) : FR_NO_FILE;
+        disk_unlock();
+
+        /* Caught up with the writer, or past the end of the query */
+        if (ret != FR_OK || (int32_t)(sector->data.start - to) > 0)
+        {
+            break;
+        }
+
+        seq++;
+
+        for (i = 0; i < sector->data.count; i++)
+        {
+            time = extend_time(sector->data.start + 0xFFFF, sector->data.packets[i].timestamp);
+            if ((int32_t)(time - from) < 0 || (int32_t)(time - to) > 0 ||
+                !(all || (wanted[sector->data.packets[i].source.source_id / 8] &
+                          (1 << (sector->data.packets[i].source.source_id % 8)))))
+            {
+                continue;
+            }
+
+            if (count == 0)
+            {
+                frame_start = time;
+            }
+
+            /* Packet timestamps only count 65535 ms past the frame's start */
+            if (count == ARCHIVE_FRAME_PACKETS || time - frame_start >= 0xFFFF)
+            {
+                if (!send_frame(conn, packets, count, frame_start, 0))
+                {
+                    return;
+                }
+                count = 0;
+                frame_start = time;
+            }
+
+            packets[count++] = sector->data.packets[i];
+        }
+    }
+
+    send_frame(conn, packets, count, frame_start, ARCHIVE_FLAG_LAST);
+}
+
+
+CSP_DEFINE_TASK(archive_thread)
+{
+    csp_socket_t * sock = csp_socket(CSP_SO_NONE);
+    csp_conn_t * conn;
+    csp_packet_t * packet;
+
+    csp_bind(sock, ARCHIVE_PORT);
+    csp_listen(sock, 2);
+
+    while (1)
+    {
+        if ((conn = csp_accept(sock, CSP_MAX_DELAY)) == NULL)
+        {
+            continue;
+        }
+
+        /* One query per connection */
+        if ((packet = csp_read(conn, ARCHIVE_QUERY_TIMEOUT)) != NULL)
+        {
+            archive_query(conn, packet);
+        }
+
+        csp_close(conn);
+    }
+}
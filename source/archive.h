@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <csp/arch/csp_thread.h>
+#include <telemetry/telemetry.h>
+
+#define ARCHIVE_ENABLED YOTTA_CFG_ARCHIVE_ENABLED
+#define ARCHIVE_SECTORS YOTTA_CFG_ARCHIVE_SECTORS
+/* Data sectors per index entry */
+#define ARCHIVE_INDEX_STRIDE YOTTA_CFG_ARCHIVE_INDEX_STRIDE
+#define ARCHIVE_SYNC_INTERVAL YOTTA_CFG_ARCHIVE_SYNC_INTERVAL
+/* Gap between the frames of a query reply, in ms */
+#define ARCHIVE_FRAME_INTERVAL YOTTA_CFG_ARCHIVE_FRAME_INTERVAL
+#define ARCHIVE_PORT YOTTA_CFG_CSP_ARCHIVE_PORT
+
+#define ARCHIVE_SECTOR_SIZE 512
+#define ARCHIVE_SECTOR_PACKETS ((ARCHIVE_SECTOR_SIZE - 12) / sizeof(telemetry_packet))
+
+/**
+ * One data sector of the archive. start is the archive time of the
+ * first packet; the 16-bit packet timestamps are its low bits, and a
+ * sector never spans more than they can count.
+ */
+typedef union {
+    uint8_t raw[ARCHIVE_SECTOR_SIZE];
+    struct {
+        uint32_t seq;
+        uint32_t start;
+        uint8_t count;
+        uint8_t reserved[3];
+        telemetry_packet packets[ARCHIVE_SECTOR_PACKETS];
+    } data;
+} archive_sector_t;
+
+/* Index entry for every ARCHIVE_INDEX_STRIDE'th data sector */
+typedef struct {
+    uint32_t seq;
+    uint32_t start;
+} archive_index_t;
+
+/* Frame type byte of a query reply, next to DOWNLINK_FRAME_BATCH */
+#define ARCHIVE_FRAME_TYPE 0x03
+
+/* The last frame of a query reply */
+#define ARCHIVE_FLAG_LAST 0x01
+
+/**
+ * Header of a query reply frame, followed by count telemetry_packets.
+ * Packet timestamps are the low 16 bits of archive times at or after
+ * start.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t count;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t start;
+} archive_header_t;
+
+bool archive_open(void);
+
+void archive_append(const telemetry_packet * packet);
+
+CSP_DEFINE_TASK(archive_thread);
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "capture.h"
+#include "fanout.h"
+#include "sources.h"
+
+#include <csp/arch/csp_time.h>
+
+/**
+ * Burst capture of the BNO055 fusion outputs. While armed, every
+ * aggregator tick adds a record to a RAM ring, overwriting the oldest,
+ * so at a 10 ms aggregator interval the ring keeps up with the sensor's
+ * 100 Hz fusion rate. When the linear acceleration magnitude crosses
+ * the threshold, or a ground command asks for it, recording goes on for
+ * CAPTURE_POST more records and then stops, freezing up to CAPTURE_PRE
+ * records from before the trigger and CAPTURE_POST from after it. The
+ * log node's downlink task drains the frozen window when it has nothing
+ * else to send, and the ring is armed again once the window is out.
+ *
+ * Records are only written by the aggregator thread while the ring isn't
+ * frozen, and only read by the log node's task while it is, so handing
+ * the state over is all the locking needed.
+ */
+
+/* Values per record: every capture_value_t ahead of CAPTURE_TRIGGER */
+#define RECORD_VALUES CAPTURE_TRIGGER
+
+#if CAPTURE_SIZE & (CAPTURE_SIZE - 1)
+#error "telemetry.capture.size must be a power of two"
+#endif
+
+#if CAPTURE_PRE + 1 + CAPTURE_POST > CAPTURE_SIZE
+#error "telemetry.capture.size must hold pre + post + 1 records"
+#endif
+
+typedef enum {
+    CAPTURE_ARMED = 0,
+    CAPTURE_TRIGGERED,
+    CAPTURE_FROZEN
+} capture_state_t;
+
+static struct {
+    /* Line aligned, so no record straddles a 32 byte line */
+    capture_record_t records[CAPTURE_SIZE] __attribute__((aligned(32)));
+    volatile capture_state_t state;
+    /* Records ever written; the next goes in slot head % CAPTURE_SIZE */
+    uint32_t head;
+    /* head when the ring was last armed; anything older is stale */
+    uint32_t armed;
+    /* The window being captured or drained, as record numbers */
+    uint32_t start;
+    uint32_t end;
+    uint16_t trigger_time;
+    capture_cause_t cause;
+    /* Set by capture_trigger, taken by the aggregator thread */
+    volatile bool requested;
+    /* Samples of the frozen window sent so far, the trigger sample first */
+    uint32_t sent;
+} capture;
+
+
+/**
+ * capture_sampling: check whether the aggregator should read the
+ * capture vectors this tick.
+ * @return true unless capture is off or the ring is frozen
+ */
+
+bool capture_sampling(void)
+{
+    return CAPTURE_ENABLED && capture.state != CAPTURE_FROZEN;
+}
+
+
+/**
+ * capture_add: record one snapshot and check for a trigger. Must only be
+ * called from the aggregator thread, with a snapshot holding at least
+ * the CAPTURE_SNAPSHOT vectors.
+ * @param snapshot the vectors read this tick
+ */
+
+void capture_add(const bno055_snapshot_t * snapshot)
+{
+    capture_record_t * record;
+    const bno055_vector_data_t * linear = &snapshot->linear;
+    uint32_t head = capture.head;
+
+    if (capture.state == CAPTURE_FROZEN)
+    {
+        return;
+    }
+
+    record = &capture.records[head & (CAPTURE_SIZE - 1)];
+    record->timestamp = csp_get_ms();
+    record->quat[0] = snapshot->quat.w;
+    record->quat[1] = snapshot->quat.x;
+    record->quat[2] = snapshot->quat.y;
+    record->quat[3] = snapshot->quat.z;
+    record->linear[0] = linear->x;
+    record->linear[1] = linear->y;
+    record->linear[2] = linear->z;
+
+    if (capture.state == CAPTURE_ARMED &&
+        (capture.requested ||
+         linear->x * linear->x + linear->y * linear->y + linear->z * linear->z >=
+         CAPTURE_THRESHOLD * CAPTURE_THRESHOLD))
+    {
+        capture.cause = capture.requested ? CAPTURE_CAUSE_COMMAND : CAPTURE_CAUSE_ACCEL;
+        capture.requested = false;
+        capture.trigger_time = record->timestamp;
+        capture.start = (head - capture.armed > CAPTURE_PRE) ? head - CAPTURE_PRE : capture.armed;
+        capture.end = head + 1 + CAPTURE_POST;
+        capture.state = CAPTURE_TRIGGERED;
+    }
+
+    capture.head = ++head;
+
+    if (capture.state == CAPTURE_TRIGGERED && head == capture.end)
+    {
+        capture.sent = 0;
+
+        /* The window must be complete before the log node's task can see it */
+        __sync_synchronize();
+        capture.state = CAPTURE_FROZEN;
+        fanout_wake(FANOUT_LOG_NODE);
+    }
+}
+
+
+/**
+ * capture_trigger: freeze a window around the next record, as if the
+ * threshold had been crossed.
+ * @return false if capture is off or a window is already being captured
+ */
+
+bool capture_trigger(void)
+{
+    if (!CAPTURE_ENABLED || capture.state != CAPTURE_ARMED)
+    {
+        return false;
+    }
+
+    capture.requested = true;
+
+    return true;
+}
+
+
+/**
+ * capture_pending: check for a frozen window waiting to be sent.
+ * @return true if capture_peek has samples to return
+ */
+
+bool capture_pending(void)
+{
+    return capture.state == CAPTURE_FROZEN;
+}
+
+
+/**
+ * capture_peek: copy out the next samples of the frozen window without
+ * removing them. Sender task only.
+ * @param packets where to copy the samples
+ * @param max the most samples to copy
+ * @return the number of samples copied
+ */
+
+uint8_t capture_peek(telemetry_packet * packets, uint8_t max)
+{
+    const capture_record_t * record;
+    uint32_t total = 1 + (capture.end - capture.start) * RECORD_VALUES;
+    uint32_t pos = capture.sent;
+    uint32_t index;
+    uint8_t value;
+    uint8_t count = 0;
+
+    if (capture.state != CAPTURE_FROZEN)
+    {
+        return 0;
+    }
+
+    __sync_synchronize();
+
+    for (; count < max && pos < total; count++, pos++)
+    {
+        if (pos == 0)
+        {
+            packets[count].source.source_id = SOURCE_CAPTURE_BASE + CAPTURE_TRIGGER;
+            packets[count].source.data_type = TELEMETRY_TYPE_INT;
+            packets[count].data.i = capture.cause;
+            packets[count].timestamp = capture.trigger_time;
+            continue;
+        }
+
+        index = (pos - 1) / RECORD_VALUES;
+        value = (pos - 1) % RECORD_VALUES;
+        record = &capture.records[(capture.start + index) & (CAPTURE_SIZE - 1)];
+
+        packets[count].source.source_id = SOURCE_CAPTURE_BASE + value;
+        packets[count].source.data_type = TELEMETRY_TYPE_FLOAT;
+        packets[count].data.f = (value < CAPTURE_LIN_X) ? record->quat[value]
+                                                        : record->linear[value - CAPTURE_LIN_X];
+        packets[count].timestamp = record->timestamp;
+    }
+
+    return count;
+}
+
+
+/**
+ * capture_consume: remove samples returned by the last capture_peek once
+ * they have been sent. The ring is armed again after the last one.
+ * @param count the number of samples sent
+ */
+
+void capture_consume(uint8_t count)
+{
+    uint32_t total = 1 + (capture.end - capture.start) * RECORD_VALUES;
+
+    capture.sent += count;
+
+    if (capture.sent >= total)
+    {
+        /* Records from before the freeze are too old for the next window */
+        capture.armed = capture.head;
+
+        /* A command that raced the last trigger isn't for the next window */
+        capture.requested = false;
+
+        /* Done with the records before the aggregator may reuse them */
+        __sync_synchronize();
+        capture.state = CAPTURE_ARMED;
+    }
+}
+
+
+/**
+ * capture_command: COMMAND_CAPTURE handler, takes no arguments.
+ */
+
+command_status_t capture_command(const uint8_t * args, uint8_t length)
+{
+    (void) args;
+
+    if (length != 0)
+    {
+        return COMMAND_BAD_LENGTH;
+    }
+
+    return capture_trigger() ? COMMAND_OK : COMMAND_BUSY;
+}
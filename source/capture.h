@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <telemetry/telemetry.h>
+
+#include "command.h"
+#include "sensor.h"
+
+#define CAPTURE_ENABLED YOTTA_CFG_TELEMETRY_CAPTURE_ENABLED
+/* Records in the ring; must be a power of two */
+#define CAPTURE_SIZE YOTTA_CFG_TELEMETRY_CAPTURE_SIZE
+#define CAPTURE_PRE YOTTA_CFG_TELEMETRY_CAPTURE_PRE
+#define CAPTURE_POST YOTTA_CFG_TELEMETRY_CAPTURE_POST
+/* Linear acceleration magnitude that triggers a capture, in m/s^2 */
+#define CAPTURE_THRESHOLD YOTTA_CFG_TELEMETRY_CAPTURE_THRESHOLD
+
+/* The vectors captured on every aggregator tick */
+#define CAPTURE_SNAPSHOT (SNAPSHOT_QUAT | SNAPSHOT_LINEAR)
+
+/**
+ * Values of a downlinked capture, published as source ids
+ * SOURCE_CAPTURE_BASE + capture_value_t. CAPTURE_TRIGGER comes first,
+ * stamped with the trigger time, and holds the capture_cause_t.
+ */
+typedef enum {
+    CAPTURE_QUAT_W = 0,
+    CAPTURE_QUAT_X,
+    CAPTURE_QUAT_Y,
+    CAPTURE_QUAT_Z,
+    CAPTURE_LIN_X,
+    CAPTURE_LIN_Y,
+    CAPTURE_LIN_Z,
+    CAPTURE_TRIGGER,
+    CAPTURE_VALUE_COUNT
+} capture_value_t;
+
+typedef enum {
+    CAPTURE_CAUSE_ACCEL = 1,
+    CAPTURE_CAUSE_COMMAND
+} capture_cause_t;
+
+/**
+ * One capture sample. Eight words, so records pack the ring with no
+ * padding and never straddle a 32 byte line.
+ */
+typedef struct {
+    uint32_t timestamp;
+    float quat[4];
+    float linear[3];
+} capture_record_t;
+
+bool capture_sampling(void);
+
+void capture_add(const bno055_snapshot_t * snapshot);
+
+bool capture_trigger(void);
+
+bool capture_pending(void);
+
+uint8_t capture_peek(telemetry_packet * packets, uint8_t max);
+
+void capture_consume(uint8_t count);
+
+command_status_t capture_command(const uint8_t * args, uint8_t length);
+
+#endif
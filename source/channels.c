@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "channels.h"
+#include "disk.h"
+
+#include <csp/arch/csp_queue.h>
+
+/**
+ * Runtime channel selection. The ground can turn raw sources off and
+ * change how often each group is sampled, to trade redundancy for
+ * bandwidth: Euler angles follow from the quaternion, and the raw
+ * acceleration is gravity plus linear acceleration. A group with every
+ * source off isn't read at all, and a disabled source is never
+ * downlinked.
+ *
+ * The command service owns the settings: it queues a change for the
+ * aggregator thread, which picks it up at the start of a tick, and only
+ * once it is queued takes it as its own copy and saves it to the SD
+ * card. The aggregator's copy is only touched by the aggregator thread.
+ */
+
+#define CHANNELS_RECORD "CHANNELS"
+
+/* How long the command service waits for the aggregator to take a change */
+#define CHANNELS_QUEUE_TIMEOUT 100
+
+static csp_queue_handle_t updates;
+
+/* The command service's copy */
+static channels_t requested;
+
+/* The aggregator thread's copy, and the groups it enables */
+static channels_t active;
+static uint32_t active_groups;
+
+
+static void channels_default(channels_t * channels)
+{
+    channels->mask = CHANNELS_ALL;
+    schedule_defaults(channels->period);
+}
+
+
+/* At least one tick, and bounded so rescheduling stays quick */
+static bool period_valid(uint32_t period)
+{
+    return period >= SCHEDULE_TICK && period <= SCHEDULE_PERIOD_MAX;
+}
+
+
+/* Same checks as the command handlers, for settings read back from the card */
+static bool channels_valid(const channels_t * channels)
+{
+    schedule_group_t group;
+
+    if (channels->mask & ~CHANNELS_ALL)
+    {
+        return false;
+    }
+
+    for (group = 0; group < GROUP_COUNT; group++)
+    {
+        if (!period_valid(channels->period[group]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static uint32_t groups_of(uint32_t mask)
+{
+    uint32_t groups = 0;
+    uint8_t id;
+
+    for (id = 0; id < SOURCE_COUNT; id++)
+    {
+        if (mask & (1UL << id))
+        {
+            groups |= GROUP_BIT(schedule_group_of(id));
+        }
+    }
+
+    return groups;
+}
+
+
+/**
+ * channels_init: start with every source enabled at its configured
+ * period, until channels_load finds saved settings.
+ */
+
+void channels_init(void)
+{
+    updates = csp_queue_create(1, sizeof(channels_t));
+
+    channels_default(&requested);
+    active = requested;
+    active_groups = groups_of(active.mask);
+}
+
+
+/**
+ * channels_load: load the saved settings from the SD card, if there are
+ * any, and hand them to the aggregator. Settings the command handlers
+ * would have rejected are ignored. Called from the command service once
+ * the scheduler is running.
+ */
+
+void channels_load(void)
+{
+    channels_t saved;
+    uint16_t ret;
+
+    disk_lock();
+    if ((ret = mount_disk()) == FR_OK)
+    {
+        ret = read_record(CHANNELS_RECORD, &saved, sizeof(saved));
+    }
+    disk_unlock();
+
+    if (ret == FR_OK && channels_valid(&saved) &&
+        csp_queue_enqueue(updates, &saved, CHANNELS_QUEUE_TIMEOUT) == CSP_QUEUE_OK)
+    {
+        requested = saved;
+    }
+}
+
+
+/**
+ * channels_poll: apply settings changed by the ground. Must be called
+ * from the aggregator thread, before the tick's schedule_due.
+ */
+
+void channels_poll(void)
+{
+    if (csp_queue_dequeue(updates, &active, 0) != CSP_QUEUE_OK)
+    {
+        return;
+    }
+
+    active_groups = groups_of(active.mask);
+    schedule_set_periods(active.period);
+}
+
+
+/**
+ * channels_enabled: check whether a source may be downlinked. Aggregator
+ * thread only.
+ * @param source_id the source id
+ * @return false if the ground turned the source off
+ */
+
+bool channels_enabled(uint8_t source_id)
+{
+    return source_id >= SOURCE_COUNT || (active.mask & (1UL << source_id));
+}
+
+
+/**
+ * channels_groups: find the groups worth reading. Aggregator thread only.
+ * @return GROUP_BIT of every group with at least one source enabled
+ */
+
+uint32_t channels_groups(void)
+{
+    return active_groups;
+}
+
+
+/**
+ * channels_update: queue new settings for the aggregator, then make them
+ * the command service's copy and save them. Nothing changes if they
+ * can't be queued; once queued they are applied even if they couldn't
+ * be saved.
+ * @param next the new settings
+ * @return COMMAND_OK, COMMAND_BUSY if the aggregator didn't take them, or
+ * COMMAND_NOT_SAVED if the SD card write failed
+ */
+
+static command_status_t channels_update(channels_t * next)
+{
+    uint16_t ret;
+
+    if (csp_queue_enqueue(updates, next, CHANNELS_QUEUE_TIMEOUT) != CSP_QUEUE_OK)
+    {
+        return COMMAND_BUSY;
+    }
+
+    requested = *next;
+
+    disk_lock();
+    if ((ret = mount_disk()) == FR_OK)
+    {
+        ret = write_record(CHANNELS_RECORD, &requested, sizeof(requested));
+    }
+    disk_unlock();
+
+    return (ret == FR_OK) ? COMMAND_OK : COMMAND_NOT_SAVED;
+}
+
+
+static uint32_t get_u32(const uint8_t * bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+
+/**
+ * channels_mask_command: COMMAND_CHANNEL_MASK handler. The argument is
+ * the new source mask, 4 bytes little-endian.
+ */
+
+command_status_t channels_mask_command(const uint8_t * args, uint8_t length)
+{
+    channels_t next = requested;
+    uint32_t mask;
+
+    if (length != 4)
+    {
+        return COMMAND_BAD_LENGTH;
+    }
+
+    if ((mask = get_u32(args)) & ~CHANNELS_ALL)
+    {
+        return COMMAND_BAD_ARGUMENT;
+    }
+
+    next.mask = mask;
+
+    return channels_update(&next);
+}
+
+
+/**
+ * channels_rate_command: COMMAND_CHANNEL_RATE handler. The arguments are
+ * a schedule_group_t byte and the group's new period in ms, 4 bytes
+ * little-endian, from one aggregator tick up to SCHEDULE_PERIOD_MAX.
+ */
+
+command_status_t channels_rate_command(const uint8_t * args, uint8_t length)
+{
+    channels_t next = requested;
+    uint32_t period;
+
+    if (length != 5)
+    {
+        return COMMAND_BAD_LENGTH;
+    }
+
+    if (args[0] >= GROUP_COUNT || !period_valid(period = get_u32(args + 1)))
+    {
+        return COMMAND_BAD_ARGUMENT;
+    }
+
+    next.period[args[0]] = period;
+
+    return channels_update(&next);
+}
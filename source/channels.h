@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "command.h"
+#include "schedule.h"
+#include "sources.h"
+
+/* Every raw source enabled */
+#define CHANNELS_ALL ((1UL << SOURCE_COUNT) - 1)
+
+/**
+ * The ground-set channel selection, saved on the SD card as the
+ * CHANNELS record. Bit n of mask enables source id n; period is the
+ * sampling period of each group in ms. Being all words, it has no
+ * padding to pack away.
+ */
+typedef struct {
+    uint32_t mask;
+    uint32_t period[GROUP_COUNT];
+} channels_t;
+
+void channels_init(void);
+
+void channels_load(void);
+
+void channels_poll(void);
+
+bool channels_enabled(uint8_t source_id);
+
+uint32_t channels_groups(void);
+
+command_status_t channels_mask_command(const uint8_t * args, uint8_t length);
+
+command_status_t channels_rate_command(const uint8_t * args, uint8_t length);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "capture.h"
+#include "channels.h"
+#include "command.h"
+
+#include <stddef.h>
+#include <csp/csp.h>
+
+/**
+ * Ground command service. The task owns the node's only CSP socket,
+ * bound to every port: packets to COMMAND_PORT are commands, and any
+ * other port gets the standard CSP services (ping, buffer status and so
+ * on) from csp_service_handler.
+ */
+
+/* How long a reply may wait for the link, in ms */
+#define COMMAND_REPLY_TIMEOUT 100
+
+typedef command_status_t (*command_handler_t)(const uint8_t * args, uint8_t length);
+
+static const command_handler_t handlers[] = {
+    [COMMAND_CAPTURE] = capture_command,
+    [COMMAND_CHANNEL_MASK] = channels_mask_command,
+    [COMMAND_CHANNEL_RATE] = channels_rate_command,
+};
+
+
+/**
+ * command_handle: run one command and send its reply back in the same
+ * buffer.
+ * @param conn the connection the command came in on
+ * @param packet the command; always consumed
+ */
+
+static void command_handle(csp_conn_t * conn, csp_packet_t * packet)
+{
+    command_status_t status = COMMAND_UNKNOWN;
+    uint8_t opcode;
+
+    if (packet->length == 0)
+    {
+        csp_buffer_free(packet);
+        return;
+    }
+
+    opcode = packet->data[0];
+
+    if (opcode < sizeof(handlers) / sizeof(handlers[0]) && handlers[opcode] != NULL)
+    {
+        status = handlers[opcode](packet->data + 1, packet->length - 1);
+    }
+
+    packet->data[1] = status;
+    packet->length = 2;
+
+    if (!csp_send(conn, packet, COMMAND_REPLY_TIMEOUT))
+    {
+        csp_buffer_free(packet);
+    }
+}
+
+
+CSP_DEFINE_TASK(command_thread)
+{
+    csp_socket_t * sock = csp_socket(CSP_SO_NONE);
+    csp_conn_t * conn;
+    csp_packet_t * packet;
+
+    /* Settings the ground saved last time */
+    channels_load();
+
+    /* Bind all ports, so the standard services are answered too */
+    csp_bind(sock, CSP_ANY);
+    csp_listen(sock, 10);
+
+    while (1)
+    {
+        if ((conn = csp_accept(sock, CSP_MAX_DELAY)) == NULL)
+        {
+            continue;
+        }
+
+        while ((packet = csp_read(conn, COMMAND_READ_TIMEOUT)) != NULL)
+        {
+            if (csp_conn_dport(conn) == COMMAND_PORT)
+            {
+                command_handle(conn, packet);
+            }
+            else
+            {
+                csp_service_handler(conn, packet);
+            }
+        }
+
+        csp_close(conn);
+    }
+}
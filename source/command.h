@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+
+#include <csp/arch/csp_thread.h>
+
+#define COMMAND_PORT YOTTA_CFG_CSP_COMMAND_PORT
+
+/* How long a connection may sit idle before the service drops it, in ms */
+#define COMMAND_READ_TIMEOUT 100
+
+/**
+ * Ground commands. A command packet is the opcode followed by its
+ * arguments; the reply is the opcode followed by a command_status_t.
+ * Only ever append, the ground tools keep their own copy.
+ */
+typedef enum {
+    COMMAND_CAPTURE = 0x01,
+    COMMAND_CHANNEL_MASK,
+    COMMAND_CHANNEL_RATE
+} command_opcode_t;
+
+typedef enum {
+    COMMAND_OK = 0,
+    COMMAND_UNKNOWN,
+    COMMAND_BAD_LENGTH,
+    COMMAND_BUSY,
+    COMMAND_BAD_ARGUMENT,
+    /* Applied, but couldn't be saved to the SD card */
+    COMMAND_NOT_SAVED
+} command_status_t;
+
+CSP_DEFINE_TASK(command_thread);
+
+#endif
@@ -15,9 +15,69 @@
  */
 #include "disk.h"
 
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <csp/arch/csp_semaphore.h>
+
+/* FatFs isn't built reentrant, so every task goes through disk_lock */
+static csp_mutex_t disk_mutex;
+static FATFS FatFs;
+static bool mounted;
+
+
+/**
+ * disk_init: create the lock that serializes file system access. Must be
+ * called before any task touches the SD card.
+ */
+
+void disk_init(void)
+{
+	csp_mutex_create(&disk_mutex);
+}
+
+
+void disk_lock(void)
+{
+	csp_mutex_lock(&disk_mutex, CSP_MAX_DELAY);
+}
+
+
+void disk_unlock(void)
+{
+	csp_mutex_unlock(&disk_mutex);
+}
+
+
+/**
+ * mount_disk: mount the file system the first time it is needed. The
+ * caller must hold disk_lock.
+ * @return FR_OK if the file system is mounted
+ */
+
+uint16_t mount_disk(void)
+{
+	uint16_t ret = FR_OK;
+
+	if (!mounted)
+	{
+		if ((ret = f_mount(&FatFs, "", 1)) == FR_OK)
+		{
+			mounted = true;
+		}
+	}
+
+	return ret;
+}
+
+
+/* Calibration profile written by older firmware */
+#define LEGACY_PATH "CALIB.txt"
+
 /** 
- * The open_file function ( from the FatFS library) opens the calibration 
- * profile file, if one exists.
+ * The open_file function ( from the FatFS library) opens the legacy text
+ * calibration profile file, if one exists. It is only read to migrate old
+ * cards to the binary record format.
  * @param Fil a pointer to the file object structure
  * @param settings a string of mode flags, a list of which can be found at 
  * http://elm-chan.org/fsw/ff/en/open.html
@@ -29,7 +89,7 @@
 uint16_t open_file(FIL * Fil, char settings)
 {
     uint16_t result;
-    char * path = "CALIB.txt";
+    char * path = LEGACY_PATH;
 
 	result = f_open(Fil, path, settings);
 	//printf("** Opened file: %d\r\n", result);
@@ -38,6 +98,20 @@ uint16_t open_file(FIL * Fil, char settings)
 }
 
 
+/**
+ * remove_legacy_file: delete the legacy text calibration profile once a
+ * binary record has replaced it, so it is never read again.
+ * @return FR_OK if the file is gone, including when there was none
+ */
+
+uint16_t remove_legacy_file(void)
+{
+	uint16_t ret = f_unlink(LEGACY_PATH);
+
+	return (ret == FR_NO_FILE) ? FR_OK : ret;
+}
+
+
 /** 
  * The close_file function closes a file and releases the handle.
  * @param Fil a pointer to the file object structure
@@ -97,23 +171,189 @@ uint16_t read_value(FIL * Fil, uint16_t * value)
 }
 
 
-/** 
- * write_value: a function to write a calibration profile value to the file.
- * If successful, the green LED blinks.
- * @param Fil, pointer to the file object structure
- * @param value, the thing you want to write to the file
+/**
+ * crc16: CRC-16/CCITT (poly 0x1021, init 0xFFFF) over a buffer.
+ */
+
+static uint16_t crc16(const uint8_t * data, uint16_t length)
+{
+	uint16_t crc = 0xFFFF;
+	uint8_t bit;
+
+	while (length--)
+	{
+		crc ^= (uint16_t)(*data++) << 8;
+		for (bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+
+/**
+ * record_path: build the 8.3 file name of one copy of a record.
+ * @param path buffer of at least 13 bytes
+ * @param name record name, up to 8 characters
+ * @param ext "BIN" for the current copy, "BAK" for the last good one
+ * and "TMP" for one being written
+ */
+
+static void record_path(char * path, const char * name, const char * ext)
+{
+	snprintf(path, 13, "%s.%s", name, ext);
+}
+
+
+/**
+ * read_record_file: read one copy of a record with a single f_read and
+ * check it before handing it back.
+ * @return FR_OK, a FatFs error, or -1 if the copy is torn or corrupt
+ */
+
+static uint16_t read_record_file(const char * path, void * data, uint8_t length)
+{
+	FIL Fil;
+	UINT br = 0;
+	uint16_t ret;
+	uint8_t buffer[sizeof(disk_record_header_t) + DISK_RECORD_MAX];
+	disk_record_header_t * header = (disk_record_header_t *) buffer;
+	uint8_t * payload = buffer + sizeof(disk_record_header_t);
+
+	if ((ret = f_open(&Fil, path, FA_READ | FA_OPEN_EXISTING)) != FR_OK)
+	{
+		return ret;
+	}
+
+	ret = f_read(&Fil, buffer, sizeof(disk_record_header_t) + length, &br);
+	f_close(&Fil);
+
+	if (ret != FR_OK)
+	{
+		return ret;
+	}
+
+	if (br != sizeof(disk_record_header_t) + length
+		|| header->magic != DISK_RECORD_MAGIC
+		|| header->format != DISK_RECORD_FORMAT
+		|| header->length != length
+		|| header->crc != crc16(payload, length))
+	{
+		return -1;
+	}
+
+	memcpy(data, payload, length);
+
+	return FR_OK;
+}
+
+
+/**
+ * read_record: load a binary record, falling back to the last good copy
+ * if the current one is missing, torn or fails its CRC. Nothing is
+ * copied into data unless a copy checks out.
+ * @param name record name, up to 8 characters
+ * @param data where to store the payload
+ * @param length expected payload size, at most DISK_RECORD_MAX
+ * @return FR_OK, FR_NO_FILE only if neither copy exists, or the error
+ * from a copy that exists but couldn't be used
+ */
+
+uint16_t read_record(const char * name, void * data, uint8_t length)
+{
+	char path[13];
+	uint16_t ret;
+	uint16_t first;
+
+	if (length > DISK_RECORD_MAX)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	record_path(path, name, "BIN");
+	if ((ret = read_record_file(path, data, length)) == FR_OK)
+	{
+		return ret;
+	}
+	first = ret;
+
+	record_path(path, name, "BAK");
+	ret = read_record_file(path, data, length);
+
+	/* A missing backup doesn't hide a current copy that failed */
+	return (ret == FR_NO_FILE) ? first : ret;
+}
+
+
+/**
+ * write_record: save a binary record atomically. The record is written
+ * and synced to a temporary file, the current copy becomes the backup,
+ * and the temporary file is renamed into place. An interrupted write
+ * leaves either the old current copy or the backup intact.
+ * @param name record name, up to 8 characters
+ * @param data the payload to save
+ * @param length payload size, at most DISK_RECORD_MAX
  * @return ret, a table of values which (0 being 'okay') is found at
- * http://elm-chan.org/fsw/ff/en/rc.html  
+ * http://elm-chan.org/fsw/ff/en/rc.html
  */
 
-uint16_t write_value(FIL * Fil, uint16_t value)
+uint16_t write_record(const char * name, const void * data, uint8_t length)
 {
-    uint16_t ret;
-    uint16_t bw;
-    if ((ret = f_printf(Fil, "%d\n", value)) != -1)
-    {
-        ret = 0;
-    }
-
-    return ret;
+	FIL Fil;
+	UINT bw = 0;
+	uint16_t ret;
+	char path[13];
+	char temp[13];
+	char backup[13];
+	uint8_t buffer[sizeof(disk_record_header_t) + DISK_RECORD_MAX];
+	disk_record_header_t * header = (disk_record_header_t *) buffer;
+
+	if (length > DISK_RECORD_MAX)
+	{
+		return FR_INVALID_PARAMETER;
+	}
+
+	record_path(path, name, "BIN");
+	record_path(temp, name, "TMP");
+	record_path(backup, name, "BAK");
+
+	header->magic = DISK_RECORD_MAGIC;
+	header->format = DISK_RECORD_FORMAT;
+	header->length = length;
+	header->crc = crc16(data, length);
+	memcpy(buffer + sizeof(disk_record_header_t), data, length);
+
+	if ((ret = f_open(&Fil, temp, FA_WRITE | FA_CREATE_ALWAYS)) != FR_OK)
+	{
+		return ret;
+	}
+
+	ret = f_write(&Fil, buffer, sizeof(disk_record_header_t) + length, &bw);
+	if (ret == FR_OK && bw != sizeof(disk_record_header_t) + length)
+	{
+		ret = FR_DISK_ERR;
+	}
+	if (ret == FR_OK)
+	{
+		ret = f_sync(&Fil);
+	}
+	f_close(&Fil);
+
+	if (ret != FR_OK)
+	{
+		f_unlink(temp);
+		return ret;
+	}
+
+	/* Keep the current copy as the last good one */
+	f_unlink(backup);
+	ret = f_rename(path, backup);
+	if (ret != FR_OK && ret != FR_NO_FILE)
+	{
+		return ret;
+	}
+
+	return f_rename(temp, path);
 }
@@ -20,4 +20,45 @@
 #include <kubos-core/modules/fatfs/ff.h>
 #include <kubos-core/modules/fatfs/diskio.h>
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Identifies a binary record file and its layout revision */
+#define DISK_RECORD_MAGIC 0x4B55
+#define DISK_RECORD_FORMAT 1
+
+/* Largest payload read_record and write_record handle */
+#define DISK_RECORD_MAX 128
+
+/**
+ * Header at the start of a binary record file. The CRC covers the
+ * payload that follows it.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t format;
+    uint8_t length;
+    uint16_t crc;
+} disk_record_header_t;
+
+void disk_init(void);
+
+void disk_lock(void);
+
+void disk_unlock(void);
+
+uint16_t mount_disk(void);
+
+uint16_t open_file(FIL * Fil, char settings);
+
+uint16_t remove_legacy_file(void);
+
+uint16_t close_file(FIL * Fil);
+
+uint16_t read_value(FIL * Fil, uint16_t * value);
+
+uint16_t read_record(const char * name, void * data, uint8_t length);
+
+uint16_t write_record(const char * name, const void * data, uint8_t length);
+
 #endif
@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "downlink.h"
+#include "prof.h"
+
+#include <string.h>
+#include <csp/arch/csp_time.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+/* Samples handed from the aggregator thread to the sender thread */
+static packet_ring_t samples;
+static volatile TaskHandle_t sender;
+
+
+/**
+ * downlink_submit: queue a sample for the sender and wake it up. Takes
+ * the place of aggregator_submit for downlinked telemetry, and must only
+ * be called from the aggregator thread.
+ * @param source the telemetry source of the sample
+ * @param data the sample value
+ */
+
+void downlink_submit(telemetry_source source, float data)
+{
+    telemetry_packet packet = { .source = source, .timestamp = csp_get_ms() };
+    uint32_t start = prof_now();
+
+    if (source.data_type == TELEMETRY_TYPE_INT)
+    {
+        packet.data.i = (int) data;
+    }
+    else
+    {
+        packet.data.f = data;
+    }
+
+    if (ring_push(&samples, &packet) && sender != NULL)
+    {
+        xTaskNotifyGive(sender);
+    }
+
+    prof_end(PROF_SUBMIT, start);
+}
+
+
+/**
+ * downlink_attach: make the calling task the one downlink_submit wakes.
+ */
+
+void downlink_attach(void)
+{
+    sender = xTaskGetCurrentTaskHandle();
+}
+
+
+/**
+ * downlink_wait: block until a sample is submitted or the timeout runs out.
+ * @param timeout the longest to wait in ms, or DOWNLINK_WAIT_FOREVER
+ */
+
+void downlink_wait(uint32_t timeout)
+{
+    TickType_t ticks = portMAX_DELAY;
+
+    if (timeout != DOWNLINK_WAIT_FOREVER)
+    {
+        /* Round up, so a wait shorter than a tick doesn't become a spin */
+        ticks = pdMS_TO_TICKS(timeout);
+        if (ticks * portTICK_PERIOD_MS < timeout)
+        {
+            ticks++;
+        }
+    }
+
+    ulTaskNotifyTake(pdTRUE, ticks);
+}
+
+
+/**
+ * downlink_receive: take the oldest submitted sample.
+ * @param packet where to copy the sample
+ * @return false if there was none
+ */
+
+bool downlink_receive(telemetry_packet * packet)
+{
+    return ring_pop(&samples, packet);
+}
+
+
+/**
+ * downlink_batch_init: start with an empty batch.
+ * @param batch the batch to reset
+ */
+
+void downlink_batch_init(downlink_batch_t * batch)
+{
+    batch->count = 0;
+    batch->opened = 0;
+}
+
+
+/**
+ * downlink_batch_add: append a telemetry packet to the batch. The caller
+ * must send the batch once downlink_batch_ready says so, before adding
+ * more.
+ * @param batch the batch being filled
+ * @param packet the telemetry packet to append
+ * @return false if the batch was already full and the packet was dropped
+ */
+
+bool downlink_batch_add(downlink_batch_t * batch, const telemetry_packet * packet)
+{
+    if (batch->count >= DOWNLINK_BATCH_CAPACITY)
+    {
+        return false;
+    }
+
+    if (batch->count == 0)
+    {
+        batch->opened = csp_get_ms();
+    }
+
+    batch->packets[batch->count++] = *packet;
+
+    return true;
+}
+
+
+/**
+ * downlink_batch_ready: a batch is flushed when it is full, or when its
+ * oldest packet has waited for the configured max latency.
+ * @param batch the batch being filled
+ * @param now the current time from csp_get_ms()
+ * @return true if the batch should be sent now
+ */
+
+bool downlink_batch_ready(const downlink_batch_t * batch, uint32_t now)
+{
+    if (batch->count == 0)
+    {
+        return false;
+    }
+
+    return (batch->count >= DOWNLINK_BATCH_CAPACITY)
+        || ((now - batch->opened) >= DOWNLINK_MAX_LATENCY);
+}
+
+
+/**
+ * downlink_batch_encode: build the frame for a batch.
+ * @param batch the batch to send
+ * @param stream the encode stream of compact frames, ignored otherwise
+ * @param out buffer of DOWNLINK_MTU bytes
+ * @return the frame length in bytes
+ */
+
+uint16_t downlink_batch_encode(const downlink_batch_t * batch, encode_stream_t stream,
+                               uint8_t * out)
+{
+#if DOWNLINK_BATCH_ENABLED && DOWNLINK_COMPACT
+    return encode_frame(stream, out, batch->packets, batch->count);
+#else
+    (void) stream;
+#if DOWNLINK_BATCH_ENABLED
+    downlink_header_t * header = (downlink_header_t *) out;
+    header->type = DOWNLINK_FRAME_BATCH;
+    header->count = batch->count;
+#endif
+    memcpy(out + DOWNLINK_HEADER_SIZE, batch->packets,
+           batch->count * sizeof(telemetry_packet));
+
+    return DOWNLINK_HEADER_SIZE + batch->count * sizeof(telemetry_packet);
+#endif
+}
+
+
+/**
+ * downlink_batch_frame: build the frame for a batch in a new CSP buffer.
+ * @param batch the batch to send
+ * @param stream the encode stream of compact frames, ignored otherwise
+ * @return the CSP packet holding the frame, or NULL if no buffer was free
+ */
+
+csp_packet_t * downlink_batch_frame(const downlink_batch_t * batch, encode_stream_t stream)
+{
+    uint32_t start = prof_now();
+    csp_packet_t * packet = csp_buffer_get(DOWNLINK_MTU);
+
+    prof_end(PROF_BUFFER_GET, start);
+
+    if (packet == NULL)
+    {
+        return NULL;
+    }
+
+    packet->length = downlink_batch_encode(batch, stream, packet->data);
+
+    return packet;
+}
+
+
+/**
+ * downlink_link_init: set up a link to a destination without connecting.
+ * @param link the link to initialize
+ * @param address CSP address of the destination node
+ * @param port CSP port on the destination node
+ */
+
+void downlink_link_init(downlink_link_t * link, uint8_t address, uint8_t port)
+{
+    link->address = address;
+    link->port = port;
+    link->conn = NULL;
+    link->backoff = DOWNLINK_BACKOFF_MIN;
+    link->retry_at = csp_get_ms();
+    link->resync = DOWNLINK_RESYNC_ALL;
+}
+
+
+/**
+ * downlink_link_up: make sure the link has an open connection, connecting
+ * if there is none and the backoff delay has expired.
+ * @param link the link to check
+ * @param now the current time from csp_get_ms()
+ * @return true if the connection is open
+ */
+
+bool downlink_link_up(downlink_link_t * link, uint32_t now)
+{
+    uint32_t start;
+
+    if (link->conn != NULL)
+    {
+        return true;
+    }
+
+    /* Still backing off from the last failure */
+    if ((int32_t)(now - link->retry_at) < 0)
+    {
+        return false;
+    }
+
+    start = prof_now();
+    link->conn = csp_connect(CSP_PRIO_NORM, link->address, link->port,
+                             DOWNLINK_CONNECT_TIMEOUT, DOWNLINK_CONN_OPTS);
+    prof_end(PROF_CONNECT, start);
+
+    if (link->conn == NULL)
+    {
+        downlink_link_drop(link, csp_get_ms());
+        return false;
+    }
+
+    link->backoff = DOWNLINK_BACKOFF_MIN;
+
+    /* Frames queued on the old connection may be lost, so restart deltas */
+    link->resync = DOWNLINK_RESYNC_ALL;
+
+    return true;
+}
+
+
+/**
+ * downlink_link_send: send a packet over the link's connection. A failed
+ * send means the connection is dead, so it is closed and a reconnect is
+ * scheduled.
+ * @param link the link to send on
+ * @param packet the packet to send
+ * @return true if CSP took the packet, false if the caller still owns it
+ */
+
+bool downlink_link_send(downlink_link_t * link, csp_packet_t * packet)
+{
+    uint32_t start;
+    bool sent;
+
+    if (!downlink_link_up(link, csp_get_ms()))
+    {
+        return false;
+    }
+
+    start = prof_now();
+    sent = csp_send(link->conn, packet, DOWNLINK_SEND_TIMEOUT);
+    prof_end(PROF_SEND, start);
+
+    if (!sent)
+    {
+        downlink_link_drop(link, csp_get_ms());
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * downlink_link_drop: close the link's connection, if any, and schedule
+ * the next connect attempt. Each consecutive failure doubles the delay up
+ * to the configured maximum. The last frames sent may not have arrived,
+ * so every stream needs a keyframe.
+ * @param link the link to drop
+ * @param now the current time from csp_get_ms()
+ */
+
+void downlink_link_drop(downlink_link_t * link, uint32_t now)
+{
+    if (link->conn != NULL)
+    {
+        csp_close(link->conn);
+        link->conn = NULL;
+    }
+
+    link->retry_at = now + link->backoff;
+    link->resync = DOWNLINK_RESYNC_ALL;
+
+    link->backoff *= 2;
+    if (link->backoff > DOWNLINK_BACKOFF_MAX)
+    {
+        link->backoff = DOWNLINK_BACKOFF_MAX;
+    }
+}
+
+
+/**
+ * downlink_send_frame: copy an already built frame into a new CSP buffer
+ * and send it over a link.
+ * @param link the link to send on
+ * @param frame the frame bytes
+ * @param length the frame length, at most DOWNLINK_MTU
+ * @return true if the frame was handed to CSP
+ */
+
+bool downlink_send_frame(downlink_link_t * link, const uint8_t * frame, uint16_t length)
+{
+    csp_packet_t * packet;
+    uint32_t start;
+
+    if (!downlink_link_up(link, csp_get_ms()))
+    {
+        return false;
+    }
+
+    start = prof_now();
+    packet = csp_buffer_get(DOWNLINK_MTU);
+    prof_end(PROF_BUFFER_GET, start);
+
+    if (packet == NULL)
+    {
+        return false;
+    }
+
+    memcpy(packet->data, frame, length);
+    packet->length = length;
+
+    /* CSP owns the buffer once it has been sent */
+    if (!downlink_link_send(link, packet))
+    {
+        csp_buffer_free(packet);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * downlink_send: frame a batch on the backlog stream and send it over a
+ * link. Only the log node gets backlog, so only its task may call this.
+ * @param link the link to send on
+ * @param batch the batch to send; it is left untouched
+ * @return true if the frame was handed to CSP
+ */
+
+bool downlink_send(downlink_link_t * link, const downlink_batch_t * batch)
+{
+    csp_packet_t * packet;
+
+    if (!downlink_link_up(link, csp_get_ms()))
+    {
+        return false;
+    }
+
+    /* The next frame can't be a delta against one that wasn't sent */
+    if (link->resync & DOWNLINK_RESYNC(ENCODE_STREAM_BACKLOG))
+    {
+        encode_reset(ENCODE_STREAM_BACKLOG);
+        link->resync &= ~DOWNLINK_RESYNC(ENCODE_STREAM_BACKLOG);
+    }
+
+    if ((packet = downlink_batch_frame(batch, ENCODE_STREAM_BACKLOG)) == NULL)
+    {
+        return false;
+    }
+
+    /* CSP owns the buffer once it has been sent; a failure drops the link */
+    if (!downlink_link_send(link, packet))
+    {
+        csp_buffer_free(packet);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef DOWNLINK_H
+#define DOWNLINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <csp/csp.h>
+#include <telemetry/telemetry.h>
+
+#include "encode.h"
+#include "ring.h"
+
+#define DOWNLINK_BATCH_ENABLED YOTTA_CFG_CSP_BATCH_ENABLED
+#define DOWNLINK_COMPACT YOTTA_CFG_CSP_BATCH_COMPACT
+#define DOWNLINK_MTU YOTTA_CFG_CSP_BATCH_MTU
+#define DOWNLINK_MAX_LATENCY YOTTA_CFG_CSP_BATCH_MAX_LATENCY
+
+#define DOWNLINK_CONNECT_TIMEOUT YOTTA_CFG_CSP_LINK_CONNECT_TIMEOUT
+#define DOWNLINK_SEND_TIMEOUT YOTTA_CFG_CSP_LINK_SEND_TIMEOUT
+#define DOWNLINK_BACKOFF_MIN YOTTA_CFG_CSP_LINK_BACKOFF_MIN
+#define DOWNLINK_BACKOFF_MAX YOTTA_CFG_CSP_LINK_BACKOFF_MAX
+
+#if YOTTA_CFG_CSP_RDP
+#define DOWNLINK_CONN_OPTS CSP_O_RDP
+#else
+#define DOWNLINK_CONN_OPTS CSP_O_NONE
+#endif
+
+/* Timeout for downlink_wait that never expires */
+#define DOWNLINK_WAIT_FOREVER UINT32_MAX
+
+/* Frame type byte leading every batched CSP payload */
+#define DOWNLINK_FRAME_BATCH 0x01
+
+/**
+ * Header placed in front of the telemetry packets of a batched frame.
+ * Without batching a frame is a single bare telemetry_packet, as before.
+ * Compact frames (csp.batch.compact) use encode_header_t instead.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t count;
+} downlink_header_t;
+
+#if DOWNLINK_BATCH_ENABLED && DOWNLINK_COMPACT
+#define DOWNLINK_HEADER_SIZE sizeof(encode_header_t)
+#define DOWNLINK_BATCH_CAPACITY \
+    ((DOWNLINK_MTU - DOWNLINK_HEADER_SIZE) / ENCODE_MAX_SAMPLE)
+#elif DOWNLINK_BATCH_ENABLED
+#define DOWNLINK_HEADER_SIZE sizeof(downlink_header_t)
+#define DOWNLINK_BATCH_CAPACITY \
+    ((DOWNLINK_MTU - DOWNLINK_HEADER_SIZE) / sizeof(telemetry_packet))
+#else
+#define DOWNLINK_HEADER_SIZE 0
+#define DOWNLINK_BATCH_CAPACITY 1
+#endif
+
+/**
+ * Telemetry packets waiting to go out together in one frame. The CSP
+ * buffer is only taken when the frame is sent, so a batch that can't be
+ * sent can still be handed to the journal.
+ */
+typedef struct {
+    telemetry_packet packets[DOWNLINK_BATCH_CAPACITY];
+    uint8_t count;
+    uint32_t opened;
+} downlink_batch_t;
+
+/* Bit of downlink_link_t.resync for each encode stream */
+#define DOWNLINK_RESYNC(stream) (1 << (stream))
+#define DOWNLINK_RESYNC_ALL ((1 << ENCODE_STREAM_COUNT) - 1)
+
+/**
+ * A long-lived connection to one downlink destination. The connection is
+ * opened on first use and kept until a send fails, after which reconnects
+ * are spaced out with a bounded exponential backoff. resync marks the
+ * encode streams whose frames the far end may have missed, so that the
+ * next frame of such a stream it gets has to be a keyframe.
+ */
+typedef struct {
+    uint8_t address;
+    uint8_t port;
+    csp_conn_t * conn;
+    uint32_t backoff;
+    uint32_t retry_at;
+    uint8_t resync;
+} downlink_link_t;
+
+void downlink_submit(telemetry_source source, float data);
+
+void downlink_attach(void);
+
+void downlink_wait(uint32_t timeout);
+
+bool downlink_receive(telemetry_packet * packet);
+
+void downlink_batch_init(downlink_batch_t * batch);
+
+bool downlink_batch_add(downlink_batch_t * batch, const telemetry_packet * packet);
+
+bool downlink_batch_ready(const downlink_batch_t * batch, uint32_t now);
+
+uint16_t downlink_batch_encode(const downlink_batch_t * batch, encode_stream_t stream,
+                               uint8_t * out);
+
+csp_packet_t * downlink_batch_frame(const downlink_batch_t * batch, encode_stream_t stream);
+
+void downlink_link_init(downlink_link_t * link, uint8_t address, uint8_t port);
+
+bool downlink_link_up(downlink_link_t * link, uint32_t now);
+
+bool downlink_link_send(downlink_link_t * link, csp_packet_t * packet);
+
+bool downlink_send_frame(downlink_link_t * link, const uint8_t * frame, uint16_t length);
+
+void downlink_link_drop(downlink_link_t * link, uint32_t now);
+
+bool downlink_send(downlink_link_t * link, const downlink_batch_t * batch);
+
+#endif
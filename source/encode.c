@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "capture.h"
+#include "encode.h"
+#include "sources.h"
+#include "stats.h"
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * LSB per unit of each float source, matching the BNO055's own register
+ * resolution so quantizing loses nothing. Zero means no known resolution.
+ * tools/tlm_decode.py has the same table.
+ */
+static const uint16_t source_scale[SOURCE_COUNT] = {
+    [SOURCE_QUAT_W] = 16384, [SOURCE_QUAT_X] = 16384,
+    [SOURCE_QUAT_Y] = 16384, [SOURCE_QUAT_Z] = 16384,
+    [SOURCE_EUL_X] = 16, [SOURCE_EUL_Y] = 16, [SOURCE_EUL_Z] = 16,
+    [SOURCE_GRAV_X] = 100, [SOURCE_GRAV_Y] = 100, [SOURCE_GRAV_Z] = 100,
+    [SOURCE_LIN_X] = 100, [SOURCE_LIN_Y] = 100, [SOURCE_LIN_Z] = 100,
+    [SOURCE_ACC_X] = 100, [SOURCE_ACC_Y] = 100, [SOURCE_ACC_Z] = 100,
+};
+
+/**
+ * source_scale_of: resolution of any source id. Window summaries share
+ * their source's resolution, except the variance, which has none, and
+ * capture samples share that of the quaternion and linear acceleration.
+ */
+
+static uint16_t source_scale_of(uint8_t id)
+{
+    if (id < SOURCE_COUNT)
+    {
+        return source_scale[id];
+    }
+
+    if (id >= SOURCE_STATS_BASE && id < SOURCE_STATS_BASE + STATS_COUNT * SOURCE_COUNT &&
+        (id - SOURCE_STATS_BASE) % STATS_COUNT != STATS_VARIANCE)
+    {
+        return source_scale[(id - SOURCE_STATS_BASE) / STATS_COUNT];
+    }
+
+    if (id >= SOURCE_CAPTURE_BASE + CAPTURE_QUAT_W && id <= SOURCE_CAPTURE_BASE + CAPTURE_QUAT_Z)
+    {
+        return source_scale[SOURCE_QUAT_W];
+    }
+
+    if (id >= SOURCE_CAPTURE_BASE + CAPTURE_LIN_X && id <= SOURCE_CAPTURE_BASE + CAPTURE_LIN_Z)
+    {
+        return source_scale[SOURCE_LIN_X];
+    }
+
+    return 0;
+}
+
+
+typedef struct {
+    int32_t ref[ENCODE_REF_COUNT];
+    uint8_t seq;
+    uint8_t since_key;
+    bool key_due;
+} encoder_t;
+
+static encoder_t encoders[ENCODE_STREAM_COUNT] = {
+    [ENCODE_STREAM_LIVE] = { .key_due = true },
+    [ENCODE_STREAM_BACKLOG] = { .key_due = true },
+};
+
+
+static uint8_t * put_varint(uint8_t * out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t) value;
+
+    return out;
+}
+
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t) value << 1) ^ (uint32_t)(value >> 31);
+}
+
+
+static int32_t quantize(float value, uint16_t scale)
+{
+    float scaled = roundf(value * scale);
+
+    if (scaled >= 2147483647.0f)
+    {
+        return INT32_MAX;
+    }
+    if (scaled <= -2147483648.0f)
+    {
+        return INT32_MIN;
+    }
+
+    return (int32_t) scaled;
+}
+
+
+/**
+ * encode_reset: make the next frame of a stream a keyframe. Called
+ * whenever a frame may not have reached the ground, since later deltas
+ * would build on it.
+ * @param stream the stream to reset
+ */
+
+void encode_reset(encode_stream_t stream)
+{
+    encoders[stream].key_due = true;
+}
+
+
+/**
+ * encode_frame: write the next compact frame of a stream. Each stream
+ * must only be encoded from one task.
+ * @param stream the stream the frame belongs to
+ * @param out buffer of at least sizeof(encode_header_t) +
+ * count * ENCODE_MAX_SAMPLE bytes
+ * @param packets the packets to encode, oldest first
+ * @param count the number of packets
+ * @return the frame length in bytes
+ */
+
+uint16_t encode_frame(encode_stream_t stream, uint8_t * out,
+                      const telemetry_packet * packets, uint8_t count)
+{
+    encoder_t * encoder = &encoders[stream];
+    encode_header_t * header = (encode_header_t *) out;
+    uint8_t * p = out + sizeof(encode_header_t);
+    const telemetry_packet * packet;
+    encode_kind_t kind;
+    uint8_t id;
+    int32_t value;
+    uint8_t i;
+
+    if (encoder->key_due || encoder->since_key >= ENCODE_KEYFRAME_INTERVAL)
+    {
+        memset(encoder->ref, 0, sizeof(encoder->ref));
+        encoder->since_key = 0;
+        encoder->key_due = false;
+        header->flags = ENCODE_FLAG_KEYFRAME;
+    }
+    else
+    {
+        header->flags = 0;
+    }
+
+    if (stream == ENCODE_STREAM_BACKLOG)
+    {
+        header->flags |= ENCODE_FLAG_BACKLOG;
+    }
+
+    header->type = ENCODE_FRAME_TYPE;
+    header->count = count;
+    header->seq = encoder->seq++;
+    header->timestamp = count ? packets[0].timestamp : 0;
+    encoder->since_key++;
+
+    for (i = 0; i < count; i++)
+    {
+        packet = &packets[i];
+        id = packet->source.source_id;
+
+        if (packet->source.data_type == TELEMETRY_TYPE_INT)
+        {
+            kind = ENCODE_KIND_INT;
+            value = packet->data.i;
+        }
+        else if (source_scale_of(id) != 0)
+        {
+            kind = ENCODE_KIND_FIXED;
+            value = quantize(packet->data.f, source_scale_of(id));
+        }
+        else
+        {
+            kind = ENCODE_KIND_FLOAT;
+            memcpy(&value, &packet->data.f, sizeof(value));
+        }
+
+        *p++ = id;
+        p = put_varint(p, ((uint32_t)(uint16_t)(packet->timestamp - header->timestamp) << 2) | kind);
+
+        if (kind == ENCODE_KIND_FLOAT)
+        {
+            p = put_varint(p, (uint32_t) value);
+            continue;
+        }
+
+        if (id < ENCODE_REF_COUNT)
+        {
+            int32_t delta = (int32_t)((uint32_t) value - (uint32_t) encoder->ref[id]);
+            encoder->ref[id] = value;
+            value = delta;
+        }
+        p = put_varint(p, zigzag(value));
+    }
+
+    return (uint16_t)(p - out);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <telemetry/telemetry.h>
+
+#define ENCODE_KEYFRAME_INTERVAL YOTTA_CFG_CSP_BATCH_KEYFRAME_INTERVAL
+
+/* Frame type byte of a compact frame, next to DOWNLINK_FRAME_BATCH */
+#define ENCODE_FRAME_TYPE 0x02
+
+/* The frame resets every delta reference */
+#define ENCODE_FLAG_KEYFRAME 0x01
+
+/* The frame belongs to the backlog stream rather than the live one */
+#define ENCODE_FLAG_BACKLOG 0x02
+
+/* Source ids below this are delta-encoded against their previous value */
+#define ENCODE_REF_COUNT 32
+
+/* Id byte, 3-byte timestamp/kind varint, 5-byte value varint */
+#define ENCODE_MAX_SAMPLE 9
+
+/**
+ * Header of a compact frame. Each sample that follows is its source id,
+ * a varint of (timestamp - header timestamp) << 2 | kind, and a zigzag
+ * varint of the value. The kind says how the value was coded:
+ * ENCODE_KIND_FIXED values are fixed-point at the source's native
+ * resolution, ENCODE_KIND_INT values are integers, and both are deltas
+ * against the previous sample of the same source. ENCODE_KIND_FLOAT is
+ * the raw IEEE-754 bits, used for sources without a known resolution.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t count;
+    uint8_t seq;
+    uint8_t flags;
+    uint16_t timestamp;
+} encode_header_t;
+
+/**
+ * Independent frame streams, each with its own sequence number and delta
+ * references. Live frames are shared by every downlink destination,
+ * while the journal and capture backlog only goes to the log node, so
+ * sending backlog never breaks the live deltas of the others.
+ */
+typedef enum {
+    ENCODE_STREAM_LIVE = 0,
+    ENCODE_STREAM_BACKLOG,
+    ENCODE_STREAM_COUNT
+} encode_stream_t;
+
+typedef enum {
+    ENCODE_KIND_FIXED = 0,
+    ENCODE_KIND_INT,
+    ENCODE_KIND_FLOAT
+} encode_kind_t;
+
+void encode_reset(encode_stream_t stream);
+
+uint16_t encode_frame(encode_stream_t stream, uint8_t * out,
+                      const telemetry_packet * packets, uint8_t count);
+
+#endif
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "fanout.h"
+#include "journal.h"
+
+#include <string.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+/**
+ * Live telemetry goes to several downlink destinations. The sender
+ * encodes each batch once into a reference-counted frame from a fixed
+ * pool and puts a reference on every destination's queue. Each
+ * destination has its own task that copies the frame into a CSP buffer
+ * for its connection, so a slow or unreachable destination only ever
+ * fills its own queue, and the sender never waits for one. The other
+ * destinations are best effort and miss frames for a full queue. The
+ * exception is the log node, whose task lives in main.c since it also
+ * owns the journal: nothing for it may be lost, so when its queue is
+ * full the sender moves the oldest frame queued for it into the journal
+ * to make room. The log node sees the gap, and its task journals live
+ * frames while the journal isn't empty, so the backlog stays in order.
+ *
+ * All destinations share one live stream of compact frames. A
+ * destination whose far end missed a frame can't use deltas until the
+ * next keyframe, and asks the sender for one early.
+ */
+
+#define FANOUT_LOG_NODE_ADDRESS YOTTA_CFG_CSP_LOG_NODE_ADDRESS
+#define FANOUT_LOG_NODE_PORT YOTTA_CFG_CSP_PORT
+
+#if FANOUT_DESTINATIONS < 1 || FANOUT_DESTINATIONS > 4
+#error "csp.fanout.destinations must be 1 to 4"
+#endif
+
+static const struct {
+    uint8_t address;
+    uint8_t port;
+} destinations[FANOUT_DESTINATIONS] = {
+    { FANOUT_LOG_NODE_ADDRESS, FANOUT_LOG_NODE_PORT },
+#if FANOUT_DESTINATIONS > 1
+    { YOTTA_CFG_CSP_FANOUT_DEST1_ADDRESS, YOTTA_CFG_CSP_FANOUT_DEST1_PORT },
+#endif
+#if FANOUT_DESTINATIONS > 2
+    { YOTTA_CFG_CSP_FANOUT_DEST2_ADDRESS, YOTTA_CFG_CSP_FANOUT_DEST2_PORT },
+#endif
+#if FANOUT_DESTINATIONS > 3
+    { YOTTA_CFG_CSP_FANOUT_DEST3_ADDRESS, YOTTA_CFG_CSP_FANOUT_DEST3_PORT },
+#endif
+};
+
+static struct {
+    fanout_frame_t frames[FANOUT_FRAMES];
+    csp_queue_handle_t queues[FANOUT_DESTINATIONS];
+    volatile TaskHandle_t tasks[FANOUT_DESTINATIONS];
+    /* Sequence number each destination expects next, only used by its task */
+    uint32_t expected[FANOUT_DESTINATIONS];
+    /* Only written by the sender */
+    uint32_t seq;
+    volatile uint32_t key_seq;
+    /* Set by any destination task, cleared by the sender */
+    volatile bool key_wanted;
+} fanout;
+
+
+/**
+ * fanout_init: create the destination queues and start the tasks of the
+ * destinations other than the log node. Must run before the sender and
+ * log node tasks are started.
+ */
+
+void fanout_init(void)
+{
+    csp_thread_handle_t thread;
+    uint8_t i;
+
+    for (i = 0; i < FANOUT_DESTINATIONS; i++)
+    {
+        fanout.queues[i] = csp_queue_create(FANOUT_QUEUE_LEN, sizeof(fanout_frame_t *));
+    }
+
+    for (i = 1; i < FANOUT_DESTINATIONS; i++)
+    {
+        csp_thread_create(fanout_thread, "FANOUT", 1000, (void *)(uintptr_t) i, 0, &thread);
+    }
+}
+
+
+/**
+ * fanout_address: CSP address of a destination, for routing.
+ * @param dest the destination index
+ * @return the destination's CSP address
+ */
+
+uint8_t fanout_address(uint8_t dest)
+{
+    return destinations[dest].address;
+}
+
+
+/**
+ * fanout_port: CSP port of a destination.
+ * @param dest the destination index
+ * @return the port frames are sent to
+ */
+
+uint8_t fanout_port(uint8_t dest)
+{
+    return destinations[dest].port;
+}
+
+
+/**
+ * fanout_attach: make the calling task the one that takes a destination's
+ * frames, and that fanout_wake wakes.
+ * @param dest the destination index
+ */
+
+void fanout_attach(uint8_t dest)
+{
+    fanout.tasks[dest] = xTaskGetCurrentTaskHandle();
+}
+
+
+/**
+ * fanout_wake: wake a destination's task for work it finds by itself,
+ * such as a frozen capture.
+ * @param dest the destination index
+ */
+
+void fanout_wake(uint8_t dest)
+{
+    if (fanout.tasks[dest] != NULL)
+    {
+        xTaskNotifyGive(fanout.tasks[dest]);
+    }
+}
+
+
+/**
+ * frame_get: take a free frame from the pool. Only the sender takes
+ * frames, so one seen free stays free until it is handed out.
+ */
+
+static fanout_frame_t * frame_get(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < FANOUT_FRAMES; i++)
+    {
+        if (fanout.frames[i].refs == 0)
+        {
+            fanout.frames[i].refs = 1;
+            return &fanout.frames[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * journal_batch: store a frame's packets in the journal.
+ */
+
+static void journal_batch(const fanout_frame_t * frame)
+{
+    uint8_t i;
+
+    for (i = 0; i < frame->batch.count; i++)
+    {
+        journal_append(&frame->batch.packets[i]);
+    }
+}
+
+
+/**
+ * journal_oldest: make room in the log node's queue by moving the oldest
+ * frame on it into the journal.
+ */
+
+static void journal_oldest(void)
+{
+    fanout_frame_t * oldest;
+
+    if (csp_queue_dequeue(fanout.queues[FANOUT_LOG_NODE], &oldest, 0) == CSP_QUEUE_OK)
+    {
+        journal_batch(oldest);
+        fanout_release(oldest);
+    }
+}
+
+
+/**
+ * fanout_publish: encode a batch once as a live frame and queue it for
+ * every destination without waiting for any of them. A destination
+ * other than the log node whose queue is full misses the frame; for the
+ * log node, the oldest queued frame goes to the journal instead. Must
+ * only be called from the sender task.
+ * @param batch the batch to send; it is left untouched
+ */
+
+void fanout_publish(const downlink_batch_t * batch)
+{
+    fanout_frame_t * frame;
+    bool queued;
+    uint8_t i;
+
+    /* The pool is sized so that this can't fail */
+    if ((frame = frame_get()) == NULL)
+    {
+        return;
+    }
+
+    if (fanout.key_wanted)
+    {
+        fanout.key_wanted = false;
+        encode_reset(ENCODE_STREAM_LIVE);
+    }
+
+    frame->batch = *batch;
+    frame->seq = fanout.seq++;
+    frame->length = downlink_batch_encode(batch, ENCODE_STREAM_LIVE, frame->data);
+#if DOWNLINK_BATCH_ENABLED && DOWNLINK_COMPACT
+    frame->key = ((const encode_header_t *) frame->data)->flags & ENCODE_FLAG_KEYFRAME;
+#else
+    frame->key = true;
+#endif
+
+    if (frame->key)
+    {
+        fanout.key_seq = frame->seq;
+    }
+
+    /* The frame must be complete before any destination can see it */
+    __sync_synchronize();
+
+    for (i = 0; i < FANOUT_DESTINATIONS; i++)
+    {
+        __sync_add_and_fetch(&frame->refs, 1);
+
+        queued = csp_queue_enqueue(fanout.queues[i], &frame, 0) == CSP_QUEUE_OK;
+
+        if (!queued && i == FANOUT_LOG_NODE)
+        {
+            journal_oldest();
+            queued = csp_queue_enqueue(fanout.queues[i], &frame, 0) == CSP_QUEUE_OK;
+        }
+
+        if (queued)
+        {
+            fanout_wake(i);
+            continue;
+        }
+
+        __sync_sub_and_fetch(&frame->refs, 1);
+
+        /* Only the sender queues frames, so this is a safety net */
+        if (i == FANOUT_LOG_NODE)
+        {
+            journal_batch(frame);
+        }
+    }
+
+    fanout_release(frame);
+}
+
+
+/**
+ * fanout_take: take the oldest frame queued for a destination. The
+ * caller holds a reference until it calls fanout_release. If frames
+ * were dropped for a full queue since the last one, the far end can't
+ * follow deltas until the next keyframe.
+ * @param dest the destination index
+ * @param link the destination's link
+ * @return the frame, or NULL if none is queued
+ */
+
+fanout_frame_t * fanout_take(uint8_t dest, downlink_link_t * link)
+{
+    fanout_frame_t * frame;
+
+    if (csp_queue_dequeue(fanout.queues[dest], &frame, 0) != CSP_QUEUE_OK)
+    {
+        return NULL;
+    }
+
+    if (frame->seq != fanout.expected[dest])
+    {
+        link->resync |= DOWNLINK_RESYNC(ENCODE_STREAM_LIVE);
+    }
+    fanout.expected[dest] = frame->seq + 1;
+
+    return frame;
+}
+
+
+/**
+ * fanout_release: drop a reference to a frame, returning it to the pool
+ * with the last one.
+ * @param frame the frame
+ */
+
+void fanout_release(fanout_frame_t * frame)
+{
+    __sync_sub_and_fetch(&frame->refs, 1);
+}
+
+
+/**
+ * fanout_resync: ask the sender to make the next live frame a keyframe,
+ * unless one the destination hasn't taken yet is already on its way.
+ * @param dest the destination index
+ */
+
+void fanout_resync(uint8_t dest)
+{
+    if ((int32_t)(fanout.key_seq - fanout.expected[dest]) < 0)
+    {
+        fanout.key_wanted = true;
+    }
+}
+
+
+/**
+ * fanout_send: send a live frame over a destination's link. A delta
+ * frame is only sent if the far end has every frame it builds on;
+ * otherwise it is not sent, as it would be of no use there, and a
+ * keyframe is asked for.
+ * @param dest the destination index
+ * @param link the destination's link
+ * @param frame the frame to send
+ * @return false if the frame wasn't sent, for the caller to keep or drop
+ */
+
+bool fanout_send(uint8_t dest, downlink_link_t * link, const fanout_frame_t * frame)
+{
+    if (!downlink_link_up(link, csp_get_ms()))
+    {
+        return false;
+    }
+
+    if (!frame->key && (link->resync & DOWNLINK_RESYNC(ENCODE_STREAM_LIVE)))
+    {
+        fanout_resync(dest);
+        return false;
+    }
+
+    if (!downlink_send_frame(link, frame->data, frame->length))
+    {
+        return false;
+    }
+
+    if (frame->key)
+    {
+        link->resync &= ~DOWNLINK_RESYNC(ENCODE_STREAM_LIVE);
+    }
+
+    return true;
+}
+
+
+/**
+ * fanout_thread: send the frames queued for a destination other than the
+ * log node. These get live telemetry only, and a frame that can't be
+ * sent is dropped.
+ * @param param the destination index
+ */
+
+CSP_DEFINE_TASK(fanout_thread)
+{
+    uint8_t dest = (uint8_t)(uintptr_t) param;
+    downlink_link_t link;
+    fanout_frame_t * frame;
+
+    downlink_link_init(&link, destinations[dest].address, destinations[dest].port);
+    fanout_attach(dest);
+
+    while (1)
+    {
+        while ((frame = fanout_take(dest, &link)) != NULL)
+        {
+            fanout_send(dest, &link, frame);
+            fanout_release(frame);
+        }
+
+        downlink_wait(DOWNLINK_WAIT_FOREVER);
+    }
+}
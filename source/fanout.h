@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <csp/arch/csp_thread.h>
+
+#include "downlink.h"
+
+/* Downlink destinations, the log node first */
+#define FANOUT_DESTINATIONS YOTTA_CFG_CSP_FANOUT_DESTINATIONS
+
+/* Frames that can wait for each destination's task */
+#define FANOUT_QUEUE_LEN YOTTA_CFG_CSP_FANOUT_QUEUE
+
+/* The log node also gets the journal and capture backlog */
+#define FANOUT_LOG_NODE 0
+
+/* Every frame the queues and destination tasks can hold, plus the one being built */
+#define FANOUT_FRAMES (FANOUT_DESTINATIONS * (FANOUT_QUEUE_LEN + 1) + 1)
+
+/**
+ * A live frame, encoded once by the sender and shared by every
+ * destination queue it was put on. It goes back to the pool when the
+ * last holder releases it. The batch is kept for the log node, which
+ * journals the packets of a frame it can't send.
+ */
+typedef struct {
+    volatile uint8_t refs;
+    bool key;
+    uint32_t seq;
+    uint16_t length;
+    uint8_t data[DOWNLINK_MTU];
+    downlink_batch_t batch;
+} fanout_frame_t;
+
+void fanout_init(void);
+
+uint8_t fanout_address(uint8_t dest);
+
+uint8_t fanout_port(uint8_t dest);
+
+void fanout_attach(uint8_t dest);
+
+void fanout_wake(uint8_t dest);
+
+void fanout_publish(const downlink_batch_t * batch);
+
+fanout_frame_t * fanout_take(uint8_t dest, downlink_link_t * link);
+
+void fanout_release(fanout_frame_t * frame);
+
+void fanout_resync(uint8_t dest);
+
+bool fanout_send(uint8_t dest, downlink_link_t * link, const fanout_frame_t * frame);
+
+CSP_DEFINE_TASK(fanout_thread);
+
+#endif
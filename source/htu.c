@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "htu.h"
+
+#include "xfer.h"
+
+#include <stddef.h>
+#include <csp/arch/csp_time.h>
+
+/**
+ * HTU21D measurements in no hold master mode. A measurement is started
+ * with one short write, and the sensor NACKs its address until the
+ * conversion is done instead of stretching the clock, so the bus is free
+ * for the BNO055 while the HTU21D converts. Transfers go through the
+ * I2C task, and a result is read with a transaction queued by
+ * htu_collect_begin and finished by htu_collect_end.
+ */
+
+static struct {
+    htu_measurement_t pending;
+    uint32_t started;
+    uint8_t cmd;
+    uint8_t buf[3];
+    xfer_t xfer;
+    bool reading;
+} htu;
+
+
+static uint32_t conversion_ms(htu_measurement_t measurement)
+{
+    return (measurement == HTU_TEMP) ? HTU_TEMP_MS : HTU_HUM_MS;
+}
+
+
+/* CRC-8 of a reading, polynomial x^8 + x^5 + x^4 + 1 */
+static uint8_t htu_crc(const uint8_t * data, uint8_t len)
+{
+    uint8_t crc = 0;
+    uint8_t bit;
+
+    while (len--)
+    {
+        crc ^= *data++;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+
+/**
+ * htu_trigger: start a measurement. Any measurement still pending is
+ * abandoned.
+ * @param measurement HTU_TEMP or HTU_HUM
+ * @return SENSOR_OK if the sensor took the command
+ */
+
+KSensorStatus htu_trigger(htu_measurement_t measurement)
+{
+    htu.pending = HTU_NONE;
+    htu.cmd = (measurement == HTU_TEMP) ? HTU_TRIGGER_TEMP_NOHOLD : HTU_TRIGGER_HUM_NOHOLD;
+
+    htu.xfer.op = XFER_WRITE;
+    htu.xfer.client = XFER_CLIENT_SAMPLING;
+    htu.xfer.bus = HTU_I2C_BUS;
+    htu.xfer.addr = HTU_ADDRESS;
+    htu.xfer.tx = &htu.cmd;
+    htu.xfer.tx_len = 1;
+    htu.xfer.done = NULL;
+
+    if (xfer_run(&htu.xfer) != I2C_OK)
+    {
+        return SENSOR_WRITE_ERROR;
+    }
+
+    htu.pending = measurement;
+    htu.started = csp_get_ms();
+
+    return SENSOR_OK;
+}
+
+
+/**
+ * htu_pending: find out which measurement is converting.
+ * @return the measurement, or HTU_NONE
+ */
+
+htu_measurement_t htu_pending(void)
+{
+    return htu.pending;
+}
+
+
+/**
+ * htu_collect_begin: queue the read of the pending measurement if its
+ * conversion time is up.
+ * @return true if a read was queued and htu_collect_end must follow
+ */
+
+bool htu_collect_begin(void)
+{
+    if (htu.pending == HTU_NONE || csp_get_ms() - htu.started < conversion_ms(htu.pending))
+    {
+        return false;
+    }
+
+    htu.xfer.op = XFER_READ;
+    htu.xfer.client = XFER_CLIENT_SAMPLING;
+    htu.xfer.bus = HTU_I2C_BUS;
+    htu.xfer.addr = HTU_ADDRESS;
+    htu.xfer.rx = htu.buf;
+    htu.xfer.rx_len = 3;
+    htu.xfer.done = NULL;
+
+    htu.reading = xfer_submit(&htu.xfer);
+
+    return htu.reading;
+}
+
+
+/**
+ * htu_collect_end: wait for the read queued by htu_collect_begin and
+ * convert it. A sensor that is still busy is asked again after the next
+ * htu_collect_begin, for up to another conversion time before the read
+ * counts as failed.
+ * @param status set to the result of the read once it is done
+ * @param value set to the temperature in C or relative humidity in %
+ * @return false if the measurement isn't ready yet
+ */
+
+bool htu_collect_end(KSensorStatus * status, float * value)
+{
+    uint32_t conversion = conversion_ms(htu.pending);
+    uint16_t raw;
+
+    if (!htu.reading)
+    {
+        return false;
+    }
+    htu.reading = false;
+
+    if (xfer_wait(&htu.xfer) != I2C_OK)
+    {
+        if (csp_get_ms() - htu.started < 2 * conversion)
+        {
+            return false;
+        }
+        *status = SENSOR_READ_ERROR;
+    }
+    else if (htu_crc(htu.buf, 2) != htu.buf[2])
+    {
+        *status = SENSOR_READ_ERROR;
+    }
+    else
+    {
+        raw = ((htu.buf[0] << 8) | htu.buf[1]) & 0xFFFC;
+        *value = (htu.pending == HTU_TEMP) ? -46.85f + 175.72f * raw / 65536.0f
+                                           : -6.0f + 125.0f * raw / 65536.0f;
+        *status = SENSOR_OK;
+    }
+
+    htu.pending = HTU_NONE;
+
+    return true;
+}
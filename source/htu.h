@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HTU_H
+#define HTU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kubos-core/modules/sensors/sensors.h>
+
+#define HTU_I2C_BUS YOTTA_CFG_SENSORS_HTU21D_I2C_BUS
+#define HTU_PIPELINED YOTTA_CFG_SENSORS_HTU21D_PIPELINED
+
+#define HTU_ADDRESS 0x40
+#define HTU_TRIGGER_TEMP_NOHOLD 0xF3
+#define HTU_TRIGGER_HUM_NOHOLD 0xF5
+
+/* Worst case conversion times at full resolution, from the datasheet */
+#define HTU_TEMP_MS 50
+#define HTU_HUM_MS 16
+
+typedef enum {
+    HTU_NONE = 0,
+    HTU_TEMP,
+    HTU_HUM
+} htu_measurement_t;
+
+KSensorStatus htu_trigger(htu_measurement_t measurement);
+
+htu_measurement_t htu_pending(void);
+
+bool htu_collect_begin(void);
+
+bool htu_collect_end(KSensorStatus * status, float * value);
+
+#endif
@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "disk.h"
+#include "journal.h"
+
+#include <string.h>
+#include <csp/arch/csp_semaphore.h>
+
+/**
+ * The journal is a store-and-forward log for telemetry that couldn't be
+ * sent. It lives in one preallocated file used as a ring of sectors:
+ * sector 0 holds the header, sectors 1..JOURNAL_SECTORS hold packets.
+ * Packets are gathered into a sector in RAM and written a whole sector
+ * at a time, so RAM use is one sector for writing and one for reading.
+ *
+ * The log node's downlink task drains the journal and appends what it
+ * can't send. The sender also appends, for frames that don't fit in the
+ * log node's queue, so every call takes the journal lock. A drained
+ * packet is only removed by journal_consume, and the sender's appends
+ * may commit the RAM sector in between; journal_peek notes where the
+ * packets came from so they are removed from wherever they are now.
+ */
+
+#define JOURNAL_PATH "TLM.JNL"
+#define JOURNAL_MAGIC 0x4A4C
+#define JOURNAL_FORMAT 1
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t format;
+    uint8_t reserved;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t seq;
+} journal_header_t;
+
+static struct {
+    FIL file;
+    bool open;
+    /* Ring slots: head is written next, tail is read next */
+    uint32_t head;
+    uint32_t tail;
+    /* Sequence number of the next sector written */
+    uint32_t seq;
+    uint16_t unsynced;
+    /* Sector being filled, and how many of its packets were drained */
+    journal_sector_t wbuf;
+    uint8_t wread;
+    /* Copy of the tail sector, and how many of its packets were drained */
+    journal_sector_t rbuf;
+    uint8_t rpos;
+    bool rloaded;
+    /* Where the last journal_peek took its packets from */
+    uint32_t peek_tail;
+    bool peek_ram;
+    uint32_t dropped;
+} journal;
+
+/* The sender and the log node's downlink task both use the journal */
+static csp_mutex_t journal_mutex;
+
+
+static uint16_t write_header(void)
+{
+    UINT bw;
+    uint16_t ret;
+    journal_header_t header = {
+        .magic = JOURNAL_MAGIC,
+        .format = JOURNAL_FORMAT,
+        .head = journal.head,
+        .tail = journal.tail,
+        .seq = journal.seq
+    };
+
+    if ((ret = f_lseek(&journal.file, 0)) == FR_OK &&
+        (ret = f_write(&journal.file, &header, sizeof(header), &bw)) == FR_OK)
+    {
+        ret = f_sync(&journal.file);
+    }
+
+    journal.unsynced = 0;
+
+    return ret;
+}
+
+
+static uint16_t write_sector(uint32_t slot, const journal_sector_t * sector)
+{
+    UINT bw = 0;
+    uint16_t ret;
+
+    if ((ret = f_lseek(&journal.file, (slot + 1) * JOURNAL_SECTOR_SIZE)) == FR_OK &&
+        (ret = f_write(&journal.file, sector->raw, JOURNAL_SECTOR_SIZE, &bw)) == FR_OK &&
+        bw != JOURNAL_SECTOR_SIZE)
+    {
+        ret = FR_DISK_ERR;
+    }
+
+    return ret;
+}
+
+
+static uint16_t read_sector(uint32_t slot, journal_sector_t * sector)
+{
+    UINT br = 0;
+    uint16_t ret;
+
+    if ((ret = f_lseek(&journal.file, (slot + 1) * JOURNAL_SECTOR_SIZE)) == FR_OK &&
+        (ret = f_read(&journal.file, sector->raw, JOURNAL_SECTOR_SIZE, &br)) == FR_OK &&
+        (br != JOURNAL_SECTOR_SIZE || sector->data.count > JOURNAL_SECTOR_PACKETS))
+    {
+        ret = FR_INT_ERR;
+    }
+
+    return ret;
+}
+
+
+/**
+ * create_journal: size a new journal file and write an empty header.
+ * The file is allocated up front, contiguously where FatFs supports it,
+ * so appends never have to walk or extend the cluster chain.
+ */
+
+static uint16_t create_journal(void)
+{
+    uint16_t ret;
+    DWORD size = (JOURNAL_SECTORS + 1) * JOURNAL_SECTOR_SIZE;
+
+#if _FATFS >= 88100
+    ret = f_expand(&journal.file, size, 1);
+#else
+    ret = f_lseek(&journal.file, size);
+#endif
+    if (ret != FR_OK)
+    {
+        return ret;
+    }
+
+    journal.head = 0;
+    journal.tail = 0;
+    journal.seq = 1;
+
+    return write_header();
+}
+
+
+/**
+ * recover_journal: load the header, then walk forward from the recorded
+ * head over any sectors written after the header was last synced.
+ */
+
+static uint16_t recover_journal(void)
+{
+    UINT br = 0;
+    uint16_t ret;
+    journal_header_t header;
+
+    if ((ret = f_lseek(&journal.file, 0)) != FR_OK ||
+        (ret = f_read(&journal.file, &header, sizeof(header), &br)) != FR_OK)
+    {
+        return ret;
+    }
+
+    if (br != sizeof(header) || header.magic != JOURNAL_MAGIC ||
+        header.format != JOURNAL_FORMAT || header.head >= JOURNAL_SECTORS ||
+        header.tail >= JOURNAL_SECTORS)
+    {
+        return create_journal();
+    }
+
+    journal.head = header.head;
+    journal.tail = header.tail;
+    journal.seq = header.seq;
+
+    while ((journal.head + 1) % JOURNAL_SECTORS != journal.tail &&
+           read_sector(journal.head, &journal.rbuf) == FR_OK &&
+           journal.rbuf.data.seq == journal.seq)
+    {
+        journal.head = (journal.head + 1) % JOURNAL_SECTORS;
+        journal.seq++;
+    }
+
+    return write_header();
+}
+
+
+/**
+ * journal_init: create the journal lock. Must run before the sender and
+ * log node tasks are started.
+ */
+
+void journal_init(void)
+{
+    csp_mutex_create(&journal_mutex);
+}
+
+
+/**
+ * journal_open: open the journal file, creating it if needed. Without an
+ * SD card (or with the journal disabled) every other journal call is a
+ * no-op and appended packets are dropped.
+ * @return true if the journal is usable
+ */
+
+bool journal_open(void)
+{
+#if JOURNAL_ENABLED
+    uint16_t ret;
+
+    csp_mutex_lock(&journal_mutex, CSP_MAX_DELAY);
+    disk_lock();
+
+    if ((ret = mount_disk()) == FR_OK &&
+        (ret = f_open(&journal.file, JOURNAL_PATH, FA_READ | FA_WRITE | FA_OPEN_ALWAYS)) == FR_OK)
+    {
+        if (f_size(&journal.file) == 0)
+        {
+            ret = create_journal();
+        }
+        else
+        {
+            ret = recover_journal();
+        }
+
+        if (ret == FR_OK)
+        {
+            journal.open = true;
+        }
+        else
+        {
+            f_close(&journal.file);
+        }
+    }
+
+    disk_unlock();
+    csp_mutex_unlock(&journal_mutex);
+#endif
+
+    return journal.open;
+}
+
+
+/**
+ * commit_sector: write the RAM sector out at the head of the ring. If
+ * the ring is full the oldest sector is overwritten.
+ */
+
+static void commit_sector(void)
+{
+    uint32_t next = (journal.head + 1) % JOURNAL_SECTORS;
+
+    if (next == journal.tail)
+    {
+        journal.dropped += journal.rloaded ? journal.rbuf.data.count - journal.rpos
+                                           : JOURNAL_SECTOR_PACKETS;
+        journal.tail = (journal.tail + 1) % JOURNAL_SECTORS;
+        journal.rloaded = false;
+        journal.rpos = 0;
+    }
+
+    journal.wbuf.data.seq = journal.seq;
+
+    disk_lock();
+
+    if (write_sector(journal.head, &journal.wbuf) == FR_OK)
+    {
+        journal.head = next;
+        journal.seq++;
+
+        if (++journal.unsynced >= JOURNAL_SYNC_INTERVAL)
+        {
+            write_header();
+        }
+    }
+    else
+    {
+        journal.dropped += journal.wbuf.data.count;
+    }
+
+    disk_unlock();
+
+    journal.wbuf.data.count = 0;
+}
+
+
+/**
+ * advance_tail: move past the tail sector once all of it has been sent.
+ */
+
+static void advance_tail(void)
+{
+    journal.tail = (journal.tail + 1) % JOURNAL_SECTORS;
+    journal.rloaded = false;
+    journal.rpos = 0;
+
+    if (++journal.unsynced >= JOURNAL_SYNC_INTERVAL)
+    {
+        disk_lock();
+        write_header();
+        disk_unlock();
+    }
+}
+
+
+/**
+ * journal_append: add a packet to the journal. It is buffered in RAM
+ * until a whole sector's worth has been gathered.
+ * @param packet the packet to store
+ */
+
+void journal_append(const telemetry_packet * packet)
+{
+    csp_mutex_lock(&journal_mutex, CSP_MAX_DELAY);
+
+    if (!journal.open)
+    {
+        journal.dropped++;
+        csp_mutex_unlock(&journal_mutex);
+        return;
+    }
+
+    /* Drop what was already drained from the RAM sector before reusing it */
+    if (journal.wbuf.data.count == JOURNAL_SECTOR_PACKETS && journal.wread > 0)
+    {
+        journal.wbuf.data.count -= journal.wread;
+        memmove(journal.wbuf.data.packets, journal.wbuf.data.packets + journal.wread,
+                journal.wbuf.data.count * sizeof(telemetry_packet));
+        journal.wread = 0;
+    }
+
+    journal.wbuf.data.packets[journal.wbuf.data.count++] = *packet;
+
+    if (journal.wbuf.data.count == JOURNAL_SECTOR_PACKETS && journal.wread == 0)
+    {
+        commit_sector();
+    }
+
+    csp_mutex_unlock(&journal_mutex);
+}
+
+
+/**
+ * journal_empty: check for stored packets, on the card or still in RAM.
+ * @return true if there is nothing left to drain
+ */
+
+bool journal_empty(void)
+{
+    bool empty;
+
+    csp_mutex_lock(&journal_mutex, CSP_MAX_DELAY);
+    empty = (journal.head == journal.tail) && (journal.wread == journal.wbuf.data.count);
+    csp_mutex_unlock(&journal_mutex);
+
+    return empty;
+}
+
+
+/**
+ * journal_peek: copy out the oldest stored packets without removing them.
+ * Sectors on the card are drained first; once they are gone packets are
+ * served straight from the RAM sector.
+ * @param packets where to copy the packets
+ * @param max the most packets to copy
+ * @return the number of packets copied
+ */
+
+uint8_t journal_peek(telemetry_packet * packets, uint8_t max)
+{
+    const telemetry_packet * first;
+    uint8_t available;
+
+    csp_mutex_lock(&journal_mutex, CSP_MAX_DELAY);
+
+    journal.peek_tail = journal.tail;
+    journal.peek_ram = (journal.head == journal.tail);
+
+    if (!journal.peek_ram)
+    {
+        if (!journal.rloaded)
+        {
+            disk_lock();
+            if (read_sector(journal.tail, &journal.rbuf) != FR_OK)
+            {
+                /* Skip a sector that can't be read back */
+                journal.rbuf.data.count = 0;
+            }
+            disk_unlock();
+
+            journal.rloaded = true;
+        }
+
+        first = journal.rbuf.data.packets + journal.rpos;
+        available = (journal.rpos < journal.rbuf.data.count) ?
+                    journal.rbuf.data.count - journal.rpos : 0;
+
+        /* Nothing left in it, or already sent from RAM before it was written */
+        if (available == 0)
+        {
+            advance_tail();
+        }
+    }
+    else
+    {
+        first = journal.wbuf.data.packets + journal.wread;
+        available = journal.wbuf.data.count - journal.wread;
+    }
+
+    if (available > max)
+    {
+        available = max;
+    }
+
+    memcpy(packets, first, available * sizeof(telemetry_packet));
+
+    csp_mutex_unlock(&journal_mutex);
+
+    return available;
+}
+
+
+/**
+ * journal_consume: remove packets returned by the last journal_peek once
+ * they have been sent. Packets peeked from RAM may have been written out
+ * to the card since, and are then removed from the tail sector; packets
+ * whose sector was overwritten in the meantime are already gone.
+ * @param count the number of packets sent
+ */
+
+void journal_consume(uint8_t count)
+{
+    csp_mutex_lock(&journal_mutex, CSP_MAX_DELAY);
+
+    if (journal.peek_ram && journal.head == journal.tail)
+    {
+        journal.wread += count;
+
+        if (journal.wread >= journal.wbuf.data.count)
+        {
+            journal.wbuf.data.count = 0;
+            journal.wread = 0;
+        }
+    }
+    else if (journal.tail == journal.peek_tail)
+    {
+        journal.rpos += count;
+
+        if (journal.rloaded && journal.rpos >= journal.rbuf.data.count)
+        {
+            advance_tail();
+        }
+    }
+
+    csp_mutex_unlock(&journal_mutex);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <telemetry/telemetry.h>
+
+#define JOURNAL_ENABLED YOTTA_CFG_JOURNAL_ENABLED
+#define JOURNAL_SECTORS YOTTA_CFG_JOURNAL_SECTORS
+#define JOURNAL_SYNC_INTERVAL YOTTA_CFG_JOURNAL_SYNC_INTERVAL
+
+#define JOURNAL_SECTOR_SIZE 512
+#define JOURNAL_SECTOR_PACKETS ((JOURNAL_SECTOR_SIZE - 8) / sizeof(telemetry_packet))
+
+/**
+ * One data sector of the journal. Sectors are only ever written whole,
+ * and the sequence number lets journal_open find sectors written after
+ * the header was last synced.
+ */
+typedef union {
+    uint8_t raw[JOURNAL_SECTOR_SIZE];
+    struct {
+        uint32_t seq;
+        uint8_t count;
+        uint8_t reserved[3];
+        telemetry_packet packets[JOURNAL_SECTOR_PACKETS];
+    } data;
+} journal_sector_t;
+
+void journal_init(void);
+
+bool journal_open(void);
+
+void journal_append(const telemetry_packet * packet);
+
+bool journal_empty(void);
+
+uint8_t journal_peek(telemetry_packet * packets, uint8_t max);
+
+void journal_consume(uint8_t count);
+
+#endif
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "kiss.h"
+
+#include <csp/arch/csp_queue.h>
+#include <csp/csp_crc32.h>
+#include <csp/csp_endian.h>
+#include <csp/drivers/usart.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+/**
+ * Frame-level KISS transmit. libcsp's csp_kiss_tx escapes a frame one
+ * byte at a time through the putc callback, holding the sending task for
+ * as long as the frame takes on the wire. Here the interface's nexthop
+ * only queues the packet and returns; the KISS TX task escapes each
+ * frame into a chunk buffer and hands it to the UART a chunk at a time,
+ * then frees the packet once the last byte is with the UART. The sender
+ * prepares the next frame while the current one is going out, so the
+ * link never idles between frames.
+ *
+ * Receive is deferred the same way. The UART callback runs in interrupt
+ * context, so it only copies the bytes into a lock-free byte ring and
+ * wakes the KISS RX task, which decodes everything waiting with
+ * csp_kiss_rx in task context. Bytes that don't fit in the ring are
+ * counted as overruns.
+ */
+
+#define KISS_FEND 0xC0
+#define KISS_FESC 0xDB
+#define KISS_TFEND 0xDC
+#define KISS_TFESC 0xDD
+#define KISS_TNC_DATA 0x00
+
+#if KISS_RX_RING & (KISS_RX_RING - 1)
+#error "csp.kiss.rx_ring must be a power of two"
+#endif
+
+static struct {
+    csp_iface_t * iface;
+    csp_queue_handle_t frames;
+    KUARTNum uart;
+    uint8_t chunk[KISS_TX_CHUNK];
+    uint16_t used;
+    /* Only the callback moves rx_head and only the RX task moves rx_tail */
+    uint8_t rx[KISS_RX_RING];
+    volatile uint32_t rx_head;
+    volatile uint32_t rx_tail;
+    volatile TaskHandle_t receiver;
+    uint32_t counters[KISS_COUNTER_COUNT];
+} kiss;
+
+
+/**
+ * kiss_tx: nexthop of the KISS interface. Never touches the UART.
+ * @param iface the KISS interface
+ * @param packet the packet to send; taken on success
+ * @param timeout the longest to wait for room in the queue, in ms
+ * @return CSP_ERR_NONE, or CSP_ERR_TIMEOUT if the queue stayed full and
+ *         the caller still owns the packet
+ */
+
+static int kiss_tx(csp_iface_t * iface, csp_packet_t * packet, uint32_t timeout)
+{
+    (void) iface;
+
+    if (csp_queue_enqueue(kiss.frames, &packet, timeout) != CSP_QUEUE_OK)
+    {
+        return CSP_ERR_TIMEOUT;
+    }
+
+    return CSP_ERR_NONE;
+}
+
+
+static void chunk_flush(void)
+{
+    if (kiss.used > 0)
+    {
+        k_uart_write(kiss.uart, (char *) kiss.chunk, kiss.used);
+        kiss.used = 0;
+    }
+}
+
+
+static void chunk_put(uint8_t byte)
+{
+    if (kiss.used == KISS_TX_CHUNK)
+    {
+        chunk_flush();
+    }
+
+    kiss.chunk[kiss.used++] = byte;
+}
+
+
+/**
+ * kiss_frame: escape one packet onto the UART, framed as libcsp frames
+ * it: CRC32 over the data, the id in network order in front, FEND and
+ * the data command byte around it.
+ */
+
+static void kiss_frame(csp_packet_t * packet)
+{
+    uint32_t crc = csp_hton32(csp_crc32_memory(packet->data, packet->length));
+    const uint8_t * bytes;
+    uint16_t length;
+    uint16_t i;
+
+    memcpy(packet->data + packet->length, &crc, sizeof(crc));
+    packet->id.ext = csp_hton32(packet->id.ext);
+    length = sizeof(packet->id.ext) + packet->length + sizeof(crc);
+    bytes = (const uint8_t *) &packet->id.ext;
+
+    chunk_put(KISS_FEND);
+    chunk_put(KISS_TNC_DATA);
+
+    for (i = 0; i < length; i++)
+    {
+        if (bytes[i] == KISS_FEND)
+        {
+            chunk_put(KISS_FESC);
+            chunk_put(KISS_TFEND);
+        }
+        else if (bytes[i] == KISS_FESC)
+        {
+            chunk_put(KISS_FESC);
+            chunk_put(KISS_TFESC);
+        }
+        else
+        {
+            chunk_put(bytes[i]);
+        }
+    }
+
+    chunk_put(KISS_FEND);
+}
+
+
+/**
+ * kiss_rx_isr: UART receive callback. Copies the bytes into the RX ring
+ * and wakes the RX task; never decodes.
+ * @param buf the bytes received
+ * @param len how many
+ * @param pxTaskWoken set if a higher priority task was woken
+ */
+
+static void kiss_rx_isr(uint8_t * buf, int len, void * pxTaskWoken)
+{
+    uint32_t head = kiss.rx_head;
+    uint32_t fill = head - kiss.rx_tail;
+    uint32_t room = KISS_RX_RING - fill;
+
+    if ((uint32_t) len > room)
+    {
+        kiss.counters[KISS_RX_OVERRUNS] += len - room;
+        len = room;
+    }
+
+    while (len-- > 0)
+    {
+        kiss.rx[head++ & (KISS_RX_RING - 1)] = *buf++;
+    }
+
+    if (head - kiss.rx_tail > kiss.counters[KISS_RX_PEAK])
+    {
+        kiss.counters[KISS_RX_PEAK] = head - kiss.rx_tail;
+    }
+
+    /* The bytes must be written before the RX task can see them */
+    __sync_synchronize();
+    kiss.rx_head = head;
+
+    if (kiss.receiver != NULL)
+    {
+        vTaskNotifyGiveFromISR(kiss.receiver, pxTaskWoken);
+    }
+}
+
+
+/**
+ * kiss_init: set up the KISS interface with frame-level transmit and
+ * deferred receive, and take over the UART's receive callback. The UART
+ * must already be initialized.
+ * @param iface the interface to set up
+ * @param handle the KISS driver state
+ * @param uart the UART carrying KISS
+ */
+
+void kiss_init(csp_iface_t * iface, csp_kiss_handle_t * handle, KUARTNum uart)
+{
+    csp_thread_handle_t thread;
+
+    kiss.iface = iface;
+    kiss.uart = uart;
+    kiss.frames = csp_queue_create(KISS_TX_QUEUE_LEN, sizeof(csp_packet_t *));
+
+    csp_kiss_init(iface, handle, usart_putc, usart_insert, "KISS");
+    iface->nexthop = kiss_tx;
+
+    csp_thread_create(kiss_tx_thread, "KISS_TX", 1000, NULL, 0, &thread);
+    csp_thread_create(kiss_rx_thread, "KISS_RX", 1000, NULL, 0, &thread);
+
+    usart_set_callback(kiss_rx_isr);
+}
+
+
+/**
+ * kiss_counter: read one of the link counters.
+ * @param counter the counter to read
+ * @return its value since boot
+ */
+
+uint32_t kiss_counter(kiss_counter_t counter)
+{
+    return kiss.counters[counter];
+}
+
+
+CSP_DEFINE_TASK(kiss_tx_thread)
+{
+    csp_packet_t * packet;
+
+    while (1)
+    {
+        if (csp_queue_dequeue(kiss.frames, &packet, CSP_MAX_DELAY) != CSP_QUEUE_OK)
+        {
+            continue;
+        }
+
+        kiss_frame(packet);
+        csp_buffer_free(packet);
+
+        /* Don't hold a frame's tail back while the queue is empty */
+        if (csp_queue_size(kiss.frames) == 0)
+        {
+            chunk_flush();
+        }
+    }
+}
+
+
+CSP_DEFINE_TASK(kiss_rx_thread)
+{
+    uint32_t head;
+    uint32_t tail;
+    uint32_t span;
+
+    kiss.receiver = xTaskGetCurrentTaskHandle();
+
+    while (1)
+    {
+        head = kiss.rx_head;
+        tail = kiss.rx_tail;
+
+        if (head == tail)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        __sync_synchronize();
+
+        /* Decode everything waiting, in at most two runs around the wrap */
+        span = KISS_RX_RING - (tail & (KISS_RX_RING - 1));
+        if (span > head - tail)
+        {
+            span = head - tail;
+        }
+
+        csp_kiss_rx(kiss.iface, kiss.rx + (tail & (KISS_RX_RING - 1)), span, NULL);
+
+        /* The bytes must be read before the callback can reuse them */
+        __sync_synchronize();
+        kiss.rx_tail = tail + span;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef KISS_H
+#define KISS_H
+
+#include <stdint.h>
+
+#include <csp/csp.h>
+#include <csp/interfaces/csp_if_kiss.h>
+#include <kubos-hal/uart.h>
+
+/* Frames that can wait for the UART behind the one being sent */
+#define KISS_TX_QUEUE_LEN YOTTA_CFG_CSP_KISS_TX_QUEUE
+
+/* Received bytes held for the KISS RX task; must be a power of two */
+#define KISS_RX_RING YOTTA_CFG_CSP_KISS_RX_RING
+
+/* Escaped bytes handed to the UART per write; the HAL's TX queue depth */
+#ifdef YOTTA_CFG_HARDWARE_UARTDEFAULTS_TXQUEUELEN
+#define KISS_TX_CHUNK YOTTA_CFG_HARDWARE_UARTDEFAULTS_TXQUEUELEN
+#else
+#define KISS_TX_CHUNK 128
+#endif
+
+/**
+ * Link counters, published as source ids SOURCE_LINK_BASE + kiss_counter_t,
+ * so only ever append.
+ */
+typedef enum {
+    /* Received bytes lost because the RX ring was full */
+    KISS_RX_OVERRUNS = 0,
+    /* Most bytes waiting in the RX ring at once */
+    KISS_RX_PEAK,
+    KISS_COUNTER_COUNT
+} kiss_counter_t;
+
+void kiss_init(csp_iface_t * iface, csp_kiss_handle_t * handle, KUARTNum uart);
+
+uint32_t kiss_counter(kiss_counter_t counter);
+
+CSP_DEFINE_TASK(kiss_tx_thread);
+
+CSP_DEFINE_TASK(kiss_rx_thread);
+
+#endif
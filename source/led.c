@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "led.h"
+
+#include <stdint.h>
+#include <csp/arch/csp_queue.h>
+#include <kubos-hal/gpio.h>
+#include <FreeRTOS.h>
+#include <timers.h>
+
+/**
+ * LED status indicator. Callers queue a pattern for a pin and return at
+ * once; a FreeRTOS software timer picks the requests up and steps every
+ * pin's pattern, so no task ever sleeps to light an LED.
+ */
+
+typedef struct {
+    int pin;
+    led_pattern_t pattern;
+} led_request_t;
+
+/* Bit n of steps is the LED state for step n of the pattern */
+static const struct {
+    uint32_t steps;
+    uint8_t length;
+    bool repeat;
+} patterns[LED_PATTERN_COUNT] = {
+    [LED_BLINK] = { 0x01, 1, false },
+    [LED_TRIPLE] = { 0x15, 5, false },
+    [LED_HEARTBEAT] = { 0x05, 1000 / LED_STEP_MS, true },
+    [LED_OFF] = { 0x00, 1, false },
+};
+
+static struct {
+    bool active;
+    led_pattern_t pattern;
+    uint8_t step;
+} pins[K_NUM_PINS];
+
+static csp_queue_handle_t requests;
+static TimerHandle_t timer;
+
+
+/**
+ * led_step: timer callback. Starts any queued patterns, then moves every
+ * running pattern on by one step. Runs in the timer task, so it must not
+ * block.
+ */
+
+static void led_step(TimerHandle_t handle)
+{
+    led_request_t request;
+    int pin;
+
+    (void) handle;
+
+    while (csp_queue_dequeue(requests, &request, 0) == CSP_QUEUE_OK)
+    {
+        pins[request.pin].pattern = request.pattern;
+        pins[request.pin].step = 0;
+        pins[request.pin].active = true;
+    }
+
+    for (pin = 0; pin < K_NUM_PINS; pin++)
+    {
+        if (!pins[pin].active)
+        {
+            continue;
+        }
+
+        if (pins[pin].step == patterns[pins[pin].pattern].length)
+        {
+            if (!patterns[pins[pin].pattern].repeat)
+            {
+                k_gpio_write(pin, 0);
+                pins[pin].active = false;
+                continue;
+            }
+            pins[pin].step = 0;
+        }
+
+        k_gpio_write(pin, (patterns[pins[pin].pattern].steps >> pins[pin].step) & 1);
+        pins[pin].step++;
+    }
+}
+
+
+/**
+ * led_init: create the request queue and start the LED timer. The pins
+ * must already be set up as outputs.
+ */
+
+void led_init(void)
+{
+    requests = csp_queue_create(LED_QUEUE_LEN, sizeof(led_request_t));
+
+    timer = xTimerCreate("LED", pdMS_TO_TICKS(LED_STEP_MS), pdTRUE, NULL, led_step);
+    xTimerStart(timer, 0);
+}
+
+
+/**
+ * led_request: show a pattern on an LED, replacing whatever it was
+ * showing. Never blocks.
+ * @param pin the LED's pin, e.g. K_LED_RED
+ * @param pattern the pattern to show
+ * @return false if the request queue was full and the request was dropped
+ */
+
+bool led_request(int pin, led_pattern_t pattern)
+{
+    led_request_t request = { .pin = pin, .pattern = pattern };
+
+    if (requests == NULL || pin < 0 || pin >= K_NUM_PINS)
+    {
+        return false;
+    }
+
+    return csp_queue_enqueue(requests, &request, 0) == CSP_QUEUE_OK;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LED_H
+#define LED_H
+
+#include <stdbool.h>
+
+/* LED patterns are stepped this often */
+#define LED_STEP_MS 50
+
+/* Requests that can wait for the LED timer */
+#define LED_QUEUE_LEN 8
+
+typedef enum {
+    /* One short flash */
+    LED_BLINK = 0,
+    /* Three short flashes, e.g. while calibration is reloaded */
+    LED_TRIPLE,
+    /* Two flashes every second until another pattern replaces it */
+    LED_HEARTBEAT,
+    LED_OFF,
+    LED_PATTERN_COUNT
+} led_pattern_t;
+
+void led_init(void);
+
+bool led_request(int pin, led_pattern_t pattern);
+
+#endif
@@ -13,8 +13,20 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include "misc.h"
+#include "archive.h"
+#include "capture.h"
+#include "channels.h"
+#include "command.h"
+#include "disk.h"
+#include "downlink.h"
+#include "fanout.h"
+#include "journal.h"
+#include "kiss.h"
+#include "led.h"
+#include "prof.h"
+#include "schedule.h"
 #include "sensor.h"
+#include "xfer.h"
 
 #include <csp/csp.h>
 #include <csp/drivers/usart.h>
@@ -25,8 +37,6 @@
 #include <telemetry/config.h>
 #include <telemetry-aggregator/aggregator.h>
 
-#define LOG_NODE_ADDRESS YOTTA_CFG_CSP_LOG_NODE_ADDRESS
-#define LOG_NODE_PORT YOTTA_CFG_CSP_PORT
 #define CSP_UART_BAUDRATE YOTTA_CFG_CSP_BAUDRATE
 #define CSP_UART_BUS YOTTA_CFG_CSP_UART_BUS
 
@@ -34,60 +44,263 @@ static csp_iface_t csp_if_kiss;
 static csp_kiss_handle_t csp_kiss_driver;
 
 
-CSP_DEFINE_TASK(csp_uart_sender)
+/**
+ * drain_journal: send one frame's worth of the oldest journaled telemetry.
+ * Packets only leave the journal once CSP has taken the frame.
+ * @param link the link to send on
+ * @return true if a frame was sent
+ */
+
+static bool drain_journal(downlink_link_t * link)
 {
+    telemetry_packet packets[DOWNLINK_BATCH_CAPACITY];
+    downlink_batch_t backlog;
+    uint8_t count;
+    uint8_t i;
+
+    if ((count = journal_peek(packets, DOWNLINK_BATCH_CAPACITY)) == 0)
+    {
+        return false;
+    }
+
+    downlink_batch_init(&backlog);
+    for (i = 0; i < count; i++)
+    {
+        downlink_batch_add(&backlog, &packets[i]);
+    }
+
+    if (!downlink_send(link, &backlog))
+    {
+        return false;
+    }
 
-    /* Create socket without any socket options */
-    csp_socket_t *sock = csp_socket(CSP_SO_NONE);
+    journal_consume(count);
 
-    /* Bind all ports to socket */
-    csp_bind(sock, CSP_ANY);
+    return true;
+}
 
-    /* Create 10 connections backlog queue */
-    csp_listen(sock, 10);
 
-    /* Pointer to current connection and packet */
-    /* The output connection is over UART */
-    csp_conn_t *output_connection;
-    csp_packet_t* csp_packet;
-    telemetry_packet read_packet;
-    telemetry_conn tel_conn;
-    
-    /* Subscribe to all telemetry publishers */
-    while (!telemetry_subscribe(&tel_conn, 0x0))  
+/**
+ * drain_capture: send one frame's worth of a frozen capture window.
+ * Samples only leave the window once CSP has taken the frame; a capture
+ * that can't be sent waits for the link rather than going to the journal.
+ * @param link the link to send on
+ * @return true if a frame was sent
+ */
+
+static bool drain_capture(downlink_link_t * link)
+{
+    telemetry_packet packets[DOWNLINK_BATCH_CAPACITY];
+    downlink_batch_t burst;
+    uint8_t count;
+    uint8_t i;
+
+    if ((count = capture_peek(packets, DOWNLINK_BATCH_CAPACITY)) == 0)
+    {
+        return false;
+    }
+
+    downlink_batch_init(&burst);
+    for (i = 0; i < count; i++)
     {
-        /* Retry subscribing every 5 ms */
-        csp_sleep_ms(5);
+        downlink_batch_add(&burst, &packets[i]);
     }
 
-     while (1)
-     {
-         if(telemetry_read(tel_conn, &read_packet))
-         /* A packet has been read in from telemetry */
-         {
-            csp_packet = csp_buffer_get(20);
-            if (csp_packet != NULL)
+    if (!downlink_send(link, &burst))
+    {
+        return false;
+    }
+
+    capture_consume(count);
+
+    return true;
+}
+
+
+/**
+ * next_wakeup: work out how long the log node task can sleep if no frame
+ * comes in.
+ * @return ms until the backlog needs attention
+ */
+
+static uint32_t next_wakeup(const downlink_link_t * link)
+{
+    uint32_t now = csp_get_ms();
+
+    if (journal_empty() && !capture_pending())
+    {
+        return DOWNLINK_WAIT_FOREVER;
+    }
+
+    /* Keep draining while connected, else wake for the next reconnect */
+    if (link->conn != NULL || (int32_t)(link->retry_at - now) <= 0)
+    {
+        return 0;
+    }
+
+    return link->retry_at - now;
+}
+
+
+/**
+ * deliver_frame: send a live frame to the log node, or journal its
+ * packets if it isn't sent, including a delta the ground can't follow.
+ */
+
+static void deliver_frame(downlink_link_t * link, const fanout_frame_t * frame)
+{
+    uint8_t i;
+
+    /* Live telemetry queues behind any backlog to stay in order */
+    if (journal_empty() && fanout_send(FANOUT_LOG_NODE, link, frame))
+    {
+        led_request(K_LED_RED, LED_BLINK);
+        led_request(K_LED_BLUE, LED_BLINK);
+        return;
+    }
+
+    for (i = 0; i < frame->batch.count; i++)
+    {
+        journal_append(&frame->batch.packets[i]);
+    }
+
+    /* Later live deltas build on this frame, which went to the backlog */
+    link->resync |= DOWNLINK_RESYNC(ENCODE_STREAM_LIVE);
+}
+
+
+CSP_DEFINE_TASK(log_node_thread)
+{
+    /* The output connection is over UART and kept open between frames */
+    downlink_link_t link;
+    fanout_frame_t * frame;
+
+    downlink_link_init(&link, fanout_address(FANOUT_LOG_NODE), fanout_port(FANOUT_LOG_NODE));
+
+    /* Telemetry that can't be sent is kept on the SD card */
+    journal_open();
+
+    /* Live frames from the sender wake this thread up */
+    fanout_attach(FANOUT_LOG_NODE);
+
+    while (1)
+    {
+        /* Sleep until a frame arrives or the backlog is due */
+        downlink_wait(next_wakeup(&link));
+
+        while ((frame = fanout_take(FANOUT_LOG_NODE, &link)) != NULL)
+        {
+            deliver_frame(&link, frame);
+            fanout_release(frame);
+        }
+
+        /* Catch up on the backlog while the link is up */
+        if (!journal_empty() && downlink_link_up(&link, csp_get_ms()))
+        {
+            if (!drain_journal(&link))
+            {
+                /* Out of CSP buffers; give them a moment instead of spinning */
+                downlink_wait(DOWNLINK_BACKOFF_MIN);
+            }
+        }
+        /* A frozen capture goes last, in the gaps between live frames */
+        else if (capture_pending() && downlink_link_up(&link, csp_get_ms()))
+        {
+            if (!drain_capture(&link))
             {
-                memcpy(csp_packet->data, &read_packet, sizeof(telemetry_packet));
-                csp_packet->length = sizeof(telemetry_packet);
-                output_connection = csp_connect(CSP_PRIO_NORM, LOG_NODE_ADDRESS, LOG_NODE_PORT, 100, CSP_O_NONE);
-
-                if (output_connection != NULL)
-                {
-                    csp_send(output_connection, csp_packet, 100);
-                    blink(K_LED_RED);
-                    blink(K_LED_BLUE);
-                    csp_buffer_free(csp_packet);
-                }
+                downlink_wait(DOWNLINK_BACKOFF_MIN);
             }
         }
-        csp_close(output_connection);
+
+        /* Back to live frames: ask for a keyframe before one is skipped */
+        if (journal_empty() && link.conn != NULL &&
+            (link.resync & DOWNLINK_RESYNC(ENCODE_STREAM_LIVE)))
+        {
+            fanout_resync(FANOUT_LOG_NODE);
+        }
+    }
+}
+
+
+/**
+ * next_flush: work out how long the sender can sleep if no sample comes in.
+ * @return ms until the batch is due
+ */
+
+static uint32_t next_flush(const downlink_batch_t * batch)
+{
+    uint32_t now = csp_get_ms();
+    uint32_t due;
+
+    if (batch->count == 0)
+    {
+        return DOWNLINK_WAIT_FOREVER;
+    }
+
+    due = batch->opened + DOWNLINK_MAX_LATENCY;
+    if ((int32_t)(due - now) <= 0)
+    {
+        return 0;
+    }
+
+    return due - now;
+}
+
+
+/**
+ * flush_batch: hand a batch to every downlink destination and archive it.
+ */
+
+static void flush_batch(downlink_batch_t * batch)
+{
+    uint8_t i;
+
+    /* Encoded once, however many destinations there are */
+    fanout_publish(batch);
+
+    /* Everything is archived too, so the ground can fetch what it missed */
+    for (i = 0; i < batch->count; i++)
+    {
+        archive_append(&batch->packets[i]);
     }
+
+    downlink_batch_init(batch);
 }
 
 
-void local_usart_rx(uint8_t * buf, int len, void * pxTaskWoken) {
-    csp_kiss_rx(&csp_if_kiss, buf, len, pxTaskWoken);
+CSP_DEFINE_TASK(csp_uart_sender)
+{
+    telemetry_packet read_packet;
+    downlink_batch_t batch;
+
+    downlink_batch_init(&batch);
+
+    archive_open();
+
+    /* Samples from the aggregator wake this thread up */
+    downlink_attach();
+
+    while (1)
+    {
+        /* Sleep until a sample arrives or the batch is due */
+        downlink_wait(next_flush(&batch));
+
+        while (downlink_receive(&read_packet))
+        {
+            downlink_batch_add(&batch, &read_packet);
+
+            if (downlink_batch_ready(&batch, csp_get_ms()))
+            {
+                flush_batch(&batch);
+            }
+        }
+
+        /* Flush once the oldest sample is due */
+        if (downlink_batch_ready(&batch, csp_get_ms()))
+        {
+            flush_batch(&batch);
+        }
+    }
 }
 
 
@@ -100,25 +313,50 @@ int main(void) {
     k_gpio_init(K_LED_RED, K_GPIO_OUTPUT, K_GPIO_PULL_NONE);
     k_gpio_init(K_LED_BLUE, K_GPIO_OUTPUT, K_GPIO_PULL_NONE);
 
+    /* Status LEDs are driven from a timer; green shows the node is alive */
+    led_init();
+    led_request(K_LED_GREEN, LED_HEARTBEAT);
+
     /* Do all of the CSP setup things*/
     struct usart_conf conf;
     char dev = (char)CSP_UART_BUS;
     conf.device = &dev;
-    conf.baudrate = CSP_UART_BUS;
+    conf.baudrate = CSP_UART_BAUDRATE;
     usart_init(&conf);
 
-    /* Init kiss interface */
-    csp_kiss_init(&csp_if_kiss, &csp_kiss_driver, usart_putc, usart_insert, "KISS");
+    /* Init kiss interface; frames are sent and decoded by their own tasks */
+    kiss_init(&csp_if_kiss, &csp_kiss_driver, CSP_UART_BUS);
 
-    /* Setup callback from USART RX to KISS RS */
-    /* This is needed if we use CSP's RDP packets - Otherwise we don't need it as we're only sending, not receiving packets */
-    usart_set_callback(local_usart_rx);
+    /* The SD card is shared by the calibration, log node and sender threads */
+    disk_init();
+
+    /* The journal is filled by the sender and drained by the log node */
+    journal_init();
 
     /* Initialize the telemetry_system */
     telemetry_init();
     
-    /* Set to route through KISS / UART */
-    csp_route_set(LOG_NODE_ADDRESS, &csp_if_kiss, CSP_NODE_MAC);
+    /* Every downlink destination is routed through KISS / UART */
+    uint8_t dest;
+    for (dest = 0; dest < FANOUT_DESTINATIONS; dest++)
+    {
+        csp_route_set(fanout_address(dest), &csp_if_kiss, CSP_NODE_MAC);
+    }
+
+    /* Live telemetry is queued to a task per destination */
+    fanout_init();
+
+    /* Start the stage timers published as telemetry */
+    prof_init();
+
+    /* Sensor transfers are queued to their own task */
+    xfer_init();
+
+    /* Work out when each source group is sampled */
+    schedule_init();
+
+    /* The ground can change the schedule and turn sources off at run time */
+    channels_init();
 
     /* Init telemetry-aggregator thread */
     INIT_AGGREGATOR_THREAD;
@@ -127,6 +365,18 @@ int main(void) {
     csp_thread_handle_t handle_calibrate_thread;
     csp_thread_create(calibrate_thread, "CALIBRATE", 1000, NULL, 0, &handle_calibrate_thread);
 
+    /* Init the ground command service */
+    csp_thread_handle_t handle_command;
+    csp_thread_create(command_thread, "COMMAND", 1000, NULL, 0, &handle_command);
+
+    /* Init the archive query service */
+    csp_thread_handle_t handle_archive;
+    csp_thread_create(archive_thread, "ARCHIVE", 1000, NULL, 0, &handle_archive);
+
+    /* Init the log node thread, which also sends the journal and captures */
+    csp_thread_handle_t handle_log_node;
+    csp_thread_create(log_node_thread, "LOG_NODE", 1000, NULL, 0, &handle_log_node);
+
     /* Init the CSP UART thread */
     csp_thread_handle_t handle_csp_uart_sender;
     csp_thread_create(csp_uart_sender, "CSP_SENDER", 1000, NULL, 0, &handle_csp_uart_sender);
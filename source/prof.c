@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "downlink.h"
+#include "kiss.h"
+#include "prof.h"
+#include "sources.h"
+#include "xfer.h"
+
+#include <stdbool.h>
+#include <csp/arch/csp_time.h>
+
+#if defined(__arm__)
+#define PROF_DEMCR (*(volatile uint32_t *) 0xE000EDFC)
+#define PROF_DEMCR_TRCENA (1 << 24)
+#define PROF_DWT_CTRL (*(volatile uint32_t *) 0xE0001000)
+#define PROF_DWT_CTRL_CYCCNTENA (1 << 0)
+#endif
+
+/**
+ * Running statistics of one stage since it was last published, in
+ * prof_now ticks. Each stage is timed from one thread, so updates are
+ * not locked. The publisher only reads and asks the timing thread to
+ * start over, which keeps a torn read to at most one sample off.
+ */
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t count;
+    volatile bool reset;
+} prof_stats_t;
+
+static prof_stats_t stats[PROF_STAGE_COUNT];
+static uint32_t published;
+static uint32_t bus_busy[XFER_CLIENT_COUNT];
+
+
+/**
+ * prof_init: start the cycle counter. Must run before the scheduler.
+ */
+
+void prof_init(void)
+{
+#if PROF_ENABLED && defined(__arm__)
+    PROF_DEMCR |= PROF_DEMCR_TRCENA;
+    PROF_CYCCNT = 0;
+    PROF_DWT_CTRL |= PROF_DWT_CTRL_CYCCNTENA;
+#endif
+    published = csp_get_ms();
+}
+
+
+/**
+ * prof_end: add one timed run of a stage to its statistics.
+ * @param stage the stage that ran
+ * @param start prof_now() when the stage started
+ */
+
+void prof_end(prof_stage_t stage, uint32_t start)
+{
+#if PROF_ENABLED
+    uint32_t elapsed = prof_now() - start;
+    prof_stats_t * s = &stats[stage];
+
+    if (s->reset || s->count == 0)
+    {
+        s->min = elapsed;
+        s->max = elapsed;
+        s->sum = 0;
+        s->count = 0;
+        s->reset = false;
+    }
+
+    if (elapsed < s->min)
+    {
+        s->min = elapsed;
+    }
+    if (elapsed > s->max)
+    {
+        s->max = elapsed;
+    }
+    s->sum += elapsed;
+    s->count++;
+#endif
+}
+
+
+static void submit_stat(prof_stage_t stage, prof_stat_t stat, uint32_t ticks)
+{
+    telemetry_source source = {
+        .source_id = SOURCE_PROF_BASE + 3 * stage + stat,
+        .data_type = TELEMETRY_TYPE_INT
+    };
+
+    downlink_submit(source, ticks / PROF_TICKS_PER_US);
+}
+
+
+/**
+ * publish_bus: submit how much of the last interval each bus client held
+ * the sensor bus for, in tenths of a percent.
+ * @param interval ms since the last publish
+ */
+
+static void publish_bus(uint32_t interval)
+{
+    telemetry_source source = { .data_type = TELEMETRY_TYPE_INT };
+    xfer_client_t client;
+    uint32_t busy;
+
+    for (client = 0; client < XFER_CLIENT_COUNT; client++)
+    {
+        busy = xfer_busy_us(client);
+        source.source_id = SOURCE_BUS_BASE + client;
+        downlink_submit(source, (busy - bus_busy[client]) / interval);
+        bus_busy[client] = busy;
+    }
+}
+
+
+/**
+ * publish_link: submit the KISS link counters.
+ */
+
+static void publish_link(void)
+{
+    telemetry_source source = { .data_type = TELEMETRY_TYPE_INT };
+    kiss_counter_t counter;
+
+    for (counter = 0; counter < KISS_COUNTER_COUNT; counter++)
+    {
+        source.source_id = SOURCE_LINK_BASE + counter;
+        downlink_submit(source, kiss_counter(counter));
+    }
+}
+
+
+/**
+ * prof_publish: every PROF_INTERVAL ms, submit the min, max and mean time
+ * in us of each stage that ran since the last time, and start over, the
+ * bus occupancy of each bus client and the link counters. Must be called
+ * from the aggregator thread, like downlink_submit.
+ */
+
+void prof_publish(void)
+{
+#if PROF_ENABLED
+    prof_stage_t stage;
+    prof_stats_t * s;
+    uint32_t now = csp_get_ms();
+
+    if (now - published < PROF_INTERVAL)
+    {
+        return;
+    }
+    publish_bus(now - published);
+    publish_link();
+    published = now;
+
+    for (stage = 0; stage < PROF_STAGE_COUNT; stage++)
+    {
+        s = &stats[stage];
+        if (s->reset || s->count == 0)
+        {
+            continue;
+        }
+
+        submit_stat(stage, PROF_MIN, s->min);
+        submit_stat(stage, PROF_MAX, s->max);
+        submit_stat(stage, PROF_MEAN, (uint32_t)(s->sum / s->count));
+
+        s->reset = true;
+    }
+#endif
+}
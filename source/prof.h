@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+#define PROF_ENABLED YOTTA_CFG_TELEMETRY_PROFILE_ENABLED
+#define PROF_INTERVAL YOTTA_CFG_TELEMETRY_PROFILE_INTERVAL
+
+/**
+ * Timed stages of the sample and downlink paths. The statistics of a
+ * stage are published as source ids SOURCE_PROF_BASE + 3 * stage +
+ * PROF_MIN, PROF_MAX and PROF_MEAN, so only ever append.
+ */
+typedef enum {
+    /* Time a transaction waits for the sensor bus, was the bno_lock wait */
+    PROF_BUS_WAIT = 0,
+    PROF_BNO_READ,
+    PROF_HTU_TEMP,
+    PROF_HTU_HUM,
+    PROF_LOAD_CALIB,
+    PROF_SUBMIT,
+    PROF_BUFFER_GET,
+    PROF_CONNECT,
+    PROF_SEND,
+    PROF_STAGE_COUNT
+} prof_stage_t;
+
+typedef enum {
+    PROF_MIN = 0,
+    PROF_MAX,
+    PROF_MEAN
+} prof_stat_t;
+
+#if defined(__arm__)
+
+/* Cortex-M DWT cycle counter, free-running once prof_init has run */
+#define PROF_CYCCNT (*(volatile uint32_t *) 0xE0001004)
+
+/* Core clock in Hz, from CMSIS */
+extern uint32_t SystemCoreClock;
+#define PROF_TICKS_PER_US (SystemCoreClock / 1000000)
+
+static inline uint32_t prof_now(void)
+{
+    return PROF_CYCCNT;
+}
+
+#else
+
+#include <time.h>
+
+#define PROF_TICKS_PER_US 1000
+
+/* Host builds count nanoseconds of the monotonic clock instead */
+static inline uint32_t prof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+#endif
+
+void prof_init(void);
+
+void prof_end(prof_stage_t stage, uint32_t start);
+
+void prof_publish(void);
+
+#endif
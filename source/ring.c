@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ring.h"
+
+
+/**
+ * ring_push: add a packet. Producer side only.
+ * @param ring the ring
+ * @param packet the packet to add
+ * @return false if the ring was full and the packet was dropped
+ */
+
+bool ring_push(packet_ring_t * ring, const telemetry_packet * packet)
+{
+    uint32_t head = ring->head;
+
+    if (head - ring->tail >= RING_SIZE)
+    {
+        ring->dropped++;
+        return false;
+    }
+
+    ring->slots[head & (RING_SIZE - 1)] = *packet;
+
+    /* The slot must be written before the consumer can see it */
+    __sync_synchronize();
+    ring->head = head + 1;
+
+    return true;
+}
+
+
+/**
+ * ring_pop: take the oldest packet. Consumer side only.
+ * @param ring the ring
+ * @param packet where to copy the packet
+ * @return false if the ring was empty
+ */
+
+bool ring_pop(packet_ring_t * ring, telemetry_packet * packet)
+{
+    uint32_t tail = ring->tail;
+
+    if (tail == ring->head)
+    {
+        return false;
+    }
+
+    __sync_synchronize();
+    *packet = ring->slots[tail & (RING_SIZE - 1)];
+
+    /* The slot must be read before the producer can reuse it */
+    __sync_synchronize();
+    ring->tail = tail + 1;
+
+    return true;
+}
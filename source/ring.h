@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <telemetry/telemetry.h>
+
+/* Must be a power of two */
+#define RING_SIZE YOTTA_CFG_TELEMETRY_RING_SIZE
+
+#if RING_SIZE & (RING_SIZE - 1)
+#error "telemetry.ring_size must be a power of two"
+#endif
+
+/**
+ * Lock-free single-producer, single-consumer ring of telemetry packets.
+ * Only the producer moves head and only the consumer moves tail, so no
+ * lock is needed as long as there is exactly one of each.
+ */
+typedef struct {
+    telemetry_packet slots[RING_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t dropped;
+} packet_ring_t;
+
+bool ring_push(packet_ring_t * ring, const telemetry_packet * packet);
+
+bool ring_pop(packet_ring_t * ring, telemetry_packet * packet);
+
+#endif
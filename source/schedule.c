@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "schedule.h"
+#include "sources.h"
+
+#include <stdbool.h>
+
+/* Period and phase of each group in ms, from config.json */
+static const struct {
+    uint32_t period;
+    uint32_t phase;
+} group_config[GROUP_COUNT] = {
+    [GROUP_HTU] = { YOTTA_CFG_TELEMETRY_SCHEDULE_HTU21D_PERIOD,
+                    YOTTA_CFG_TELEMETRY_SCHEDULE_HTU21D_PHASE },
+    [GROUP_QUAT] = { YOTTA_CFG_TELEMETRY_SCHEDULE_QUATERNION_PERIOD,
+                     YOTTA_CFG_TELEMETRY_SCHEDULE_QUATERNION_PHASE },
+    [GROUP_EULER] = { YOTTA_CFG_TELEMETRY_SCHEDULE_EULER_PERIOD,
+                      YOTTA_CFG_TELEMETRY_SCHEDULE_EULER_PHASE },
+    [GROUP_GRAVITY] = { YOTTA_CFG_TELEMETRY_SCHEDULE_GRAVITY_PERIOD,
+                        YOTTA_CFG_TELEMETRY_SCHEDULE_GRAVITY_PHASE },
+    [GROUP_LINEAR] = { YOTTA_CFG_TELEMETRY_SCHEDULE_LINEAR_ACCEL_PERIOD,
+                       YOTTA_CFG_TELEMETRY_SCHEDULE_LINEAR_ACCEL_PHASE },
+    [GROUP_ACCEL] = { YOTTA_CFG_TELEMETRY_SCHEDULE_ACCEL_PERIOD,
+                      YOTTA_CFG_TELEMETRY_SCHEDULE_ACCEL_PHASE },
+};
+
+/* The group each source is sampled with */
+static const uint8_t source_group[SOURCE_COUNT] = {
+    [SOURCE_TEMP] = GROUP_HTU, [SOURCE_HUM] = GROUP_HTU,
+    [SOURCE_QUAT_W] = GROUP_QUAT, [SOURCE_QUAT_X] = GROUP_QUAT,
+    [SOURCE_QUAT_Y] = GROUP_QUAT, [SOURCE_QUAT_Z] = GROUP_QUAT,
+    [SOURCE_EUL_X] = GROUP_EULER, [SOURCE_EUL_Y] = GROUP_EULER, [SOURCE_EUL_Z] = GROUP_EULER,
+    [SOURCE_GRAV_X] = GROUP_GRAVITY, [SOURCE_GRAV_Y] = GROUP_GRAVITY,
+    [SOURCE_GRAV_Z] = GROUP_GRAVITY,
+    [SOURCE_LIN_X] = GROUP_LINEAR, [SOURCE_LIN_Y] = GROUP_LINEAR, [SOURCE_LIN_Z] = GROUP_LINEAR,
+    [SOURCE_ACC_X] = GROUP_ACCEL, [SOURCE_ACC_Y] = GROUP_ACCEL, [SOURCE_ACC_Z] = GROUP_ACCEL,
+};
+
+/* Period and phase of each group in ticks */
+static struct {
+    uint32_t period;
+    uint32_t phase;
+} groups[GROUP_COUNT];
+
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    uint32_t t;
+
+    while (b != 0)
+    {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+
+/**
+ * collides: two periodic groups ever land on the same tick exactly when
+ * their phases agree modulo the gcd of their periods.
+ */
+
+static bool collides(schedule_group_t a, uint32_t phase, schedule_group_t b)
+{
+    uint32_t g = gcd(groups[a].period, groups[b].period);
+
+    return (phase % g) == (groups[b].phase % g);
+}
+
+
+/**
+ * assign_phase: start from the configured phase and move the group later
+ * until none of its reads share a tick with an earlier group's, so the
+ * per-tick bus time stays that of one group. If no phase is free the
+ * configured one is kept and coinciding BNO055 groups share a burst read.
+ * Only one repeat of the collision pattern is searched, so the time this
+ * takes on the aggregator thread doesn't grow with the period.
+ */
+
+static void assign_phase(schedule_group_t group)
+{
+    uint32_t span = 1;
+    uint32_t offset;
+    uint32_t phase;
+    uint32_t g;
+    schedule_group_t other;
+
+    /*
+     * Collisions only depend on the phase modulo each gcd, so they repeat
+     * every lcm of the gcds, which divides the period. A gcd of 1 means
+     * the other group shares a tick with every phase.
+     */
+    for (other = 0; other < group; other++)
+    {
+        g = gcd(groups[group].period, groups[other].period);
+        if (g == 1)
+        {
+            return;
+        }
+        span = span / gcd(span, g) * g;
+    }
+
+    for (offset = 0; offset < span; offset++)
+    {
+        phase = (groups[group].phase + offset) % groups[group].period;
+
+        for (other = 0; other < group; other++)
+        {
+            if (collides(group, phase, other))
+            {
+                break;
+            }
+        }
+
+        if (other == group)
+        {
+            groups[group].phase = phase;
+            return;
+        }
+    }
+}
+
+
+/**
+ * schedule_init: convert the configured periods and phases to ticks and
+ * spread the groups out over the bus.
+ */
+
+void schedule_init(void)
+{
+    uint32_t period[GROUP_COUNT];
+
+    schedule_defaults(period);
+    schedule_set_periods(period);
+}
+
+
+/**
+ * schedule_defaults: get the periods configured in config.json.
+ * @param period where to store the period of each group, in ms
+ */
+
+void schedule_defaults(uint32_t period[GROUP_COUNT])
+{
+    schedule_group_t group;
+
+    for (group = 0; group < GROUP_COUNT; group++)
+    {
+        period[group] = group_config[group].period;
+    }
+}
+
+
+/**
+ * schedule_set_periods: change the period of every group, keeping the
+ * configured phases, and spread the groups out over the bus again. Must
+ * only be called from the aggregator thread, like schedule_due.
+ * @param period the period of each group, in ms
+ */
+
+void schedule_set_periods(const uint32_t period[GROUP_COUNT])
+{
+    schedule_group_t group;
+
+    for (group = 0; group < GROUP_COUNT; group++)
+    {
+        groups[group].period = period[group] / SCHEDULE_TICK;
+        if (groups[group].period == 0)
+        {
+            groups[group].period = 1;
+        }
+        groups[group].phase = (group_config[group].phase / SCHEDULE_TICK) % groups[group].period;
+
+        assign_phase(group);
+    }
+}
+
+
+/**
+ * schedule_due: find the groups to sample on a tick.
+ * @param tick the number of ticks since start
+ * @return GROUP_BIT of every group due
+ */
+
+uint32_t schedule_due(uint32_t tick)
+{
+    uint32_t due = 0;
+    schedule_group_t group;
+
+    for (group = 0; group < GROUP_COUNT; group++)
+    {
+        if (tick % groups[group].period == groups[group].phase)
+        {
+            due |= GROUP_BIT(group);
+        }
+    }
+
+    return due;
+}
+
+
+/**
+ * schedule_group_of: find the group a source is sampled with.
+ * @param source_id a source id below SOURCE_COUNT
+ * @return its schedule_group_t
+ */
+
+schedule_group_t schedule_group_of(uint8_t source_id)
+{
+    return source_group[source_id];
+}
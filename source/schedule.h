@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+
+/* user_aggregator runs once per tick */
+#define SCHEDULE_TICK YOTTA_CFG_TELEMETRY_AGGREGATOR_INTERVAL
+
+/* Longest group period the ground may set, in ms */
+#define SCHEDULE_PERIOD_MAX 60000
+
+/**
+ * Source groups sampled together, each at its own period. The BNO055
+ * groups map onto the SNAPSHOT_* vectors.
+ */
+typedef enum {
+    GROUP_HTU = 0,
+    GROUP_QUAT,
+    GROUP_EULER,
+    GROUP_GRAVITY,
+    GROUP_LINEAR,
+    GROUP_ACCEL,
+    GROUP_COUNT
+} schedule_group_t;
+
+#define GROUP_BIT(group) (1 << (group))
+
+void schedule_init(void);
+
+void schedule_defaults(uint32_t period[GROUP_COUNT]);
+
+void schedule_set_periods(const uint32_t period[GROUP_COUNT]);
+
+uint32_t schedule_due(uint32_t tick);
+
+schedule_group_t schedule_group_of(uint8_t source_id);
+
+#endif
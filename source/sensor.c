@@ -14,15 +14,68 @@
  * limitations under the License.
  */
 #include "disk.h"
-#include "misc.h"
+#include "led.h"
+#include "prof.h"
 #include "sensor.h"
 
+#include <stdio.h>
+#include <string.h>
 #include <kubos-hal/gpio.h>
+#include <kubos-hal/i2c.h>
 #include <kubos-core/modules/sensors/bno055.h>
 
+#define BNO055_I2C_BUS YOTTA_CFG_SENSORS_BNO055_I2C_BUS
 
-static bno055_offsets_t offsets;
-static bool offsets_set;
+/* Binary calibration record, see read_record in disk.c */
+#define CALIB_RECORD "CALIB"
+
+#define CALIB_PERIOD YOTTA_CFG_SENSORS_BNO055_CALIBRATION_PERIOD
+#define CALIB_RELOAD_CHECKS YOTTA_CFG_SENSORS_BNO055_CALIBRATION_RELOAD_CHECKS
+
+/* CALIB_STAT with system, gyro, accel and mag all at 3 */
+#define CALIB_STAT_FULL 0xFF
+
+/**
+ * The data registers run contiguously from ACC_DATA_X_LSB (0x08) to
+ * GRV_DATA_Z_MSB (0x33): accel, mag, gyro, euler, quaternion, linear
+ * accel and gravity, each axis a little-endian int16. SNAPSHOT_START and
+ * SNAPSHOT_LEN in sensor.h cover them.
+ */
+
+/* LSB per unit, from the datasheet's default UNIT_SEL */
+#define QUAT_SCALE (1.0 / (1 << 14))
+#define EULER_SCALE (1.0 / 16.0)
+#define ACCEL_SCALE (1.0 / 100.0)
+
+
+/**
+ * In-RAM copy of the calibration profile. It is filled from calib_profile
+ * the first time the sensor is set up, and the offsets are only written
+ * to the sensor while they are dirty. Only ever used from the bus task,
+ * in XFER_CALL transactions.
+ */
+static struct {
+    bno055_offsets_t offsets;
+    uint16_t version;
+    bool loaded;
+    bool dirty;
+} calib_cache;
+
+/**
+ * Profile read from the SD card by fetch_calibration, outside the bus.
+ * Written once before ready is set and only read by the bus task after.
+ */
+static struct {
+    bno055_offsets_t offsets;
+    volatile bool ready;
+} calib_profile;
+
+/* Offsets read out by the calibration monitor */
+typedef struct {
+    bno055_offsets_t offsets;
+    uint16_t version;   /* cache version of the last offsets that changed it */
+    bool changed;
+} calib_snapshot_t;
 
 /**
  * This code specifically interacts with the Bosch BNO055 
@@ -91,88 +144,355 @@ void displayCalStatus(void)
 }
 
 
-/** 
- * load_calibration: a function to load the calibration profile.
- * If it's the first time loading a value, mount the file system too.
- * @return ret, 
- */ 
+static int16_t snapshot_word(const uint8_t * block, uint8_t reg)
+{
+    const uint8_t * p = block + (reg - SNAPSHOT_START);
 
-KSensorStatus load_calibration(void)
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+
+static void snapshot_vector(const uint8_t * block, uint8_t reg, double scale,
+                            bno055_vector_data_t * vector)
 {
+    vector->x = snapshot_word(block, reg) * scale;
+    vector->y = snapshot_word(block, reg + 2) * scale;
+    vector->z = snapshot_word(block, reg + 4) * scale;
+}
 
-    KSensorStatus ret = SENSOR_ERROR;
-    static FATFS FatFs;
-    static FIL Fil;
-    uint16_t sd_stat = FR_OK;
 
-    /* Mount the file system if needed. */
-    if(!offsets_set)
+/* Where each snapshot vector sits in the data block */
+static const struct {
+    uint8_t mask;
+    uint8_t reg;
+    uint8_t len;
+} snapshot_spans[] = {
+    { SNAPSHOT_ACCEL, BNO055_ACCEL_DATA_X_LSB_ADDR, 6 },
+    { SNAPSHOT_EULER, BNO055_EULER_H_LSB_ADDR, 6 },
+    { SNAPSHOT_QUAT, BNO055_QUATERNION_DATA_W_LSB_ADDR, 8 },
+    { SNAPSHOT_LINEAR, BNO055_LINEAR_ACCEL_DATA_X_LSB_ADDR, 6 },
+    { SNAPSHOT_GRAVITY, BNO055_GRAVITY_DATA_X_LSB_ADDR, 6 },
+};
+
+
+/**
+ * bno055_snapshot_begin: queue a single I2C burst of the fusion data
+ * registers. The burst covers the smallest register range holding every
+ * requested vector; with SNAPSHOT_ALL it replaces one
+ * bno055_get_position plus four bno055_get_data_vector transactions.
+ * @param read the read to start; must stay valid until bno055_snapshot_end
+ * @param mask the SNAPSHOT_* vectors to read
+ * @return false if nothing was queued, in which case bno055_snapshot_end
+ *         must not be called
+ */
+
+bool bno055_snapshot_begin(bno055_snapshot_read_t * read, uint8_t mask)
+{
+    uint8_t start = SNAPSHOT_START + SNAPSHOT_LEN;
+    uint8_t end = SNAPSHOT_START;
+    uint8_t i;
+
+    for (i = 0; i < sizeof(snapshot_spans) / sizeof(snapshot_spans[0]); i++)
+    {
+        if (mask & snapshot_spans[i].mask)
+        {
+            if (snapshot_spans[i].reg < start)
+            {
+                start = snapshot_spans[i].reg;
+            }
+            if (snapshot_spans[i].reg + snapshot_spans[i].len > end)
+            {
+                end = snapshot_spans[i].reg + snapshot_spans[i].len;
+            }
+        }
+    }
+
+    if (start >= end)
     {
-        sd_stat = f_mount(&FatFs, "", 1);
+        return false;
     }
 
-    offsets_set = false;
+    read->mask = mask;
+    read->reg = start;
+    read->xfer.op = XFER_WRITE_READ;
+    read->xfer.client = XFER_CLIENT_SAMPLING;
+    read->xfer.bus = BNO055_I2C_BUS;
+    read->xfer.addr = BNO055_ADDRESS_A;
+    read->xfer.tx = &read->reg;
+    read->xfer.tx_len = 1;
+    read->xfer.rx = read->block + (start - SNAPSHOT_START);
+    read->xfer.rx_len = end - start;
+    read->xfer.done = NULL;
+
+    return xfer_submit(&read->xfer);
+}
+
+
+/**
+ * bno055_snapshot_end: wait for a snapshot read and decode the requested
+ * vectors from it.
+ * @param read the read started by bno055_snapshot_begin
+ * @param snapshot where to store the decoded vectors
+ * @return SENSOR_OK, or SENSOR_READ_ERROR if the transfer failed
+ */
+
+KSensorStatus bno055_snapshot_end(bno055_snapshot_read_t * read, bno055_snapshot_t * snapshot)
+{
+    const uint8_t * block = read->block;
+    uint8_t mask = read->mask;
 
-    if(sd_stat == FR_OK)
+    if (xfer_wait(&read->xfer) != I2C_OK)
     {
-        /* Open the calibration file */
-        if((sd_stat = open_file(&Fil, FA_READ | FA_OPEN_EXISTING)) == FR_OK)
+        return SENSOR_READ_ERROR;
+    }
+
+    if (mask & SNAPSHOT_QUAT)
+    {
+        snapshot->quat.w = snapshot_word(block, BNO055_QUATERNION_DATA_W_LSB_ADDR) * QUAT_SCALE;
+        snapshot->quat.x = snapshot_word(block, BNO055_QUATERNION_DATA_W_LSB_ADDR + 2) * QUAT_SCALE;
+        snapshot->quat.y = snapshot_word(block, BNO055_QUATERNION_DATA_W_LSB_ADDR + 4) * QUAT_SCALE;
+        snapshot->quat.z = snapshot_word(block, BNO055_QUATERNION_DATA_W_LSB_ADDR + 6) * QUAT_SCALE;
+    }
+    if (mask & SNAPSHOT_EULER)
+    {
+        snapshot_vector(block, BNO055_EULER_H_LSB_ADDR, EULER_SCALE, &snapshot->euler);
+    }
+    if (mask & SNAPSHOT_GRAVITY)
+    {
+        snapshot_vector(block, BNO055_GRAVITY_DATA_X_LSB_ADDR, ACCEL_SCALE, &snapshot->gravity);
+    }
+    if (mask & SNAPSHOT_LINEAR)
+    {
+        snapshot_vector(block, BNO055_LINEAR_ACCEL_DATA_X_LSB_ADDR, ACCEL_SCALE, &snapshot->linear);
+    }
+    if (mask & SNAPSHOT_ACCEL)
+    {
+        snapshot_vector(block, BNO055_ACCEL_DATA_X_LSB_ADDR, ACCEL_SCALE, &snapshot->accel);
+    }
+
+    return SENSOR_OK;
+}
+
+
+/**
+ * bno055_read_snapshot: read the requested fusion vectors and wait for
+ * them.
+ * @param snapshot where to store the decoded vectors
+ * @param mask the SNAPSHOT_* vectors to read
+ * @return SENSOR_OK, or SENSOR_READ_ERROR if the transfer failed
+ */
+
+KSensorStatus bno055_read_snapshot(bno055_snapshot_t * snapshot, uint8_t mask)
+{
+    bno055_snapshot_read_t read;
+
+    if (!bno055_snapshot_begin(&read, mask))
+    {
+        return (mask & SNAPSHOT_ALL) ? SENSOR_READ_ERROR : SENSOR_OK;
+    }
+
+    return bno055_snapshot_end(&read, snapshot);
+}
+
+
+/**
+ * read_legacy_calibration: read a calibration profile left on the SD card
+ * in the old newline-separated text format. The next save replaces it
+ * with a binary record and deletes it.
+ * @param calib where to store the values read
+ * @return FR_OK if every value was read
+ */
+
+static uint16_t read_legacy_calibration(bno055_offsets_t * calib)
+{
+    static FIL Fil;
+    bno055_offsets_t values;
+    uint16_t sd_stat;
+
+    /* Open the calibration file */
+    if((sd_stat = open_file(&Fil, FA_READ | FA_OPEN_EXISTING)) == FR_OK)
+    {
+        sd_stat = read_value(&Fil, &values.accel_offset_x);
+        sd_stat |= read_value(&Fil, &values.accel_offset_y);
+        sd_stat |= read_value(&Fil, &values.accel_offset_z);
+        sd_stat |= read_value(&Fil, &values.accel_radius);
+
+        sd_stat |= read_value(&Fil, &values.gyro_offset_x);
+        sd_stat |= read_value(&Fil, &values.gyro_offset_y);
+        sd_stat |= read_value(&Fil, &values.gyro_offset_z);
+
+        sd_stat |= read_value(&Fil, &values.mag_offset_x);
+        sd_stat |= read_value(&Fil, &values.mag_offset_y);
+        sd_stat |= read_value(&Fil, &values.mag_offset_z);
+        sd_stat |= read_value(&Fil, &values.mag_radius);
+
+        close_file(&Fil);
+
+        if(sd_stat == FR_OK)
         {
-            sd_stat = read_value(&Fil, &offsets.accel_offset_x);
-            sd_stat |= read_value(&Fil, &offsets.accel_offset_y);
-            sd_stat |= read_value(&Fil, &offsets.accel_offset_z);
-            sd_stat |= read_value(&Fil, &offsets.accel_radius);
+            *calib = values;
+        }
+    }
 
-            sd_stat |= read_value(&Fil, &offsets.gyro_offset_x);
-            sd_stat |= read_value(&Fil, &offsets.gyro_offset_y);
-            sd_stat |= read_value(&Fil, &offsets.gyro_offset_z);
+    return sd_stat;
+}
 
-            sd_stat |= read_value(&Fil, &offsets.mag_offset_x);
-            sd_stat |= read_value(&Fil, &offsets.mag_offset_y);
-            sd_stat |= read_value(&Fil, &offsets.mag_offset_z);
-            sd_stat |= read_value(&Fil, &offsets.mag_radius);
 
-            if(sd_stat == FR_OK)
-            {
-                //printf("** Loaded calibration from SD card\r\n");
-                offsets_set = true;
-            }
+/**
+ * read_calibration: read the calibration profile from the SD card. The
+ * binary record is tried first (current copy, then the last good one).
+ * The legacy text file is only read when no binary record exists at all,
+ * never in place of one that failed its CRC.
+ * @param calib where to store the values read
+ * @return FR_OK if a complete, uncorrupted profile was read
+ */
+
+static uint16_t read_calibration(bno055_offsets_t * calib)
+{
+    uint16_t sd_stat;
 
-            sd_stat = close_file(&Fil);
+    disk_lock();
 
+    if((sd_stat = mount_disk()) == FR_OK)
+    {
+        if((sd_stat = read_record(CALIB_RECORD, calib, sizeof(bno055_offsets_t))) == FR_NO_FILE)
+        {
+            sd_stat = read_legacy_calibration(calib);
         }
     }
 
+    disk_unlock();
+
+    return sd_stat;
+}
+
+
+/**
+ * cache_offsets: put a set of offsets in the cache, bumping the version
+ * and marking the sensor copy dirty only if they differ from what is
+ * already cached.
+ * @param calib the offsets to cache
+ * @return true if the cached offsets changed
+ */
+
+static bool cache_offsets(const bno055_offsets_t * calib)
+{
+    if(calib_cache.loaded &&
+       memcmp(&calib_cache.offsets, calib, sizeof(bno055_offsets_t)) == 0)
+    {
+        return false;
+    }
+
+    calib_cache.offsets = *calib;
+    calib_cache.version++;
+    calib_cache.loaded = true;
+    calib_cache.dirty = true;
+
+    return true;
+}
+
+
+/**
+ * invalidate_calibration: mark the sensor's copy of the offsets as lost,
+ * so the next load_calibration pushes them again.
+ */
+
+void invalidate_calibration(void)
+{
+    calib_cache.dirty = true;
+}
+
+
+/**
+ * fetch_calibration: read the calibration profile from the SD card, or
+ * fall back to the default offsets, for load_calibration to cache. Only
+ * the first call touches the card. Must be called before the bus
+ * transaction that sets the sensor up, never from the bus task, so the
+ * bus isn't held through SD card I/O.
+ */
+
+void fetch_calibration(void)
+{
+    bno055_offsets_t calib;
+
+    if(calib_profile.ready)
+    {
+        return;
+    }
+
+    if(read_calibration(&calib) == FR_OK)
+    {
+        //printf("** Loaded calibration from SD card\r\n");
+    }
+
 /** 
  * The code is set to provide default calibration values three primary 
  * sensors (three axes each for the accelerometer, gyroscope, and 
  * magnetometer, plus a radius value for the accelerometer and magnetometer).
  */
 
-    if(!offsets_set)
+    else
     {
         //printf("** Loading default calibration values\r\n");
 
         /* Load values into offset structure */
-        offsets.accel_offset_x = 65530;
-        offsets.accel_offset_y = 81;
-        offsets.accel_offset_z = 27;
-        offsets.accel_radius = 1000;
+        calib.accel_offset_x = 65530;
+        calib.accel_offset_y = 81;
+        calib.accel_offset_z = 27;
+        calib.accel_radius = 1000;
+
+        calib.gyro_offset_x = 0;
+        calib.gyro_offset_y = 0;
+        calib.gyro_offset_z = 0;
+
+        calib.mag_offset_x = 65483;
+        calib.mag_offset_y = 5;
+        calib.mag_offset_z = 76;
+        calib.mag_radius = 661;
+    }
 
-        offsets.gyro_offset_x = 0;
-        offsets.gyro_offset_y = 0;
-        offsets.gyro_offset_z = 0;
+    calib_profile.offsets = calib;
+    __sync_synchronize();
+    calib_profile.ready = true;
+}
+
+
+/** 
+ * load_calibration: a function to load the calibration profile.
+ * The profile comes from the RAM cache, which is filled from what
+ * fetch_calibration read the first time through. The offsets are only
+ * written to the sensor if they changed since they were last written.
+ * @return ret, SENSOR_OK if the sensor has the cached offsets, or
+ * SENSOR_ERROR if fetch_calibration hasn't run yet
+ */ 
 
-        offsets.mag_offset_x = 65483;
-        offsets.mag_offset_y = 5;
-        offsets.mag_offset_z = 76;
-        offsets.mag_radius = 661;
+KSensorStatus load_calibration(void)
+{
+
+    KSensorStatus ret = SENSOR_OK;
+    uint32_t start = prof_now();
 
-        offsets_set= true;
+    if(!calib_cache.loaded)
+    {
+        if(!calib_profile.ready)
+        {
+            prof_end(PROF_LOAD_CALIB, start);
+            return SENSOR_ERROR;
+        }
+
+        cache_offsets(&calib_profile.offsets);
     }
 
     /* Set the values */
-    ret = bno055_set_sensor_offset_struct(offsets);
+    if(calib_cache.dirty)
+    {
+        if((ret = bno055_set_sensor_offset_struct(calib_cache.offsets)) == SENSOR_OK)
+        {
+            calib_cache.dirty = false;
+        }
+    }
+
+    prof_end(PROF_LOAD_CALIB, start);
 
     return ret;
 }
@@ -180,78 +500,153 @@ KSensorStatus load_calibration(void)
 
 /** 
  * save_calibration: push the calibration values to a file on the uSD card.
+ * Only touches the card, so it is called from the calibration monitor
+ * with a snapshot of the offsets and never while holding the bus.
  * @param calib the bno055_offsets_t struct that stores calibration values
+ * @return FR_OK if the profile is on the card
  */
 
-void save_calibration(bno055_offsets_t calib)
+uint16_t save_calibration(bno055_offsets_t calib)
 {
-    static FATFS FatFs;
-    static FIL Fil;
-    uint16_t sd_stat = FR_OK;
+    uint16_t sd_stat;
+
+    disk_lock();
 
-    /* Open calibration file */
-    if((sd_stat = open_file(&Fil, FA_WRITE | FA_OPEN_ALWAYS)) == FR_OK)
+    if((sd_stat = mount_disk()) == FR_OK &&
+       (sd_stat = write_record(CALIB_RECORD, &calib, sizeof(bno055_offsets_t))) == FR_OK)
     {
-        sd_stat = write_value(&Fil, calib.accel_offset_x);
-        sd_stat |= write_value(&Fil, calib.accel_offset_y);
-        sd_stat |= write_value(&Fil, calib.accel_offset_z);
-        sd_stat |= write_value(&Fil, calib.accel_radius);
+        //printf("** Saved calibration to SD card\r\n");
 
-        sd_stat |= write_value(&Fil, calib.gyro_offset_x);
-        sd_stat |= write_value(&Fil, calib.gyro_offset_y);
-        sd_stat |= write_value(&Fil, calib.gyro_offset_z);
+        /* The binary record replaces any legacy profile */
+        remove_legacy_file();
+    }
 
-        sd_stat |= write_value(&Fil, calib.mag_offset_x);
-        sd_stat |= write_value(&Fil, calib.mag_offset_y);
-        sd_stat |= write_value(&Fil, calib.mag_offset_z);
-        sd_stat |= write_value(&Fil, calib.mag_radius);
+    disk_unlock();
 
-        if(sd_stat == FR_OK)
-        {
-            //printf("** Saved calibration to SD card\r\n");
-        }
+    return sd_stat;
+}
 
-        close_file(&Fil);
+/**
+ * snapshot_offsets: read the offsets the sensor worked out and put them
+ * in the cache. Runs on the bus task, which owns the cache while the
+ * sensor is in use.
+ * @param arg the calib_snapshot_t to fill in
+ */
+
+static KSensorStatus snapshot_offsets(void * arg)
+{
+    calib_snapshot_t * snapshot = arg;
+    bno055_offsets_t offsets;
+    KSensorStatus status;
+
+    /* Leave the snapshot alone on a failed read, a save may be pending */
+    if((status = bno055_get_sensor_offset_struct(&offsets)) != SENSOR_OK)
+    {
+        return status;
     }
+
+    snapshot->offsets = offsets;
+
+    if((snapshot->changed = cache_offsets(&snapshot->offsets)))
+    {
+        /* The sensor produced these offsets, so it already has them */
+        calib_cache.dirty = false;
+        snapshot->version = calib_cache.version;
+    }
+
+    return SENSOR_OK;
 }
 
-CSP_DEFINE_TASK(calibrate_thread)
+
+/* Push the cached profile to the sensor again, on the bus task */
+static KSensorStatus reload_offsets(void * arg)
+{
+    (void) arg;
+
+    invalidate_calibration();
+
+    return load_calibration();
+}
+
+
+/* Sum of the four 2-bit fields of CALIB_STAT, 0 to 12 */
+static uint8_t calib_score(uint8_t stat)
 {
-    static bno055_offsets_t offsets;
-    static bool offsets_set;
-    uint8_t calibCount = 0;
-    uint8_t oldCount = 0;
+    return ((stat >> 6) & 0x03) + ((stat >> 4) & 0x03) + ((stat >> 2) & 0x03) + (stat & 0x03);
+}
 
-    csp_mutex_create(&bno_lock);
+
+/**
+ * calibrate_thread: the calibration monitor. Every CALIB_PERIOD ms it
+ * reads CALIB_STAT in one short bus transaction. When the sensor has
+ * just become fully calibrated the offsets are read out and, if they
+ * changed, saved to the SD card outside the bus. A failed save is retried
+ * every check until the card has the latest offsets. After
+ * CALIB_RELOAD_CHECKS checks in a row without full calibration the stored
+ * profile is pushed to the sensor again. Only reading and writing the
+ * offsets themselves holds the bus for longer than one transfer.
+ */
+
+CSP_DEFINE_TASK(calibrate_thread)
+{
+    calib_snapshot_t snapshot = { .version = 0 };
+    uint16_t saved_version = 0;
+    uint8_t reg = BNO055_CALIB_STAT_ADDR;
+    uint8_t stat = 0;
+    uint8_t last = 0;
+    uint8_t misses = 0;
+    xfer_t xfer = {
+        .op = XFER_WRITE_READ,
+        .client = XFER_CLIENT_CALIBRATION,
+        .bus = BNO055_I2C_BUS,
+        .addr = BNO055_ADDRESS_A,
+        .tx = &reg,
+        .tx_len = 1,
+        .rx = &stat,
+        .rx_len = 1
+    };
 
     while(1)
     {
-        csp_mutex_lock(&bno_lock, CSP_MAX_DELAY);
-        if(bno055_check_calibration(&calibCount, 5, &offsets) != SENSOR_OK)
+        if(xfer_run(&xfer) == I2C_OK)
         {
-            /* Reload the calibration profile */
-            if(calibCount == 0)
+            if(stat == CALIB_STAT_FULL)
             {
-                //printf("** Reloading calibration profile\r\n");
-                load_calibration();
-            }
+                misses = 0;
 
-            /**
-            * While the calibration profile is being loaded, the red LED will blink 
-            * in three-blink groups. 
-            */
+                /* Read the offsets only when the status improved to fully calibrated */
+                if(calib_score(last) < calib_score(stat))
+                {
+                    xfer_call(XFER_CLIENT_CALIBRATION, snapshot_offsets, &snapshot);
+                }
+            }
+            else
+            {
+                /* Reload the calibration profile */
+                if(++misses >= CALIB_RELOAD_CHECKS)
+                {
+                    misses = 0;
+                    xfer_call(XFER_CLIENT_CALIBRATION, reload_offsets, NULL);
+                }
+
+                /**
+                * While the sensor isn't calibrated, the red LED will blink
+                * in three-blink groups.
+                */
+
+                led_request(K_LED_RED, LED_TRIPLE);
+            }
 
-            blink(K_LED_RED);
-            vTaskDelay(100);
-            blink(K_LED_RED);
-            vTaskDelay(100);
-            blink(K_LED_RED);
+            last = stat;
         }
-        else if(oldCount != 0)
+
+        /* Save offsets that changed the cache until the card has them */
+        if(snapshot.version != saved_version &&
+           save_calibration(snapshot.offsets) == FR_OK)
         {
-            save_calibration(offsets);
+            saved_version = snapshot.version;
         }
-        csp_mutex_unlock(&bno_lock);
-        csp_sleep_ms(30000);
+
+        csp_sleep_ms(CALIB_PERIOD);
     }
 }
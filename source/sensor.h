@@ -17,6 +17,54 @@
 #define SENSOR_H
 
 #include <csp/arch/csp_thread.h>
+#include "xfer.h"
+#include <kubos-core/modules/sensors/bno055.h>
+
+/* Vectors to read in a snapshot */
+#define SNAPSHOT_QUAT    (1 << 0)
+#define SNAPSHOT_EULER   (1 << 1)
+#define SNAPSHOT_GRAVITY (1 << 2)
+#define SNAPSHOT_LINEAR  (1 << 3)
+#define SNAPSHOT_ACCEL   (1 << 4)
+#define SNAPSHOT_ALL     0x1F
+
+/**
+ * BNO055 fusion outputs, decoded from one burst read of the data
+ * registers so every vector comes from the same fusion epoch.
+ */
+typedef struct {
+    bno055_quat_data_t quat;
+    bno055_vector_data_t euler;
+    bno055_vector_data_t gravity;
+    bno055_vector_data_t linear;
+    bno055_vector_data_t accel;
+} bno055_snapshot_t;
+
+/* The data registers, ACC_DATA_X_LSB (0x08) up to TEMP (0x34) */
+#define SNAPSHOT_START BNO055_ACCEL_DATA_X_LSB_ADDR
+#define SNAPSHOT_LEN (BNO055_TEMP_ADDR - BNO055_ACCEL_DATA_X_LSB_ADDR)
+
+/* A snapshot read in flight on the I2C task */
+typedef struct {
+    xfer_t xfer;
+    uint8_t mask;
+    uint8_t reg;
+    uint8_t block[SNAPSHOT_LEN];
+} bno055_snapshot_read_t;
+
+bool bno055_snapshot_begin(bno055_snapshot_read_t * read, uint8_t mask);
+
+KSensorStatus bno055_snapshot_end(bno055_snapshot_read_t * read, bno055_snapshot_t * snapshot);
+
+KSensorStatus bno055_read_snapshot(bno055_snapshot_t * snapshot, uint8_t mask);
+
+KSensorStatus load_calibration(void);
+
+void invalidate_calibration(void);
+
+void fetch_calibration(void);
+
+uint16_t save_calibration(bno055_offsets_t calib);
 
 CSP_DEFINE_TASK(calibrate_thread);
 
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "session.h"
+
+
+/**
+ * session_ready: bring the sensor up if it isn't already.
+ * @param session the sensor's session
+ * @return true if the sensor is initialized and can be read
+ */
+
+bool session_ready(sensor_session_t * session)
+{
+    if (session->state == SESSION_READY)
+    {
+        return true;
+    }
+
+    if (session->init() != SENSOR_OK)
+    {
+        return false;
+    }
+
+    session->state = SESSION_READY;
+    session->failures = 0;
+
+    return true;
+}
+
+
+/**
+ * session_report: record the status of a read. Too many failures in a
+ * row take the session down, so the next session_ready re-initializes
+ * the sensor.
+ * @param session the sensor's session
+ * @param status the status returned by the read
+ */
+
+void session_report(sensor_session_t * session, KSensorStatus status)
+{
+    if (status == SENSOR_OK)
+    {
+        session->failures = 0;
+        return;
+    }
+
+    if (++session->failures >= SESSION_MAX_FAILURES)
+    {
+        session->state = SESSION_DOWN;
+    }
+}
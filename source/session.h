@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kubos-core/modules/sensors/sensors.h>
+
+#define SESSION_MAX_FAILURES YOTTA_CFG_SENSORS_MAX_FAILURES
+
+typedef enum {
+    SESSION_DOWN = 0,
+    SESSION_READY
+} session_state_t;
+
+/**
+ * Tracks whether a sensor has been set up, and how healthy it has been
+ * since. The init function runs once, then again only after
+ * SESSION_MAX_FAILURES reads in a row have failed.
+ */
+typedef struct {
+    KSensorStatus (*init)(void);
+    session_state_t state;
+    uint8_t failures;
+} sensor_session_t;
+
+#define SESSION_INIT(init_fn) { .init = (init_fn), .state = SESSION_DOWN }
+
+bool session_ready(sensor_session_t * session);
+
+void session_report(sensor_session_t * session, KSensorStatus status);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SOURCES_H
+#define SOURCES_H
+
+/**
+ * Telemetry source ids published by the node. The ground decoder in
+ * tools/tlm_decode.py keeps its own copy of these, so only ever append.
+ */
+typedef enum {
+    SOURCE_TEMP = 0,
+    SOURCE_HUM,
+    SOURCE_QUAT_W,
+    SOURCE_QUAT_X,
+    SOURCE_QUAT_Y,
+    SOURCE_QUAT_Z,
+    SOURCE_EUL_X,
+    SOURCE_EUL_Y,
+    SOURCE_EUL_Z,
+    SOURCE_GRAV_X,
+    SOURCE_GRAV_Y,
+    SOURCE_GRAV_Z,
+    SOURCE_LIN_X,
+    SOURCE_LIN_Y,
+    SOURCE_LIN_Z,
+    SOURCE_ACC_X,
+    SOURCE_ACC_Y,
+    SOURCE_ACC_Z,
+    SOURCE_COUNT
+} source_id_t;
+
+/* Window summaries from stats.c: SOURCE_STATS_BASE + 5 * source + stats_value_t */
+#define SOURCE_STATS_BASE 100
+
+/* Burst capture samples from capture.c: SOURCE_CAPTURE_BASE + capture_value_t */
+#define SOURCE_CAPTURE_BASE 190
+
+/* Stage timings from prof.c: SOURCE_PROF_BASE + 3 * stage + prof_stat_t */
+#define SOURCE_PROF_BASE 200
+
+/* Sensor bus occupancy per client in 0.1 %: SOURCE_BUS_BASE + xfer_client_t */
+#define SOURCE_BUS_BASE 240
+
+/* KISS link counters: SOURCE_LINK_BASE + kiss_counter_t */
+#define SOURCE_LINK_BASE 244
+
+#endif
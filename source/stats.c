@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "downlink.h"
+#include "schedule.h"
+#include "sources.h"
+#include "stats.h"
+
+/**
+ * Windowed statistics per source. Each group can be sampled faster than
+ * it is downlinked: with a window of N, every N samples of a source are
+ * reduced to one summary of min, max, mean, variance and last value.
+ * Mean and variance are kept with Welford's method, so each sample is
+ * an O(1) update and memory is fixed. A window of 0 or 1 passes samples
+ * straight through.
+ */
+
+/* Samples per summary of each group, from config.json */
+static const uint16_t group_window[GROUP_COUNT] = {
+    [GROUP_HTU] = YOTTA_CFG_TELEMETRY_SCHEDULE_HTU21D_WINDOW,
+    [GROUP_QUAT] = YOTTA_CFG_TELEMETRY_SCHEDULE_QUATERNION_WINDOW,
+    [GROUP_EULER] = YOTTA_CFG_TELEMETRY_SCHEDULE_EULER_WINDOW,
+    [GROUP_GRAVITY] = YOTTA_CFG_TELEMETRY_SCHEDULE_GRAVITY_WINDOW,
+    [GROUP_LINEAR] = YOTTA_CFG_TELEMETRY_SCHEDULE_LINEAR_ACCEL_WINDOW,
+    [GROUP_ACCEL] = YOTTA_CFG_TELEMETRY_SCHEDULE_ACCEL_WINDOW,
+};
+
+typedef struct {
+    uint16_t count;
+    float min;
+    float max;
+    float mean;
+    /* Sum of squared differences from the mean */
+    float m2;
+    float last;
+} stats_window_t;
+
+static stats_window_t windows[SOURCE_COUNT];
+
+
+static void submit_value(uint8_t source_id, stats_value_t value, float data)
+{
+    telemetry_source source = {
+        .source_id = SOURCE_STATS_BASE + STATS_COUNT * source_id + value,
+        .data_type = TELEMETRY_TYPE_FLOAT
+    };
+
+    downlink_submit(source, data);
+}
+
+
+/**
+ * stats_submit: take a sample in place of downlink_submit. Samples of a
+ * windowed source are folded into the window's statistics, and the
+ * summary is submitted once the window is full. Must only be called from
+ * the aggregator thread.
+ * @param source the telemetry source of the sample
+ * @param value the sample value
+ */
+
+void stats_submit(telemetry_source source, float value)
+{
+    stats_window_t * window;
+    float delta;
+    uint8_t id = source.source_id;
+
+    if (id >= SOURCE_COUNT || group_window[schedule_group_of(id)] <= 1)
+    {
+        downlink_submit(source, value);
+        return;
+    }
+
+    window = &windows[id];
+
+    if (window->count == 0)
+    {
+        window->min = value;
+        window->max = value;
+        window->mean = 0;
+        window->m2 = 0;
+    }
+
+    if (value < window->min)
+    {
+        window->min = value;
+    }
+    if (value > window->max)
+    {
+        window->max = value;
+    }
+
+    window->count++;
+    delta = value - window->mean;
+    window->mean += delta / window->count;
+    window->m2 += delta * (value - window->mean);
+    window->last = value;
+
+    if (window->count < group_window[schedule_group_of(id)])
+    {
+        return;
+    }
+
+    submit_value(id, STATS_MIN, window->min);
+    submit_value(id, STATS_MAX, window->max);
+    submit_value(id, STATS_MEAN, window->mean);
+    submit_value(id, STATS_VARIANCE, window->m2 / (window->count - 1));
+    submit_value(id, STATS_LAST, window->last);
+
+    window->count = 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#include <telemetry/telemetry.h>
+
+/**
+ * Values in the summary of one window of a source, published as source
+ * ids SOURCE_STATS_BASE + STATS_COUNT * source + stats_value_t.
+ */
+typedef enum {
+    STATS_MIN = 0,
+    STATS_MAX,
+    STATS_MEAN,
+    STATS_VARIANCE,
+    STATS_LAST,
+    STATS_COUNT
+} stats_value_t;
+
+void stats_submit(telemetry_source source, float value);
+
+#endif
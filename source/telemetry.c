@@ -13,7 +13,17 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include "misc.h"
+#include "capture.h"
+#include "channels.h"
+#include "downlink.h"
+#include "htu.h"
+#include "led.h"
+#include "prof.h"
+#include "sensor.h"
+#include "schedule.h"
+#include "session.h"
+#include "sources.h"
+#include "stats.h"
 #include <kubos-core/modules/sensors/htu21d.h>
 #include <kubos-core/modules/sensors/bno055.h>
 #include <kubos-hal/gpio.h>
@@ -22,95 +32,343 @@
 
 
 /* Setup telemetry sources */
-static telemetry_source temp_source = { .source_id = 0, .data_type = TELEMETRY_TYPE_INT };
-static telemetry_source hum_source  = { .source_id = 1, .data_type = TELEMETRY_TYPE_INT };
+static telemetry_source temp_source = { .source_id = SOURCE_TEMP, .data_type = TELEMETRY_TYPE_INT };
+static telemetry_source hum_source  = { .source_id = SOURCE_HUM, .data_type = TELEMETRY_TYPE_INT };
 
-static void htu_aggregator()
+
+/* Sources the ground turned off are read along with their group but dropped */
+static void submit_sample(telemetry_source source, float value)
+{
+    if (channels_enabled(source.source_id))
+    {
+        stats_submit(source, value);
+    }
+}
+
+
+/* Sensor setup runs on the bus task, as one uninterrupted sequence */
+static KSensorStatus htu_setup(void * arg)
+{
+    KSensorStatus status;
+
+    (void) arg;
+
+    if ((status = htu21d_setup()) != SENSOR_OK)
+    {
+        return status;
+    }
+
+    return htu21d_reset();
+}
+
+
+static KSensorStatus bno_setup(void * arg)
+{
+    KSensorStatus status;
+
+    (void) arg;
+
+    if ((status = bno055_setup(OPERATION_MODE_NDOF)) != SENSOR_OK)
+    {
+        return status;
+    }
+
+    /* The mode switch left the sensor without its offsets */
+    invalidate_calibration();
+
+    return load_calibration();
+}
+
+
+static KSensorStatus htu_init(void)
+{
+    return xfer_call(XFER_CLIENT_SAMPLING, htu_setup, NULL);
+}
+
+
+static KSensorStatus bno_init(void)
+{
+    /* Read the stored profile here, so the bus isn't held through SD I/O */
+    fetch_calibration();
+
+    return xfer_call(XFER_CLIENT_SAMPLING, bno_setup, NULL);
+}
+
+
+/* Sensors are set up once and only set up again after repeated failures */
+static sensor_session_t htu_session = SESSION_INIT(htu_init);
+static sensor_session_t bno_session = SESSION_INIT(bno_init);
+
+
+#if HTU_PIPELINED
+
+/**
+ * The HTU21D measurements run as a pipeline across ticks. When the group
+ * is due the temperature conversion is started and the tick goes on to
+ * the BNO055; a later tick collects the temperature and starts humidity,
+ * and a later one still collects humidity. Each tick only spends the
+ * transfers on the bus, never a conversion.
+ */
+
+static uint32_t htu_started;
+
+
+/**
+ * htu_begin: queue the read of a finished conversion, if there is one.
+ * @return true if a read was queued for htu_end to finish
+ */
+
+static bool htu_begin(void)
+{
+    htu_started = prof_now();
+
+    return htu_collect_begin();
+}
+
+
+/**
+ * htu_end: finish a read queued by htu_begin, and start the next
+ * conversion if one is due.
+ * @param due true if the HTU21D group is due this tick
+ * @param reading what htu_begin returned
+ */
+
+static void htu_end(bool due, bool reading)
+{
+    htu_measurement_t pending = htu_pending();
+    KSensorStatus status;
+    float value = 0;
+
+    if (reading && htu_collect_end(&status, &value))
+    {
+        prof_end((pending == HTU_TEMP) ? PROF_HTU_TEMP : PROF_HTU_HUM, htu_started);
+        session_report(&htu_session, status);
+
+        if (status == SENSOR_OK)
+        {
+            submit_sample((pending == HTU_TEMP) ? temp_source : hum_source, value);
+        }
+
+        /* Humidity follows temperature */
+        if (pending == HTU_TEMP && session_ready(&htu_session))
+        {
+            session_report(&htu_session, htu_trigger(HTU_HUM));
+        }
+    }
+
+    if (due && htu_pending() == HTU_NONE && session_ready(&htu_session))
+    {
+        session_report(&htu_session, htu_trigger(HTU_TEMP));
+    }
+}
+
+#else
+
+static bool htu_begin(void)
+{
+    return false;
+}
+
+
+static KSensorStatus read_temperature(void * temp)
+{
+    return htu21d_read_temperature(temp);
+}
+
+
+static KSensorStatus read_humidity(void * hum)
+{
+    return htu21d_read_humidity(hum);
+}
+
+
+/* Without pipelining both measurements are read, blocking, when due */
+static void htu_end(bool due, bool reading)
 {
     float temp = 0;
     float hum = 0;
+    KSensorStatus status;
+    uint32_t start;
+
+    (void) reading;
 
-    htu21d_setup();
-    htu21d_reset();
-
-    htu21d_read_temperature(&temp);
-    aggregator_submit(temp_source, temp);
-
-    htu21d_read_humidity(&hum);
-    aggregator_submit(hum_source, hum);
-}
-
-
-static void bno_aggregator()
-{
-    bno055_quat_data_t quat_data;
-    bno055_vector_data_t eul_vector;
-    bno055_vector_data_t grav_vector;
-    bno055_vector_data_t lin_vector;
-    bno055_vector_data_t acc_vector;
-    static KI2CStatus bno_stat;
-
-    csp_mutex_lock(&bno_lock, CSP_MAX_DELAY);
-
-    bno_stat = bno055_setup(OPERATION_MODE_NDOF);
-    load_calibration();
-
-    blink(K_LED_ORANGE);
-    bno055_get_position(&quat_data);
-    telemetry_source quat_w = { .source_id = 2, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(quat_w, quat_data.w);
-    telemetry_source quat_x = { .source_id = 3, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(quat_x, quat_data.x);
-    telemetry_source quat_y = { .source_id = 4, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(quat_y, quat_data.y);
-    telemetry_source quat_z = { .source_id = 5, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(quat_z, quat_data.z);
-
-    blink(K_LED_ORANGE);
-    bno055_get_data_vector(VECTOR_EULER, &eul_vector);
-    telemetry_source eul_x = { .source_id = 6, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(eul_x, eul_vector.x);
-    telemetry_source eul_y = { .source_id = 7, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(eul_y, eul_vector.y);
-    telemetry_source eul_z = { .source_id = 8, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(eul_z, eul_vector.z);
-
-    blink(K_LED_ORANGE);
-    bno055_get_data_vector(VECTOR_GRAVITY, &grav_vector);
-    telemetry_source grav_vector_x = { .source_id = 9, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(grav_vector_x, grav_vector.x);
-    telemetry_source grav_vector_y = { .source_id = 10, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(grav_vector_y, grav_vector.y);
-    telemetry_source grav_vector_z = { .source_id = 11, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(grav_vector_z, grav_vector.z);
-
-    blink(K_LED_ORANGE);
-    bno055_get_data_vector(VECTOR_LINEARACCEL, &lin_vector);
-    telemetry_source lin_vector_x = { .source_id = 12, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(lin_vector_x, lin_vector.x);
-    telemetry_source lin_vector_y = { .source_id = 13, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(lin_vector_y, lin_vector.y);
-    telemetry_source lin_vector_z = { .source_id = 14, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(lin_vector_z, lin_vector.z);
-
-    blink(K_LED_ORANGE);
-    bno055_get_data_vector(VECTOR_ACCELEROMETER, &acc_vector);
-    telemetry_source acc_vector_x = { .source_id = 15, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(acc_vector_x, acc_vector.x);
-    telemetry_source acc_vector_y = { .source_id = 16, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(acc_vector_y, acc_vector.y);
-    telemetry_source acc_vector_z = { .source_id = 17, .data_type = TELEMETRY_TYPE_FLOAT };
-    aggregator_submit(acc_vector_z, acc_vector.z);
-
-    csp_mutex_unlock(&bno_lock);
+    if (!due || !session_ready(&htu_session))
+    {
+        return;
+    }
+
+    start = prof_now();
+    status = xfer_call(XFER_CLIENT_SAMPLING, read_temperature, &temp);
+    prof_end(PROF_HTU_TEMP, start);
+    session_report(&htu_session, status);
+    if (status == SENSOR_OK)
+    {
+        submit_sample(temp_source, temp);
+    }
+
+    start = prof_now();
+    status = xfer_call(XFER_CLIENT_SAMPLING, read_humidity, &hum);
+    prof_end(PROF_HTU_HUM, start);
+    session_report(&htu_session, status);
+    if (status == SENSOR_OK)
+    {
+        submit_sample(hum_source, hum);
+    }
+}
+
+#endif
+
+
+static void submit_float(uint8_t source_id, float value)
+{
+    telemetry_source source = { .source_id = source_id, .data_type = TELEMETRY_TYPE_FLOAT };
+
+    submit_sample(source, value);
+}
+
+
+/* Submit x, y and z of a vector to three consecutive source ids */
+static void submit_vector(uint8_t first_id, const bno055_vector_data_t * vector)
+{
+    submit_float(first_id, vector->x);
+    submit_float(first_id + 1, vector->y);
+    submit_float(first_id + 2, vector->z);
+}
+
+
+static uint32_t bno_started;
+
+/* The vectors of the read in flight that are downlinked this tick */
+static uint8_t bno_submit;
+
+
+/**
+ * bno_begin: queue one burst read of every group due this tick, plus the
+ * capture vectors while capture is recording.
+ * @param due the groups due this tick
+ * @param read the read to start
+ * @return true if the read was queued and bno_end must follow
+ */
+
+static bool bno_begin(uint32_t due, bno055_snapshot_read_t * read)
+{
+    uint8_t mask = 0;
+
+    mask |= (due & GROUP_BIT(GROUP_QUAT)) ? SNAPSHOT_QUAT : 0;
+    mask |= (due & GROUP_BIT(GROUP_EULER)) ? SNAPSHOT_EULER : 0;
+    mask |= (due & GROUP_BIT(GROUP_GRAVITY)) ? SNAPSHOT_GRAVITY : 0;
+    mask |= (due & GROUP_BIT(GROUP_LINEAR)) ? SNAPSHOT_LINEAR : 0;
+    mask |= (due & GROUP_BIT(GROUP_ACCEL)) ? SNAPSHOT_ACCEL : 0;
+
+    if (!session_ready(&bno_session))
+    {
+        return false;
+    }
+
+    if (mask != 0)
+    {
+        led_request(K_LED_ORANGE, LED_BLINK);
+    }
+
+    bno_submit = mask;
+    if (capture_sampling())
+    {
+        mask |= CAPTURE_SNAPSHOT;
+    }
+
+    /* Every group due this tick comes from one burst read */
+    bno_started = prof_now();
+
+    return bno055_snapshot_begin(read, mask);
+}
+
+
+/**
+ * bno_end: wait for the read queued by bno_begin, submit the vectors of
+ * the groups due and hand the capture vectors to the capture ring.
+ * @param read the read started by bno_begin
+ */
+
+static void bno_end(bno055_snapshot_read_t * read)
+{
+    bno055_snapshot_t snapshot;
+    KSensorStatus status;
+    uint8_t mask = bno_submit;
+
+    status = bno055_snapshot_end(read, &snapshot);
+    prof_end(PROF_BNO_READ, bno_started);
+    session_report(&bno_session, status);
+
+    if (status != SENSOR_OK)
+    {
+        return;
+    }
+
+    if ((read->mask & CAPTURE_SNAPSHOT) == CAPTURE_SNAPSHOT)
+    {
+        capture_add(&snapshot);
+    }
+
+    if (mask & SNAPSHOT_QUAT)
+    {
+        submit_float(SOURCE_QUAT_W, snapshot.quat.w);
+        submit_float(SOURCE_QUAT_X, snapshot.quat.x);
+        submit_float(SOURCE_QUAT_Y, snapshot.quat.y);
+        submit_float(SOURCE_QUAT_Z, snapshot.quat.z);
+    }
+    if (mask & SNAPSHOT_EULER)
+    {
+        submit_vector(SOURCE_EUL_X, &snapshot.euler);
+    }
+    if (mask & SNAPSHOT_GRAVITY)
+    {
+        submit_vector(SOURCE_GRAV_X, &snapshot.gravity);
+    }
+    if (mask & SNAPSHOT_LINEAR)
+    {
+        submit_vector(SOURCE_LIN_X, &snapshot.linear);
+    }
+    if (mask & SNAPSHOT_ACCEL)
+    {
+        submit_vector(SOURCE_ACC_X, &snapshot.accel);
+    }
 }
 
 /**
  * Implementing user_aggregator function defined by telemetry-aggregator module.
  * This function is defined in <telemetry-aggregator/aggregator.h>
+ * It runs once per telemetry.aggregator.interval tick and samples the
+ * groups schedule_due says are due. The BNO055 and HTU21D transactions
+ * are queued back to back on the I2C task, and the BNO055 vectors are
+ * submitted while the HTU21D read is still on the bus. While burst
+ * capture is recording the BNO055 is read on every tick.
  */
 void user_aggregator()
 {
-    htu_aggregator();
-    bno_aggregator();
+    static uint32_t tick;
+    static bno055_snapshot_read_t read;
+    uint32_t due;
+    bool bno = false;
+    bool htu;
+
+    /* Pick up channel changes from the ground; groups with no source on aren't read */
+    channels_poll();
+    due = schedule_due(tick++) & channels_groups();
+
+    if ((due & ~GROUP_BIT(GROUP_HTU)) || capture_sampling())
+    {
+        bno = bno_begin(due, &read);
+    }
+
+    /* Runs every tick, to move a pipelined measurement along */
+    htu = htu_begin();
+
+    if (bno)
+    {
+        bno_end(&read);
+    }
+
+    htu_end(due & GROUP_BIT(GROUP_HTU), htu);
+
+    prof_publish();
 }
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "prof.h"
+#include "xfer.h"
+
+#include <stddef.h>
+#include <csp/csp.h>
+#include <csp/arch/csp_queue.h>
+
+/**
+ * Arbiter for the sensor I2C bus. Every client queues its transactions
+ * to the bus task, which owns the bus: it runs them one at a time,
+ * highest priority client first, and signals completion, so a caller can
+ * put several transactions on the bus and do other work until it needs
+ * the results. Driver sequences that need several transfers without
+ * another client in between (sensor setup, calibration) run as one
+ * XFER_CALL transaction. No other lock is needed to share the bus.
+ *
+ * The transfers themselves go through k_i2c_write and k_i2c_read, which
+ * kubos-hal implements by polling; xfer_execute is the one place a DMA
+ * or interrupt driven transfer would go. The host simulator's k_i2c
+ * already takes the time a real bus would.
+ */
+
+/* Queue each client's transactions go to */
+static const uint8_t client_queue[XFER_CLIENT_COUNT] = {
+    [XFER_CLIENT_SAMPLING] = 0,
+    [XFER_CLIENT_CALIBRATION] = 1,
+};
+
+#define XFER_QUEUES 2
+
+static csp_queue_handle_t pending[XFER_QUEUES];
+static csp_thread_handle_t bus_task;
+
+/* Time each client has held the bus, only written by the bus task */
+static volatile uint32_t busy_us[XFER_CLIENT_COUNT];
+
+
+/**
+ * xfer_init: create the transaction queues and the bus task. Must run
+ * before any task that uses the bus is started.
+ */
+
+void xfer_init(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < XFER_QUEUES; i++)
+    {
+        pending[i] = csp_queue_create(XFER_QUEUE_LEN, sizeof(xfer_t *));
+    }
+
+    /* Above the sampling tasks, so queued transactions run back to back */
+    csp_thread_create(xfer_thread, "I2C", 1000, NULL, 1, &bus_task);
+}
+
+
+/**
+ * xfer_submit: queue a transaction for the bus without waiting for it.
+ * Must not be called from an XFER_CALL function, which already holds
+ * the bus.
+ * @param xfer the transaction, which must stay valid until it completes
+ * @return false if the queue was full and the transaction wasn't queued
+ */
+
+bool xfer_submit(xfer_t * xfer)
+{
+    xfer->complete = false;
+    xfer->status = I2C_ERROR;
+    xfer->result = SENSOR_ERROR;
+    xfer->waiter = xTaskGetCurrentTaskHandle();
+    xfer->queued = prof_now();
+
+    /*
+     * Drop the counts of transactions that completed before they were
+     * waited for. Their complete flag is already set, so xfer_wait only
+     * ever takes notifications of transactions still outstanding.
+     */
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    if (csp_queue_enqueue(pending[client_queue[xfer->client]], &xfer, 0) != CSP_QUEUE_OK)
+    {
+        return false;
+    }
+
+    xTaskNotifyGive(bus_task);
+
+    return true;
+}
+
+
+/**
+ * xfer_wait: block until a submitted transaction has completed. Several
+ * transactions can be outstanding at once and waited for in any order.
+ * @param xfer the transaction
+ * @return the status of the transfer
+ */
+
+KI2CStatus xfer_wait(xfer_t * xfer)
+{
+    /* Each completion notifies once; take one at a time so none are lost */
+    while (!xfer->complete)
+    {
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    }
+
+    return xfer->status;
+}
+
+
+/**
+ * xfer_run: submit a transaction and wait for it.
+ * @param xfer the transaction
+ * @return the status of the transfer
+ */
+
+KI2CStatus xfer_run(xfer_t * xfer)
+{
+    if (!xfer_submit(xfer))
+    {
+        return I2C_ERROR;
+    }
+
+    return xfer_wait(xfer);
+}
+
+
+/**
+ * xfer_call: run a function on the bus task with the bus to itself, and
+ * wait for it. The function may use the kubos-core drivers and k_i2c
+ * directly, but must not submit transactions.
+ * @param client the client the bus time is charged to
+ * @param call the function to run
+ * @param arg passed to call
+ * @return what call returned, or SENSOR_ERROR if it couldn't be queued
+ */
+
+KSensorStatus xfer_call(xfer_client_t client, KSensorStatus (*call)(void * arg), void * arg)
+{
+    xfer_t xfer = {
+        .op = XFER_CALL,
+        .client = client,
+        .call = call,
+        .arg = arg
+    };
+
+    if (xfer_run(&xfer) != I2C_OK)
+    {
+        return SENSOR_ERROR;
+    }
+
+    return xfer.result;
+}
+
+
+/**
+ * xfer_busy_us: how long a client's transactions have held the bus.
+ * The count wraps, so compare two readings to get the time in between.
+ * @param client the client
+ * @return the total bus time in us
+ */
+
+uint32_t xfer_busy_us(xfer_client_t client)
+{
+    return busy_us[client];
+}
+
+
+static KI2CStatus xfer_execute(xfer_t * xfer)
+{
+    KI2CStatus status = I2C_OK;
+
+    if (xfer->op == XFER_CALL)
+    {
+        xfer->result = xfer->call(xfer->arg);
+        return I2C_OK;
+    }
+
+    if (xfer->op != XFER_READ)
+    {
+        status = k_i2c_write(xfer->bus, xfer->addr, xfer->tx, xfer->tx_len);
+    }
+
+    if (status == I2C_OK && xfer->op != XFER_WRITE)
+    {
+        status = k_i2c_read(xfer->bus, xfer->addr, xfer->rx, xfer->rx_len);
+    }
+
+    return status;
+}
+
+
+/* Take the next transaction, highest priority queue first */
+static xfer_t * xfer_next(void)
+{
+    xfer_t * xfer;
+    uint8_t i;
+
+    for (i = 0; i < XFER_QUEUES; i++)
+    {
+        if (csp_queue_dequeue(pending[i], &xfer, 0) == CSP_QUEUE_OK)
+        {
+            return xfer;
+        }
+    }
+
+    return NULL;
+}
+
+
+CSP_DEFINE_TASK(xfer_thread)
+{
+    xfer_t * xfer;
+    TaskHandle_t waiter;
+    uint32_t start;
+
+    while (1)
+    {
+        /* One notification per queued transaction */
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+
+        if ((xfer = xfer_next()) == NULL)
+        {
+            continue;
+        }
+
+        prof_end(PROF_BUS_WAIT, xfer->queued);
+
+        start = prof_now();
+        xfer->status = xfer_execute(xfer);
+        busy_us[xfer->client] += (prof_now() - start) / PROF_TICKS_PER_US;
+
+        if (xfer->done != NULL)
+        {
+            xfer->done(xfer);
+        }
+
+        /* The caller may reuse the transaction as soon as it is complete */
+        waiter = xfer->waiter;
+        xfer->complete = true;
+        xTaskNotifyGive(waiter);
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef XFER_H
+#define XFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <csp/arch/csp_thread.h>
+#include <kubos-hal/i2c.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <kubos-core/modules/sensors/sensors.h>
+
+/* Transactions that can be waiting for the bus, per priority */
+#define XFER_QUEUE_LEN 8
+
+typedef enum {
+    XFER_WRITE = 0,
+    XFER_READ,
+    /* Write tx (usually a register address), then read into rx */
+    XFER_WRITE_READ,
+    /* Run call(arg) with the bus to itself, for multi-transfer driver sequences */
+    XFER_CALL
+} xfer_op_t;
+
+/**
+ * Users of the sensor bus, in priority order. Queued transactions of a
+ * higher priority client always go first; a running one is never cut
+ * short.
+ */
+typedef enum {
+    XFER_CLIENT_SAMPLING = 0,
+    XFER_CLIENT_CALIBRATION,
+    XFER_CLIENT_COUNT
+} xfer_client_t;
+
+typedef struct xfer xfer_t;
+
+/**
+ * One I2C transaction. The caller owns the transaction and its buffers
+ * and must keep them untouched from xfer_submit until it completes.
+ * On completion done() is called from the bus task, if set, and the
+ * submitting task is notified.
+ */
+struct xfer {
+    xfer_op_t op;
+    xfer_client_t client;
+    KI2CNum bus;
+    uint16_t addr;
+    uint8_t * tx;
+    uint8_t tx_len;
+    uint8_t * rx;
+    uint8_t rx_len;
+    KSensorStatus (*call)(void * arg);
+    void * arg;
+    void (*done)(xfer_t * xfer);
+    KI2CStatus status;
+    KSensorStatus result;
+    TaskHandle_t waiter;
+    uint32_t queued;
+    volatile bool complete;
+};
+
+void xfer_init(void);
+
+bool xfer_submit(xfer_t * xfer);
+
+KI2CStatus xfer_wait(xfer_t * xfer);
+
+KI2CStatus xfer_run(xfer_t * xfer);
+
+KSensorStatus xfer_call(xfer_client_t client, KSensorStatus (*call)(void * arg), void * arg);
+
+uint32_t xfer_busy_us(xfer_client_t client);
+
+CSP_DEFINE_TASK(xfer_thread);
+
+#endif
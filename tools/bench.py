@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2016 Kubos Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+End-to-end benchmark of the sensor node on the host simulator (sim/).
+
+Runs the full pipeline (user_aggregator, downlink_submit, the sender
+task, csp_send over KISS) against the simulated log node for each point
+of a matrix of baud rates, aggregator intervals and numbers of active
+source groups. For every run it reports sample-to-wire latency (node
+timestamp to the last KISS byte of the frame arriving) and the sustained
+sample rate, and writes everything to a JSON file. Give --compare an
+earlier result file to print the change per run.
+"""
+
+import argparse
+import copy
+import hashlib
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SIM = os.path.join(ROOT, 'sim')
+LOGNODE = os.path.join(ROOT, 'tools', 'sim_lognode.py')
+
+# Groups in the order they are switched on, with their telemetry id count
+GROUPS = [
+    ('quaternion', 4),
+    ('linear_accel', 3),
+    ('euler', 3),
+    ('gravity', 3),
+    ('accel', 3),
+    ('htu21d', 2),
+]
+
+# Must match SOURCE_STATS_BASE in source/sources.h; ids from here up are
+# window summaries, capture samples and stage timings
+SOURCE_STATS_BASE = 100
+
+# Period that keeps a group effectively off for the length of a run
+OFF_PERIOD = 24 * 3600 * 1000
+
+
+def variant(base, interval, sources, period):
+    config = copy.deepcopy(base)
+    config['telemetry']['aggregator']['interval'] = interval
+    offered = 0.0
+    ids = 0
+    for index, (group, count) in enumerate(GROUPS):
+        schedule = config['telemetry']['schedule'][group]
+        if index < sources:
+            if period:
+                schedule['period'] = period
+            offered += count * 1000.0 / max(schedule['period'], interval)
+            ids += count
+        else:
+            schedule['period'] = OFF_PERIOD
+    return config, offered, ids
+
+
+def build(config):
+    """Build the simulator for a config; builds are cached by config."""
+    text = json.dumps(config, sort_keys=True)
+    tag = hashlib.sha1(text.encode()).hexdigest()[:10]
+    build_dir = os.path.join('build', 'bench-' + tag)
+    config_path = os.path.join(SIM, build_dir + '.json')
+    os.makedirs(os.path.dirname(config_path), exist_ok=True)
+    with open(config_path, 'w') as f:
+        f.write(text)
+    subprocess.check_call(['make', '-s', '-C', SIM, 'BUILD=' + build_dir,
+                           'CONFIG_JSON=' + config_path],
+                          stdout=subprocess.DEVNULL)
+    return os.path.join(SIM, build_dir, 'ukub-sim')
+
+
+def percentile(values, fraction):
+    if not values:
+        return None
+    values = sorted(values)
+    index = min(len(values) - 1, int(round(fraction * (len(values) - 1))))
+    return round(values[index], 1)
+
+
+def run(binary, baud, duration, warmup, seed):
+    with tempfile.TemporaryDirectory() as work:
+        samples = os.path.join(work, 'samples.csv')
+        env = dict(os.environ,
+                   UKUB_SIM_BAUD=str(baud),
+                   UKUB_SIM_DURATION=str(duration),
+                   UKUB_SIM_SD=os.path.join(work, 'sd'),
+                   UKUB_SIM_SEED=str(seed),
+                   UKUB_SIM_LOGNODE='%s %s --out %s' % (sys.executable, LOGNODE, samples))
+        subprocess.check_call([binary], env=env, stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+
+        latencies = []
+        count = 0
+        with open(samples) as f:
+            for line in f:
+                arrival, timestamp, source_id = line.split(',')[:3]
+                arrival = float(arrival)
+                # Only raw samples are part of the offered load
+                if arrival < warmup or int(source_id) >= SOURCE_STATS_BASE:
+                    continue
+                count += 1
+                # Node timestamps are csp_get_ms() truncated to 16 bits
+                latencies.append((arrival - int(timestamp)) % 65536)
+
+    window = (duration - warmup) / 1000.0
+    return {
+        'samples': count,
+        'delivered_sps': round(count / window, 1),
+        'latency_ms': {
+            'p50': percentile(latencies, 0.50),
+            'p90': percentile(latencies, 0.90),
+            'p99': percentile(latencies, 0.99),
+            'max': percentile(latencies, 1.0),
+        },
+    }
+
+
+def key(result):
+    return (result['baud'], result['interval'], result['sources'])
+
+
+def compare(results, path):
+    with open(path) as f:
+        previous = {key(r): r for r in json.load(f)['runs']}
+    print('\nchange vs %s:' % path)
+    for result in results:
+        old = previous.get(key(result))
+        if old is None:
+            continue
+        print('  baud %6d interval %3d sources %d: sps %+7.1f  p50 %+7.1f ms  p99 %+7.1f ms'
+              % (key(result) + (result['delivered_sps'] - old['delivered_sps'],
+                                result['latency_ms']['p50'] - old['latency_ms']['p50'],
+                                result['latency_ms']['p99'] - old['latency_ms']['p99'])))
+
+
+def commit():
+    try:
+        return subprocess.check_output(['git', '-C', ROOT, 'describe', '--always', '--dirty'],
+                                       stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def int_list(text):
+    return [int(value) for value in text.split(',')]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--baud', type=int_list, default=[9600, 57600, 115200],
+                        help='comma separated baud rates (default 9600,57600,115200)')
+    parser.add_argument('--interval', type=int_list, default=[10],
+                        help='comma separated aggregator intervals in ms (default 10)')
+    parser.add_argument('--sources', type=int_list, default=[1, 3, 6],
+                        help='comma separated numbers of active source groups, 1-%d '
+                             '(default 1,3,6)' % len(GROUPS))
+    parser.add_argument('--period', type=int,
+                        help='sample period in ms for every active group '
+                             '(default: as configured)')
+    parser.add_argument('--duration', type=int, default=10000,
+                        help='ms to run each point (default 10000)')
+    parser.add_argument('--warmup', type=int, default=2000,
+                        help='ms at the start of each run to leave out (default 2000)')
+    parser.add_argument('--seed', type=int, default=1, help='sensor noise seed')
+    parser.add_argument('--out', default='bench.json', help='result file (default bench.json)')
+    parser.add_argument('--compare', help='earlier result file to compare against')
+    args = parser.parse_args()
+
+    with open(os.path.join(ROOT, 'config.json')) as f:
+        base = json.load(f)
+
+    results = []
+    for interval in args.interval:
+        for sources in args.sources:
+            config, offered, ids = variant(base, interval, sources, args.period)
+            binary = build(config)
+            for baud in args.baud:
+                result = {'baud': baud, 'interval': interval, 'sources': sources,
+                          'ids': ids, 'offered_sps': round(offered, 1)}
+                result.update(run(binary, baud, args.duration, args.warmup, args.seed))
+                results.append(result)
+                print('baud %6d interval %3d sources %d (%2d ids): %7.1f of %7.1f samples/s, '
+                      'latency p50 %s p90 %s p99 %s max %s ms'
+                      % (baud, interval, sources, ids, result['delivered_sps'], offered,
+                         result['latency_ms']['p50'], result['latency_ms']['p90'],
+                         result['latency_ms']['p99'], result['latency_ms']['max']))
+
+    with open(args.out, 'w') as f:
+        json.dump({'commit': commit(), 'duration_ms': args.duration,
+                   'warmup_ms': args.warmup, 'period_ms': args.period, 'runs': results},
+                  f, indent=2)
+
+    if args.compare:
+        compare(results, args.compare)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,318 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2016 Kubos Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Simulated log node for the host build of the sensor node (sim/).
+
+Speaks KISS on stdin/stdout (as started by UKUB_SIM_LOGNODE) or on a
+serial port or pty given with --port. Accepts RDP connections the way a
+libcsp node does (SYN/ACK handshake, one ACK per segment, RST on close,
+no retransmission), decodes the telemetry frames and writes one CSV line
+per sample: arrival time in ms, node timestamp, source id, value. When
+started by the simulator, arrival times are on the node's csp_get_ms()
+clock and mark when the last byte of the frame came off the wire.
+
+--command sends a ground command to the node's command service at a
+given time, e.g. --command 3000:01 asks for a burst capture 3 s in.
+Replies are logged to stderr. --query asks the node's archive for
+samples between two archive times, optionally of given source ids
+only, e.g. --query 8000:0:5000:2,3; the reply goes to --query-out.
+
+--subscriber answers for a second downlink destination as well, such
+as --subscriber 4:second.csv for csp.fanout.dest1 at address 4. --stall
+makes one of the addresses accept connections but never acknowledge
+data, like a consumer that has stopped reading.
+"""
+
+import argparse
+import os
+import random
+import select
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import tlm_decode  # noqa: E402
+
+RDP_SYN = 0x08
+RDP_ACK = 0x04
+RDP_RST = 0x01
+RDP = struct.Struct('>BHH')
+
+# Ports commands and archive queries are sent from, so replies can be
+# told from telemetry
+COMMAND_SPORT = 20
+QUERY_SPORT = 21
+
+
+def kiss_encode(frame):
+    out = bytearray([tlm_decode.KISS_FEND, 0x00])
+    for byte in frame:
+        if byte == tlm_decode.KISS_FEND:
+            out += bytes([tlm_decode.KISS_FESC, tlm_decode.KISS_TFEND])
+        elif byte == tlm_decode.KISS_FESC:
+            out += bytes([tlm_decode.KISS_FESC, tlm_decode.KISS_TFESC])
+        else:
+            out.append(byte)
+    out.append(tlm_decode.KISS_FEND)
+    return bytes(out)
+
+
+class KissReader(object):
+    """Incremental version of tlm_decode.kiss_frames."""
+
+    def __init__(self):
+        self.frame = bytearray()
+        self.escaped = False
+
+    def feed(self, data):
+        frames = []
+        for byte in data:
+            if byte == tlm_decode.KISS_FEND:
+                if len(self.frame) > 1 and self.frame[0] == 0x00:
+                    frames.append(bytes(self.frame[1:]))
+                self.frame = bytearray()
+            elif byte == tlm_decode.KISS_FESC:
+                self.escaped = True
+            elif self.escaped:
+                self.frame.append(tlm_decode.KISS_FEND if byte == tlm_decode.KISS_TFEND
+                                  else tlm_decode.KISS_FESC)
+                self.escaped = False
+            else:
+                self.frame.append(byte)
+        return frames
+
+
+class Connection(object):
+    def __init__(self, rcv_cur):
+        self.rcv_cur = rcv_cur
+        self.snd_nxt = random.randint(0, 0xFFFF)
+
+
+class Consumer(object):
+    def __init__(self, args, out):
+        self.out = out
+        self.decoder = tlm_decode.Decoder(raw=args.raw)
+        self.stalled = False
+
+
+class LogNode(object):
+    def __init__(self, args, write, out):
+        self.address = args.address
+        self.ack_delay = args.ack_delay / 1000.0
+        self.write = write
+        self.consumers = {args.address: Consumer(args, out)}
+        for address, path in args.subscriber:
+            self.consumers[address] = Consumer(args, open(path, 'w'))
+        for address in args.stall:
+            self.consumers[address].stalled = True
+        self.decoder = self.consumers[args.address].decoder
+        self.conns = {}
+        # Started by the simulator, arrivals are timed on the node's clock
+        epoch = os.environ.get('UKUB_SIM_EPOCH_NS')
+        self.start = int(epoch) / 1e9 if epoch else time.monotonic()
+        self.frames = 0
+        self.bad = 0
+        self.query_out = args.query_out
+
+    def now_ms(self):
+        return (time.monotonic() - self.start) * 1000.0
+
+    def send(self, src, dst, dport, sport, flags, data):
+        ext = (2 << 30) | (src << 25) | (dst << 20) | (dport << 14) | (sport << 8) | flags
+        crc = struct.pack('>I', tlm_decode.crc32c(data))
+        self.write(kiss_encode(struct.pack('>I', ext) + data + crc))
+
+    def reply(self, header, conn, flags):
+        _, src, dst, dport, sport, _ = header
+        if self.ack_delay:
+            time.sleep(self.ack_delay)
+        self.send(dst, src, sport, dport, tlm_decode.CSP_FRDP,
+                  RDP.pack(flags, conn.snd_nxt, conn.rcv_cur))
+
+    def frame(self, frame):
+        if len(frame) < tlm_decode.CSP_HEADER_SIZE + tlm_decode.KISS_CRC_SIZE:
+            self.bad += 1
+            return
+        ext = struct.unpack('>I', frame[:4])[0]
+        header = (ext >> 30, (ext >> 25) & 0x1F, (ext >> 20) & 0x1F,
+                  (ext >> 14) & 0x3F, (ext >> 8) & 0x3F, ext & 0xFF)
+        _, src, dst, dport, sport, flags = header
+        body = frame[4:-4]
+        if struct.unpack('>I', frame[-4:])[0] != tlm_decode.crc32c(body):
+            self.bad += 1
+            return
+        consumer = self.consumers.get(dst)
+        if consumer is None:
+            return
+        self.frames += 1
+
+        if dport == COMMAND_SPORT and not flags & tlm_decode.CSP_FRDP:
+            sys.stderr.write('lognode: %.1f command %s status %s\n'
+                             % (self.now_ms(), body[:1].hex(), body[1:].hex()))
+            return
+
+        if dport == QUERY_SPORT and not flags & tlm_decode.CSP_FRDP:
+            self.query_reply(body)
+            return
+
+        if flags & tlm_decode.CSP_FRDP:
+            rdp_flags, seq, _ = RDP.unpack(body[-RDP.size:])
+            data = body[:-RDP.size]
+            key = (dst, src, sport)
+            if rdp_flags & RDP_RST:
+                self.conns.pop(key, None)
+                return
+            if rdp_flags & RDP_SYN:
+                conn = self.conns[key] = Connection(seq)
+                self.reply(header, conn, RDP_SYN | RDP_ACK)
+                conn.snd_nxt += 1
+                return
+            conn = self.conns.get(key)
+            if conn is None or not data or consumer.stalled:
+                return
+            if seq != (conn.rcv_cur + 1) & 0xFFFF:
+                # Out of order or repeated: just ack what we have
+                self.reply(header, conn, RDP_ACK)
+                return
+            conn.rcv_cur = seq
+            self.reply(header, conn, RDP_ACK)
+        else:
+            data = body
+
+        self.deliver(consumer, data)
+
+    def command(self, node, port, data):
+        self.send(self.address, node, port, COMMAND_SPORT, 0, data)
+
+    def query(self, node, port, start, end, ids):
+        data = struct.pack('<II', start, end) + bytes(ids)
+        self.send(self.address, node, port, QUERY_SPORT, 0, data)
+
+    def query_reply(self, data):
+        try:
+            samples, last = tlm_decode.decode_archive(data)
+        except (ValueError, IndexError, struct.error):
+            self.bad += 1
+            return
+        for sample in samples:
+            self.query_out.write('%s\n' % sample)
+        self.query_out.flush()
+        if last:
+            sys.stderr.write('lognode: %.1f archive query done\n' % self.now_ms())
+
+    def deliver(self, consumer, data):
+        arrival = self.now_ms()
+        try:
+            samples = consumer.decoder.decode(data)
+        except (ValueError, IndexError, struct.error):
+            self.bad += 1
+            return
+        for sample in samples:
+            consumer.out.write('%.1f,%s\n' % (arrival, sample))
+        consumer.out.flush()
+
+
+def open_port(path):
+    import termios
+    import tty
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    if os.isatty(fd):
+        tty.setraw(fd)
+        termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd, fd
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--port', help='serial port or pty (default stdin/stdout)')
+    parser.add_argument('--address', type=int, default=3, help='CSP address (default 3)')
+    parser.add_argument('--ack-delay', type=float, default=0,
+                        help='ms to wait before each RDP reply')
+    parser.add_argument('--raw', action='store_true',
+                        help='frames are bare telemetry_packets (batching off)')
+    parser.add_argument('--out', help='CSV file for samples (default stderr)')
+    parser.add_argument('--node', type=int, default=1, help='node CSP address (default 1)')
+    parser.add_argument('--command-port', type=int, default=11,
+                        help='node command port (default 11)')
+    parser.add_argument('--command', action='append', default=[], metavar='MS:HEX',
+                        help='send a command packet at MS, repeatable')
+    parser.add_argument('--archive-port', type=int, default=12,
+                        help='node archive port (default 12)')
+    parser.add_argument('--query', action='append', default=[], metavar='MS:FROM:TO[:IDS]',
+                        help='query the archive at MS, repeatable')
+    parser.add_argument('--query-out', help='CSV file for query replies (default stderr)')
+    parser.add_argument('--subscriber', action='append', default=[], metavar='ADDRESS:FILE',
+                        help='also take telemetry for ADDRESS, writing it to FILE, repeatable')
+    parser.add_argument('--stall', action='append', type=int, default=[], metavar='ADDRESS',
+                        help='never acknowledge data sent to ADDRESS, repeatable')
+    args = parser.parse_args()
+    args.subscriber = [(int(address), path)
+                       for address, path in (s.split(':', 1) for s in args.subscriber)]
+    args.query_out = open(args.query_out, 'w') if args.query_out else sys.stderr
+
+    def command(data):
+        return lambda node: node.command(args.node, args.command_port, bytes.fromhex(data))
+
+    def query(start, end, ids=''):
+        ids = [int(i) for i in ids.split(',') if i]
+        return lambda node: node.query(args.node, args.archive_port, int(start), int(end), ids)
+
+    commands = [(float(ms), command(data))
+                for ms, data in (c.split(':', 1) for c in args.command)]
+    commands += [(float(ms), query(*rest))
+                 for ms, *rest in (q.split(':') for q in args.query)]
+    commands.sort(key=lambda c: c[0])
+
+    if args.port:
+        rfd, wfd = open_port(args.port)
+    else:
+        rfd, wfd = sys.stdin.fileno(), sys.stdout.fileno()
+
+    out = open(args.out, 'w') if args.out else sys.stderr
+    node = LogNode(args, lambda data: os.write(wfd, data), out)
+    reader = KissReader()
+
+    try:
+        while True:
+            while commands and commands[0][0] <= node.now_ms():
+                commands.pop(0)[1](node)
+            if commands:
+                wait = max(commands[0][0] - node.now_ms(), 0) / 1000.0
+                if not select.select([rfd], [], [], wait)[0]:
+                    continue
+            try:
+                data = os.read(rfd, 4096)
+            except OSError:
+                # A pty reads EIO once the node has gone
+                break
+            if not data:
+                break
+            for frame in reader.feed(data):
+                node.frame(frame)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        sys.stderr.write('lognode: %d frames, %d bad, %d samples dropped\n'
+                         % (node.frames, node.bad, node.decoder.dropped))
+        for address, _ in args.subscriber:
+            sys.stderr.write('lognode: %d samples dropped for %d\n'
+                             % (node.consumers[address].decoder.dropped, address))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2016 Kubos Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""
+Ground-side decoder for ukub-sensor-node telemetry frames.
+
+Reads a capture of the KISS byte stream coming out of the node (or of the
+CSP payloads, one hex string per line with --hex) and prints one CSV line
+per sample: timestamp, source id, value.
+
+Frames are bare telemetry_packets (--raw, nodes built with
+csp.batch.enabled false), batches of telemetry_packets (type 0x01), or
+compact fixed-point/delta frames (type 0x02, see source/encode.h).
+"""
+
+import argparse
+import struct
+import sys
+
+FRAME_BATCH = 0x01
+FRAME_COMPACT = 0x02
+FRAME_ARCHIVE = 0x03
+
+# Archive query replies: type, count, flags, reserved, start time
+ARCHIVE_HEADER = struct.Struct('<BBBBI')
+ARCHIVE_FLAG_LAST = 0x01
+
+FLAG_KEYFRAME = 0x01
+# Journal and capture frames have their own sequence and references
+FLAG_BACKLOG = 0x02
+
+KIND_FIXED = 0
+KIND_INT = 1
+KIND_FLOAT = 2
+
+# Must match ENCODE_REF_COUNT in source/encode.h
+REF_COUNT = 32
+
+# Must match source_scale in source/encode.c, indexed by source id
+SOURCE_SCALE = [
+    0, 0,                           # temperature, humidity
+    16384, 16384, 16384, 16384,     # quaternion w, x, y, z
+    16, 16, 16,                     # euler
+    100, 100, 100,                  # gravity
+    100, 100, 100,                  # linear accel
+    100, 100, 100,                  # accel
+]
+
+# Must match SOURCE_STATS_BASE in source/sources.h and stats_value_t in
+# source/stats.h: window summaries are min, max, mean, variance, last
+STATS_BASE = 100
+STATS_COUNT = 5
+STATS_VARIANCE = 3
+
+# Must match SOURCE_CAPTURE_BASE in source/sources.h and capture_value_t
+# in source/capture.h: quaternion w, x, y, z, linear accel x, y, z, then
+# the trigger marker
+CAPTURE_BASE = 190
+CAPTURE_SCALE = [16384, 16384, 16384, 16384, 100, 100, 100]
+
+
+def source_scale(source_id):
+    """Resolution of a source id, as source_scale_of in source/encode.c."""
+    if source_id < len(SOURCE_SCALE):
+        return SOURCE_SCALE[source_id]
+    index = source_id - STATS_BASE
+    if 0 <= index < STATS_COUNT * len(SOURCE_SCALE) and index % STATS_COUNT != STATS_VARIANCE:
+        return SOURCE_SCALE[index // STATS_COUNT]
+    index = source_id - CAPTURE_BASE
+    if 0 <= index < len(CAPTURE_SCALE):
+        return CAPTURE_SCALE[index]
+    return 0
+
+
+# telemetry_packet as laid out by arm-none-eabi-gcc (and x86 gcc):
+# source_id, data_type, subsystem_mask, data, timestamp
+PACKET = struct.Struct('<B3xIH2x4sH2x')
+TELEMETRY_TYPE_INT = 0
+
+KISS_FEND = 0xC0
+KISS_FESC = 0xDB
+KISS_TFEND = 0xDC
+KISS_TFESC = 0xDD
+
+CSP_HEADER_SIZE = 4
+KISS_CRC_SIZE = 4
+CSP_FCRC32 = 0x01
+CSP_FRDP = 0x02
+RDP_HEADER_SIZE = 5
+
+
+class Sample(object):
+    def __init__(self, timestamp, source_id, value, is_int):
+        self.timestamp = timestamp
+        self.source_id = source_id
+        self.value = value
+        self.is_int = is_int
+
+    def __str__(self):
+        value = '%d' % self.value if self.is_int else '%.6g' % self.value
+        return '%d,%d,%s' % (self.timestamp, self.source_id, value)
+
+
+def decode_packet(data):
+    source_id, data_type, _, raw, timestamp = PACKET.unpack(data)
+    if data_type == TELEMETRY_TYPE_INT:
+        return Sample(timestamp, source_id, struct.unpack('<i', raw)[0], True)
+    return Sample(timestamp, source_id, struct.unpack('<f', raw)[0], False)
+
+
+def decode_archive(payload):
+    """
+    Decode an archive query reply. Timestamps come back as full archive
+    times. Returns the samples and whether this was the last frame.
+    """
+    _, count, flags, _, start = ARCHIVE_HEADER.unpack_from(payload)
+    samples = []
+    for i in range(count):
+        offset = ARCHIVE_HEADER.size + i * PACKET.size
+        sample = decode_packet(payload[offset:offset + PACKET.size])
+        sample.timestamp = start + ((sample.timestamp - start) & 0xFFFF)
+        samples.append(sample)
+    return samples, bool(flags & ARCHIVE_FLAG_LAST)
+
+
+def get_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def to_int32(value):
+    value &= 0xFFFFFFFF
+    return value - 0x100000000 if value & 0x80000000 else value
+
+
+class Stream(object):
+    def __init__(self):
+        self.refs = [0] * REF_COUNT
+        self.seq = None
+        self.synced = False
+
+
+class Decoder(object):
+    """
+    Keeps the per-source delta references of the compact encoding, for
+    the live and backlog streams apart. After a lost frame every compact
+    frame of its stream is dropped until the next keyframe.
+    """
+
+    def __init__(self, raw=False):
+        self.raw = raw
+        self.streams = {0: Stream(), FLAG_BACKLOG: Stream()}
+        self.dropped = 0
+
+    def decode(self, payload):
+        if self.raw:
+            return [decode_packet(payload[:PACKET.size])]
+        if not payload:
+            return []
+        if payload[0] == FRAME_BATCH:
+            count = payload[1]
+            return [decode_packet(payload[2 + i * PACKET.size:2 + (i + 1) * PACKET.size])
+                    for i in range(count)]
+        if payload[0] == FRAME_COMPACT:
+            return self.decode_compact(payload)
+        if payload[0] == FRAME_ARCHIVE:
+            return decode_archive(payload)[0]
+        raise ValueError('unknown frame type 0x%02x' % payload[0])
+
+    def decode_compact(self, payload):
+        _, count, seq, flags, base = struct.unpack_from('<BBBBH', payload)
+        stream = self.streams[flags & FLAG_BACKLOG]
+
+        if stream.seq is not None and seq != (stream.seq + 1) & 0xFF:
+            stream.synced = False
+        stream.seq = seq
+
+        if flags & FLAG_KEYFRAME:
+            stream.refs = [0] * REF_COUNT
+            stream.synced = True
+        if not stream.synced:
+            self.dropped += count
+            return []
+
+        samples = []
+        pos = 6
+        for _ in range(count):
+            source_id = payload[pos]
+            pos += 1
+            tag, pos = get_varint(payload, pos)
+            raw, pos = get_varint(payload, pos)
+            kind = tag & 0x03
+            timestamp = (base + (tag >> 2)) & 0xFFFF
+
+            if kind == KIND_FLOAT:
+                value = struct.unpack('<f', struct.pack('<I', raw))[0]
+                samples.append(Sample(timestamp, source_id, value, False))
+                continue
+
+            value = unzigzag(raw)
+            if source_id < REF_COUNT:
+                value = to_int32(stream.refs[source_id] + value)
+                stream.refs[source_id] = value
+
+            if kind == KIND_INT:
+                samples.append(Sample(timestamp, source_id, value, True))
+            else:
+                samples.append(Sample(timestamp, source_id,
+                                      float(value) / source_scale(source_id), False))
+        return samples
+
+
+def kiss_frames(stream):
+    """Split a KISS byte stream into unescaped frames, command byte removed."""
+    frame = bytearray()
+    escaped = False
+    for byte in stream:
+        if byte == KISS_FEND:
+            if len(frame) > 1 and frame[0] == 0x00:
+                yield bytes(frame[1:])
+            frame = bytearray()
+        elif byte == KISS_FESC:
+            escaped = True
+        elif escaped:
+            frame.append(KISS_FEND if byte == KISS_TFEND else KISS_FESC)
+            escaped = False
+        else:
+            frame.append(byte)
+
+
+def crc32c(data):
+    """CRC32-C, as libcsp's csp_crc32_memory."""
+    crc = 0xFFFFFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82F63B78 if crc & 1 else 0)
+    return crc ^ 0xFFFFFFFF
+
+
+def csp_payload(frame):
+    """
+    Strip the CSP header, the CRC32 the KISS interface appends, and any
+    RDP/CRC32 trailer. None for RDP control segments and corrupt frames.
+    """
+    if len(frame) < CSP_HEADER_SIZE + KISS_CRC_SIZE:
+        return None
+    flags = struct.unpack('>I', frame[:CSP_HEADER_SIZE])[0] & 0xFF
+    payload = frame[CSP_HEADER_SIZE:-KISS_CRC_SIZE]
+    if struct.unpack('>I', frame[-KISS_CRC_SIZE:])[0] != crc32c(payload):
+        return None
+    if flags & CSP_FCRC32:
+        payload = payload[:-4]
+    if flags & CSP_FRDP:
+        payload = payload[:-RDP_HEADER_SIZE]
+    return payload or None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('capture', nargs='?', help='capture file (default stdin)')
+    parser.add_argument('--hex', action='store_true',
+                        help='input is one hex CSP payload per line')
+    parser.add_argument('--raw', action='store_true',
+                        help='frames are bare telemetry_packets (batching off)')
+    args = parser.parse_args()
+
+    stream = open(args.capture, 'rb') if args.capture else sys.stdin.buffer
+    decoder = Decoder(raw=args.raw)
+
+    if args.hex:
+        payloads = (bytes.fromhex(line.decode().strip()) for line in stream if line.strip())
+    else:
+        payloads = (csp_payload(frame) for frame in kiss_frames(stream.read()))
+
+    for payload in payloads:
+        if payload is None:
+            continue
+        for sample in decoder.decode(payload):
+            print(sample)
+
+    if decoder.dropped:
+        sys.stderr.write('%d samples dropped waiting for a keyframe\n' % decoder.dropped)
+
+
+if __name__ == '__main__':
+    main()